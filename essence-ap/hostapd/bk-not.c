@@ -762,6 +762,15 @@ static void process_incoming(char *buf, size_t len){
 	
 	char *pos = buf;
 
+	/* Events are tagged with the BSS they come from */
+	if (os_strncmp(pos, "IFNAME=", 7) == 0){
+		pos = os_strchr(pos, ' ');
+		if (pos == NULL)
+			return;
+		pos++;
+		len -= pos - buf;
+	}
+
 	if (os_strncmp(pos, "NEWNODE" , 7) == 0){
 		compute_notification(pos + 7, len -7);
 	} else if (os_strncmp(pos, "NOT_RESP" , 8) == 0){
@@ -4333,6 +4333,13 @@ static int hostapd_config_fill(struct hostapd_config *conf,
 	} else if (os_strcmp(buf, "coloc_intf_reporting") == 0) {
 		bss->coloc_intf_reporting = atoi(pos);
 #endif /* CONFIG_OWE */
+#ifdef CONFIG_ACTION_NOTIFICATION
+	} else if (os_strcmp(buf, "notification_journal") == 0) {
+		os_free(bss->notification_journal);
+		bss->notification_journal = os_strdup(pos);
+	} else if (os_strcmp(buf, "notification_journal_size") == 0) {
+		bss->notification_journal_size = atoi(pos);
+#endif /* CONFIG_ACTION_NOTIFICATION */
 	} else if (os_strcmp(buf, "multi_ap") == 0) {
 		int val = atoi(pos);
 
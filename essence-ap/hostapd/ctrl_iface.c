@@ -3191,6 +3191,10 @@ static int hostapd_ctrl_iface_receive_process(struct hostapd_data *hapd,
 		if (hapd_cmd_delete_brdcst_not(hapd, buf + 7)){
 			reply_len = -1;
 		}
+	} else if (os_strcmp(buf, "HYPERLOCAL_STATS") == 0) {
+		reply_len = hostapd_not_stats(hapd, reply, reply_size);
+	} else if (os_strcmp(buf, "HYPERLOCAL_STATS_RESET") == 0) {
+		hostapd_not_stats_reset(hapd);
 #endif /* CONFIG_ACTION_NOTIFICATION */
 	} else if (os_strncmp(buf, "EAPOL_REAUTH ", 13) == 0) {
 		if (hostapd_ctrl_iface_eapol_reauth(hapd, buf + 13))
@@ -0,0 +1,263 @@
+"""asyncio binding of libhyperlocal
+
+Drives the hostapd notification socket or the wpa_supplicant wpa_wipush
+socket from an asyncio loop, see src/common/hyperlocal_client.h. Every
+request returns an awaitable with its result and the events go to the
+on_event callback. The library is looked for next to this file unless
+LIBHYPERLOCAL names it.
+
+    client = hyperlocal.Client(hyperlocal.AP,
+                               "/var/run/hostapd/notification",
+                               events="NOT_RESP", on_event=handle)
+    mid = await client.push(addr, b"hello")
+"""
+
+import asyncio
+import itertools
+import os
+from ctypes import (CDLL, CFUNCTYPE, POINTER, Structure, byref, c_char_p,
+                    c_int, c_size_t, c_uint, c_uint8, c_uint16, c_uint32,
+                    c_void_p, get_errno, string_at)
+
+AP = 0
+STA = 1
+
+EVENT_AP = 0
+EVENT_MSG = 1
+EVENT_ANNOUNCE = 2
+EVENT_QFAIL = 3
+EVENT_QDONE = 4
+
+PRIO_NORMAL = 0
+PRIO_URGENT = 1
+PRIO_BULK = 2
+
+
+class _Event(Structure):
+    _fields_ = [("type", c_int),
+                ("ifname", c_char_p),
+                ("name", c_char_p),
+                ("addr", c_uint8 * 6),
+                ("msg_type", c_uint8),
+                ("kind", c_uint8),
+                ("check", c_uint16),
+                ("mid", c_uint32),
+                ("qid", c_uint32),
+                ("answered", c_uint16),
+                ("failed", c_uint16),
+                ("data", c_void_p),
+                ("len", c_size_t)]
+
+
+class _Push(Structure):
+    _fields_ = [("dst", c_uint8 * 6),
+                ("topic", c_int),
+                ("type", c_uint8),
+                ("prio", c_uint8),
+                ("ttl", c_uint32),
+                ("payload", c_char_p),
+                ("len", c_size_t)]
+
+
+_EVENT_CB = CFUNCTYPE(None, c_void_p, POINTER(_Event))
+_DONE_CB = CFUNCTYPE(None, c_void_p, c_int, c_uint32)
+_BATCH_CB = CFUNCTYPE(None, c_void_p, c_int, POINTER(c_uint32), c_size_t)
+
+
+def _load(path=None):
+    if path is None:
+        path = os.environ.get("LIBHYPERLOCAL") or os.path.join(
+            os.path.dirname(os.path.abspath(__file__)), "libhyperlocal.so")
+    lib = CDLL(path, use_errno=True)
+    lib.hl_client_open.restype = c_void_p
+    lib.hl_client_open.argtypes = [c_int, c_char_p, c_char_p, c_char_p,
+                                   _EVENT_CB, c_void_p]
+    lib.hl_client_close.argtypes = [c_void_p]
+    lib.hl_client_fd.argtypes = [c_void_p]
+    lib.hl_client_process.argtypes = [c_void_p]
+    lib.hl_subscribe.argtypes = [c_void_p, c_char_p, _DONE_CB, c_void_p]
+    lib.hl_push.argtypes = [c_void_p, POINTER(_Push), _DONE_CB, c_void_p]
+    lib.hl_push_batch.argtypes = [c_void_p, POINTER(_Push), c_size_t,
+                                  _BATCH_CB, c_void_p]
+    lib.hl_answer.argtypes = [c_void_p, c_char_p, c_uint32, c_uint32,
+                              c_char_p, c_size_t, _DONE_CB, c_void_p]
+    lib.hl_query.argtypes = [c_void_p, c_char_p, c_char_p, c_size_t,
+                             _DONE_CB, c_void_p]
+    lib.hl_topic.argtypes = [c_void_p, c_char_p, c_uint, c_int, _DONE_CB,
+                             c_void_p]
+    return lib
+
+
+def _mac(addr):
+    """bytes of an "xx:xx:xx:xx:xx:xx" address, or None for None"""
+    if addr is None or isinstance(addr, bytes):
+        return addr
+    return bytes(int(x, 16) for x in addr.split(":"))
+
+
+def _macstr(addr):
+    return ":".join("%02x" % b for b in addr)
+
+
+class Event:
+    """An event, see struct hl_event"""
+
+    def __init__(self, ev):
+        self.type = ev.type
+        self.ifname = ev.ifname.decode() if ev.ifname else None
+        self.name = ev.name.decode() if ev.name else None
+        self.addr = _macstr(ev.addr)
+        self.msg_type = ev.msg_type
+        self.kind = ev.kind
+        self.check = ev.check
+        self.mid = ev.mid
+        self.qid = ev.qid
+        self.answered = ev.answered
+        self.failed = ev.failed
+        # The event only lives during the callback, so the data is copied
+        self.data = string_at(ev.data, ev.len) if ev.len else b""
+
+    def __repr__(self):
+        return "Event(%r)" % self.__dict__
+
+
+class HyperlocalError(OSError):
+    pass
+
+
+class Client:
+    """One handle, on the loop it was made on"""
+
+    def __init__(self, kind, path, ifname=None, events=None, on_event=None,
+                 loop=None, lib=None):
+        self._lib = lib or _load()
+        self._loop = loop or asyncio.get_event_loop()
+        self._futures = {}
+        self._tokens = itertools.count(1)
+        self._on_event = on_event
+        # ctypes frees a callback with its last reference
+        self._event_cb = _EVENT_CB(self._event)
+        self._done_cb = _DONE_CB(self._done)
+        self._batch_cb = _BATCH_CB(self._batch)
+
+        self._h = self._lib.hl_client_open(
+            kind, path.encode(), ifname.encode() if ifname else None,
+            events.encode() if events else None,
+            self._event_cb if on_event else _EVENT_CB(), None)
+        if not self._h:
+            raise self._error()
+        self._loop.add_reader(self._lib.hl_client_fd(self._h), self._process)
+
+    def close(self):
+        if self._h:
+            self._loop.remove_reader(self._lib.hl_client_fd(self._h))
+            self._lib.hl_client_close(self._h)
+            self._h = None
+
+    def _error(self):
+        err = get_errno()
+        return HyperlocalError(err, os.strerror(err))
+
+    def _process(self):
+        if self._lib.hl_client_process(self._h) < 0:
+            err = self._error()
+            futures, self._futures = self._futures, {}
+            for fut in futures.values():
+                if not fut.done():
+                    fut.set_exception(err)
+
+    def _event(self, ctx, ev):
+        self._on_event(Event(ev.contents))
+
+    def _request(self):
+        token = next(self._tokens)
+        fut = self._loop.create_future()
+        self._futures[token] = fut
+        return token, fut
+
+    def _check(self, res, token):
+        if res < 0:
+            self._futures.pop(token)
+            raise self._error()
+
+    def _done(self, ctx, status, id):
+        fut = self._futures.pop(ctx, None)
+        if fut is None or fut.done():
+            return
+        if status < 0:
+            fut.set_exception(HyperlocalError("request failed"))
+        else:
+            fut.set_result(id)
+
+    def _batch(self, ctx, status, mids, count):
+        fut = self._futures.pop(ctx, None)
+        if fut is not None and not fut.done():
+            # Rejected records have mid 0, the status says if there are any
+            fut.set_result(mids[:count])
+
+    def subscribe(self, events=None):
+        token, fut = self._request()
+        self._check(self._lib.hl_subscribe(
+            self._h, events.encode() if events else None, self._done_cb,
+            token), token)
+        return fut
+
+    @staticmethod
+    def _push(dst=None, payload=b"", type=0, prio=PRIO_NORMAL, ttl=0,
+              topic=-1):
+        p = _Push()
+        if dst is not None:
+            p.dst[:] = _mac(dst)
+        p.topic = topic
+        p.type = type
+        p.prio = prio
+        p.ttl = ttl
+        p.payload = payload
+        p.len = len(payload)
+        return p
+
+    def push(self, dst, payload, **kw):
+        """Queue payload for dst, or for topic=<id>, the result is the mid"""
+        p = self._push(dst, payload, **kw)
+        token, fut = self._request()
+        self._check(self._lib.hl_push(self._h, byref(p), self._done_cb,
+                                      token), token)
+        return fut
+
+    def push_batch(self, pushes):
+        """pushes are (dst, payload) or dicts of push() arguments"""
+        arr = (_Push * len(pushes))()
+        for i, p in enumerate(pushes):
+            arr[i] = (self._push(**p) if isinstance(p, dict)
+                      else self._push(*p))
+        token, fut = self._request()
+        self._check(self._lib.hl_push_batch(self._h, arr, len(pushes),
+                                            self._batch_cb, token), token)
+        return fut
+
+    def answer(self, addr, qid, payload, ttl=0):
+        """Answer the query qid of addr, or of a NOT_QRY with addr None"""
+        token, fut = self._request()
+        self._check(self._lib.hl_answer(self._h, _mac(addr), qid, ttl,
+                                        payload, len(payload),
+                                        self._done_cb, token), token)
+        return fut
+
+    def query(self, bssid, payload):
+        """Ask bssid, or every AP with None, the result is the qid
+
+        The answers are on_event events, a client without one cannot ask.
+        """
+        token, fut = self._request()
+        self._check(self._lib.hl_query(self._h, _mac(bssid), payload,
+                                       len(payload), self._done_cb, token),
+                    token)
+        return fut
+
+    def topic(self, bssid, topic, join=True):
+        token, fut = self._request()
+        self._check(self._lib.hl_topic(self._h, _mac(bssid), topic,
+                                       1 if join else 0, self._done_cb,
+                                       token), token)
+        return fut
+
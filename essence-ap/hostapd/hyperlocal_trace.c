@@ -0,0 +1,163 @@
+/*
+ * hyperlocal_trace - Reader of the hostapd hyperlocal trace ring
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * Drains the ring that hostapd built with CONFIG_HYPERLOCAL_TRACE writes to
+ * <ctrl_interface>/notification.trace and prints one line per event. The
+ * events read are released, so only one reader should run at a time.
+ */
+
+#include "utils/includes.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "utils/common.h"
+#include "ap/ap_action_trace.h"
+
+static const struct {
+	const char *name;
+	const char *a;
+	const char *b;
+} trace_events[AFQ_TR_NUM] = {
+	[AFQ_TR_PROBE] = { "PROBE", "num", NULL },
+	[AFQ_TR_RX] = { "RX", "action", "len" },
+	[AFQ_TR_NODE_ADD] = { "NODE_ADD", NULL, NULL },
+	[AFQ_TR_NODE_DEL] = { "NODE_DEL", NULL, NULL },
+	[AFQ_TR_PUSH] = { "PUSH", "mid", "prio_len" },
+	[AFQ_TR_QUEUE] = { "QUEUE", "mid", "now" },
+	[AFQ_TR_SEND_BCAST] = { "SEND_BCAST", "mid", NULL },
+	[AFQ_TR_SEND_DIRECT] = { "SEND_DIRECT", "mid", NULL },
+	[AFQ_TR_AGG] = { "AGG", "count", "len" },
+	[AFQ_TR_FRAG] = { "FRAG", "mid", "frag" },
+	[AFQ_TR_FETCH_REQ] = { "FETCH_REQ", "timeout", NULL },
+	[AFQ_TR_FETCH] = { "FETCH", NULL, NULL },
+	[AFQ_TR_QUERY] = { "QUERY", "qmid", "len" },
+	[AFQ_TR_EVENT] = { "EVENT", "event", "sent" },
+	[AFQ_TR_TX] = { "TX", "len", "prio" },
+	[AFQ_TR_TX_STATUS] = { "TX_STATUS", "action", "ack" },
+};
+
+
+static void trace_print(const struct afq_trace_rec *rec)
+{
+	const char *name = "UNKNOWN";
+	const char *a = "a", *b = "b";
+
+	if (rec->event < AFQ_TR_NUM && trace_events[rec->event].name){
+		name = trace_events[rec->event].name;
+		a = trace_events[rec->event].a;
+		b = trace_events[rec->event].b;
+	}
+
+	printf("%llu.%06llu %-11s " MACSTR,
+	       (unsigned long long) (rec->usec / 1000000),
+	       (unsigned long long) (rec->usec % 1000000), name,
+	       MAC2STR(rec->addr));
+	if (a)
+		printf(" %s=%u", a, rec->a);
+	if (b)
+		printf(" %s=%u", b, rec->b);
+	printf("\n");
+}
+
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: hyperlocal_trace [-f] [-s] <trace file>\n"
+		"  -f  keep waiting for new events\n"
+		"  -s  skip the events already in the ring\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct afq_trace_hdr *hdr;
+	struct afq_trace_rec *ring, rec;
+	struct stat st;
+	u64 head, tail, dropped = 0, d;
+	int follow = 0, skip = 0;
+	int fd, c;
+
+	for (;;){
+		c = getopt(argc, argv, "fs");
+		if (c < 0)
+			break;
+		switch (c){
+		case 'f':
+			follow = 1;
+			break;
+		case 's':
+			skip = 1;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	if (optind != argc - 1){
+		usage();
+		return 1;
+	}
+
+	fd = open(argv[optind], O_RDWR);
+	if (fd < 0 || fstat(fd, &st) < 0){
+		perror(argv[optind]);
+		return 1;
+	}
+	if ((size_t) st.st_size < sizeof(*hdr)){
+		fprintf(stderr, "%s: not a trace file\n", argv[optind]);
+		return 1;
+	}
+	hdr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		   0);
+	close(fd);
+	if (hdr == MAP_FAILED){
+		perror("mmap");
+		return 1;
+	}
+
+	if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) !=
+	    AFQ_TRACE_MAGIC || hdr->version != AFQ_TRACE_VERSION ||
+	    hdr->rec_size != sizeof(rec) || hdr->num == 0 ||
+	    (hdr->num & (hdr->num - 1)) ||
+	    (size_t) st.st_size < sizeof(*hdr) + (size_t) hdr->num *
+	    sizeof(rec)){
+		fprintf(stderr, "%s: not a version %d trace file\n",
+			argv[optind], AFQ_TRACE_VERSION);
+		return 1;
+	}
+	ring = (struct afq_trace_rec *) (hdr + 1);
+
+	tail = hdr->tail;
+	if (skip)
+		tail = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+
+	for (;;){
+		head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+		while (tail != head){
+			rec = ring[tail & (hdr->num - 1)];
+			tail++;
+			trace_print(&rec);
+		}
+		__atomic_store_n(&hdr->tail, tail, __ATOMIC_RELEASE);
+
+		d = __atomic_load_n(&hdr->dropped, __ATOMIC_RELAXED);
+		if (d != dropped){
+			fprintf(stderr, "%llu events dropped\n",
+				(unsigned long long) (d - dropped));
+			dropped = d;
+		}
+
+		if (!follow)
+			break;
+		fflush(stdout);
+		usleep(100000);
+	}
+
+	munmap(hdr, st.st_size);
+	return 0;
+}
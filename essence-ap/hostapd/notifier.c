@@ -8,7 +8,6 @@
 
 #include "includes.h"
 #include <dirent.h>
-#include <netdb.h>
 
 #include "common/wpa_ctrl.h"
 #include "common/ieee802_11_defs.h"
@@ -17,6 +16,7 @@
 #include "utils/edit.h"
 #include "common/version.h"
 #include "common/cli.h"
+#include "common/hyperlocal_ring.h"
 
 #ifndef CONFIG_NO_CTRL_IFACE
 
@@ -76,47 +76,21 @@ static void usage(void)
 	print_help(stderr, NULL);
 }
 
-int *pystub_sockfd;
-#define NOT_PYSTUB_PORT_NO 9998
-static int not_connect_pystub()
-{
-	int sockfd, portno, n;
-	
-	struct sockaddr_in serv_addr;
-	struct hostent *server;
-	
-	char buffer[256];
+/* Events for the application, see hyperlocal_ring.h */
+#define NOT_RING_SIZE (256 * 1024)
+static struct hl_ring *not_ring;
 
-	portno = NOT_PYSTUB_PORT_NO;
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	if (sockfd < 0){
-		printf("ERROR opening socket for pystub\n");
-		return -1;
-	}
-	server = gethostbyname("localhost");
-	if (server == NULL){
-		printf("ERROR, no such host\n");
-		return -1;
-	}
-	bzero((char *) &serv_addr, sizeof(serv_addr));
-	serv_addr.sin_family = AF_INET;
-	bcopy((char *)server->h_addr, 
-	     (char *)&serv_addr.sin_addr.s_addr,
-	     server->h_length);
-	serv_addr.sin_port = htons(portno);
-	if (connect(sockfd,(struct sockaddr *)&serv_addr,sizeof(serv_addr)) < 0){ 
-		printf("ERROR connecting the pystub\n");
-		return -1;
-	}
-
-	printf("Successfully connected to pystub\n");	
-	pystub_sockfd = &sockfd;
-	return 0;
-}
-
-static int not_disconnect_pystub()
+/*
+ * The ring the events go to. The application calls this before it runs
+ * wpa_not_init() in another thread and reads the events from the ring in
+ * place. The ring stays as long as the library is loaded, so the last
+ * events can be read after wpa_not_init() returns.
+ */
+struct hl_ring * not_event_ring(void)
 {
-	close(*pystub_sockfd);
+	if (not_ring == NULL)
+		not_ring = hl_ring_create(NOT_RING_SIZE);
+	return not_ring;
 }
 
 static void register_event_handler(struct wpa_ctrl *ctrl)
@@ -1895,7 +1869,8 @@ static void hostapd_cli_recv_pending(struct wpa_ctrl *ctrl, int in_read,
 				if (in_read && first)
 					printf("\n");
 				first = 0;
-				write(*pystub_sockfd, buf+8, len-8);
+				if (not_ring && len > 8)
+					hl_ring_write(not_ring, buf + 8, len - 8);
 			}
 		} else {
 			printf("Could not read pending message.\n");
@@ -2188,7 +2163,7 @@ int wpa_not_init(int argc, char *argv[])
 		os_sleep(1, 0);
 		continue;
 	}
-	not_connect_pystub();
+	not_event_ring();
 
 	if (action_file && !hostapd_cli_attached)
 		return -1;
@@ -2205,7 +2180,6 @@ int wpa_not_init(int argc, char *argv[])
 	unregister_event_handler(ctrl_conn);
 	os_free(ctrl_ifname);
 	eloop_destroy();
-	not_disconnect_pystub();
 	hostapd_cli_cleanup();
 	return 0;
 }
@@ -1,34 +1,33 @@
-import time
-import socket
+import asyncio
+import re
 import sys
-from ctypes import cdll
-from thread import *
 
-lib = cdll.LoadLibrary('./notifier.so')
+import hyperlocal
 
-message = "PUSH 00:e0:4c:7d:f1:ac 0 I am good, thank you! :ENDNOT:"
+path = sys.argv[1] if len(sys.argv) > 1 else "/var/run/hostapd/notification"
 
-def start_pystub_listener(p):
-    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
-    try:
-    	s.bind(("localhost", 9998))
-    except socket.error as msg:
-    	print 'Bind failed. Error Code : ' + str(msg[0]) + ' Message ' + msg[1]
-    	sys.exit()
-    	
-    s.listen(10)
-    conn, addr = s.accept()
+message = b"I am good, thank you!"
+
+# "Addr:<addr>-MID:<mid>-<payload>..." of a NOT_RESP event
+not_resp = re.compile(rb"Addr:([0-9a-f:]{17})-MID:(\d+)-(.*)", re.S)
+
+
+async def main():
+    events = asyncio.Queue()
+    client = hyperlocal.Client(hyperlocal.AP, path, events="NOT_RESP",
+                               on_event=events.put_nowait)
 
     while True:
-        data = conn.recv(1024)
-        if len(data) > 0:
-            print "Data received: ", data
-            print "MAC ID: ", data[:17]
-            print "Query ID: ", data[17]
-            print "Payload: ", data[18:]
-            time.sleep(0.5)
-            lib.not_process_command(message)
-
-start_new_thread(start_pystub_listener, (0,))
-
-lib.wpa_not_init(0, 0)
+        ev = await events.get()
+        m = not_resp.match(ev.data)
+        if m is None:
+            continue
+        addr = m.group(1).decode()
+        print("Data received:", ev.data)
+        print("MAC ID:", addr)
+        print("Payload:", m.group(3))
+        mid = await client.push(addr, message)
+        print("Answer queued, MID", mid)
+
+
+asyncio.run(main())
@@ -18,157 +18,581 @@
 #include "sta_info.h"
 #include "ap_drv_ops.h"
 #include "ap_action.h"
+#include "ap_action_i.h"
+#include "common/hyperlocal_ctrl.h"
 
 struct not_ctrl_dst {
+	struct dl_list list; /* afq_global::dst */
 	struct sockaddr_un addr;
 	socklen_t addrlen;
+	u32 events; /* HAPD_NOT_EV_* */
 	int errors;
 };
 
-struct afq_mes{
-	char *payload;
+#define HAPD_NOT_MAX_DST 16
+
+static const struct {
+	const char *name;
+	u32 event;
+} not_events[] = {
+	{ "NEWNODE", HAPD_NOT_EV_NEWNODE },
+	{ "OLDNODE", HAPD_NOT_EV_OLDNODE },
+	{ "NOT_RESP", HAPD_NOT_EV_NOT_RESP },
+	{ "SENDMSG", HAPD_NOT_EV_SENDMSG },
+	{ "DELIVERED", HAPD_NOT_EV_DELIVERED },
+	{ "FAILED", HAPD_NOT_EV_FAILED },
+	{ "NOT_QRY", HAPD_NOT_EV_NOT_QRY },
+	{ "SUBSCRIBE", HAPD_NOT_EV_SUBSCRIBE },
+	{ NULL, 0 }
+};
+
+/* PUSH header plus the largest payload */
+#define HAPD_NOT_RXBUF_LEN (HYPERLOCAL_MAX_PAYLOAD + 256)
+/* Text replies are limited to 4096 bytes, binary ones to a full MID list */
+#define HAPD_NOT_TXBUF_LEN \
+	(HL_CTRL_HDR_LEN + HL_CTRL_MAX_RECORDS * HL_CTRL_PUSH_MID_LEN)
+#define HAPD_NOT_TEXT_REPLY_LEN 4096
+
+/*
+ * Fragmented transfer of a message that does not fit in one frame. The
+ * station pulls the fragments with WLAN_PA_HYPERLOCAL_COMEBACK_REQ, so the
+ * transfer can be resumed at any fragment until its last fragment is
+ * acknowledged or it expires.
+ */
+struct afq_xfer {
+	struct dl_list list;
+	u8 addr[ETH_ALEN];
+	struct afq_frame *frame;
 	size_t paylen;
 	u8 type;
+	u8 prio;
 	u32 mid;
-	struct afq_mes *next;
+	u16 num;
+	u16 frag_len; /* hapd->frag_len when the transfer started */
+	struct afq_timer timer;
 };
 
-struct afq {
-	u8 addr[ETH_ALEN];
-	u32 last_bcst_mes_id;
-	int computed;
-	struct afq_mes *pending;
-	struct afq_mes *last;
-	struct afq *next;
+static int stop_not_connection(struct afq_global *g, struct sockaddr_un *addr, socklen_t addrlen);
+static void hapd_not_node_timeout(struct hostapd_data *hapd, void *ctx);
+static void hapd_not_mes_timeout(struct hostapd_data *hapd, void *ctx);
+static void afq_xfer_timeout(struct hostapd_data *hapd, void *ctx);
+static int afq_push_frame(struct hostapd_data *hapd, const u8 *addr,
+			  struct afq_frame *frame, u8 type, u8 prio, u32 mid,
+			  size_t len, u32 ttl, int defer, int fanout);
+
+/* Pending messages a station may have per class */
+static const u16 afq_prio_qlen[AFQ_PRIO_NUM] = { 32, 128, 64 };
+static const char * const afq_prio_names[AFQ_PRIO_NUM] = {
+	"urgent", "normal", "bulk"
 };
 
-static int stop_not_connection(struct hostapd_data *hapd, struct sockaddr_un *addr, socklen_t addrlen);
-static void hapd_not_node_timeout(void *eloop_ctx, void *timeout_ctx);
-static void hapd_not_brct_timeout(void *eloop_ctx, void *timeout_ctx);
-
-static int getLoc(const u8 *addr){
-	int loc;
+int afq_prio_parse(const char *name)
+{
+	int prio;
 
-	if (is_broadcast_ether_addr(addr)){
-		loc = 0;
-	}else{
-		loc = STA_HASH(addr) + 1;
+	for (prio = 0; prio < AFQ_PRIO_NUM; prio++){
+		if (os_strncmp(name, afq_prio_names[prio],
+			       os_strlen(afq_prio_names[prio])) == 0)
+			return prio;
 	}
 
-	return loc;
+	return -1;
 }
 
-static struct afq *getNode(struct hostapd_data *hapd,
-					 const u8 *addr){
-	struct afq *node;
+const char * afq_prio_name(u8 prio)
+{
+	return prio < AFQ_PRIO_NUM ? afq_prio_names[prio] : "unknown";
+}
 
-	int loc = getLoc(addr);
+static void afq_pending_reset(struct afq *node)
+{
+	node->pending = NULL;
+	os_memset(node->tail, 0, sizeof(node->tail));
+	os_memset(node->qlen, 0, sizeof(node->qlen));
+}
 
-	node = hapd->pend_list[loc];
+/* Insert mes behind the last pending message of its class or a more urgent one */
+static void afq_pending_insert(struct afq *node, struct afq_mes *mes)
+{
+	struct afq_mes *prev = NULL;
+	int prio;
+
+	for (prio = mes->prio; prio >= 0 && prev == NULL; prio--)
+		prev = node->tail[prio];
 
-	while (node != NULL && os_memcmp(node->addr, addr, ETH_ALEN) != 0){
-		node = node->next;
+	if (prev){
+		mes->next = prev->next;
+		prev->next = mes;
+	}else{
+		mes->next = node->pending;
+		node->pending = mes;
 	}
+	node->tail[mes->prio] = mes;
+	node->qlen[mes->prio]++;
+}
 
-	return node;
+/* Unlink mes from the pending list, prev is the message before it or NULL */
+static void afq_pending_unlink(struct afq *node, struct afq_mes *mes,
+			       struct afq_mes *prev)
+{
+	if (prev)
+		prev->next = mes->next;
+	else
+		node->pending = mes->next;
 
+	if (node->tail[mes->prio] == mes)
+		node->tail[mes->prio] = prev && prev->prio == mes->prio ? prev :
+			NULL;
+	node->qlen[mes->prio]--;
+	mes->next = NULL;
 }
 
 static struct afq *addNode(struct hostapd_data *hapd,
 					const u8 *addr){
 	struct afq *node;
-	int loc;
 
-	node = os_malloc(sizeof(struct afq));
+	node = afq_node_alloc(hapd, addr);
 	if (node == NULL) {
-		wpa_printf(MSG_ERROR, "malloc failed");
+		wpa_printf(MSG_ERROR, "No node for " MACSTR, MAC2STR(addr));
 		return NULL;
 	}
 
-	wpa_printf(MSG_DEBUG, "Adding new node for " MACSTR, MAC2STR(addr));
+	AFQ_TRACE(AFQ_TR_NODE_ADD, addr, 0, 0);
 
-	os_memcpy(node->addr, addr, ETH_ALEN);
-	node->pending = NULL;
-	node->last = NULL;
-	node->last_bcst_mes_id = 0;
+	afq_pending_reset(node);
+	node->bcast_seq = afq_bcast_head(hapd);
 	node->computed = 0;
+	dl_list_init(&node->acks);
+	afq_timer_init(&node->expire, hapd_not_node_timeout, node);
+	afq_sched_node_init(hapd, node);
 
-	loc = getLoc(addr);
+	return node;
 
-	node->next = hapd->pend_list[loc];
-	hapd->pend_list[loc] = node;
+}
 
-	wpa_printf(MSG_DEBUG, "Head: %p, Next: %p", node, node->next);
+#define AFQ_AGG_DEFAULT_LEN 1400
+#define AFQ_AGG_MAX_LEN 2200
+#define AFQ_FRAG_DEFAULT_LEN 1400
+#define AFQ_FRAG_MIN_LEN 512
+#define AFQ_FRAG_MAX_LEN 2048
+#define AFQ_XFER_DEFAULT_TIMEOUT 30
+#define AFQ_XFER_MAX 256
+#define AFQ_ACK_DEFAULT_ATTEMPTS 4
+
+/*
+ * Aggregated WLAN_PA_HYPERLOCAL_AGG_RESP frame under construction. The
+ * messages are copied as type/mid/len TLVs straight out of their pre-encoded
+ * frames.
+ */
+struct afq_agg {
+	struct afq *node;
+	struct wpabuf *buf;
+	struct afq_mes *first;
+	u8 count;
+};
 
-	return node;
+struct afq_frame * afq_frame_build(u8 type, u32 mid, const char *payload,
+				   size_t paylen)
+{
+	struct afq_frame *frame;
+	struct wpabuf *buf;
+
+	buf = wpabuf_alloc(AFQ_FRAME_HDR_LEN + AFQ_MES_HDR_LEN + paylen + 2);
+	if (buf == NULL)
+		return NULL;
+
+	frame = os_malloc(sizeof(*frame));
+	if (frame == NULL){
+		wpabuf_free(buf);
+		return NULL;
+	}
+
+	wpabuf_put_u8(buf, WLAN_ACTION_PUBLIC);
+/*NEWANDROID*/
+	wpabuf_put_u8(buf, WLAN_PA_GAS_INITIAL_RESP);
+	wpabuf_put_u8(buf, 255);
+/*NEWANDROID*/
+	wpabuf_put_u8(buf, WLAN_PA_HYPERLOCAL_RESP);
+	wpabuf_put_u8(buf, type);
+	wpabuf_put_le32(buf, mid);
+	wpabuf_put_le16(buf, paylen);
+	wpabuf_put_data(buf, payload, paylen);
+	wpabuf_put_le16(buf, 0);
 
+	frame->refcnt = 1;
+	frame->buf = buf;
+
+	return frame;
+}
+
+struct afq_frame * afq_frame_get(struct afq_frame *frame)
+{
+	frame->refcnt++;
+	return frame;
+}
+
+void afq_frame_put(struct afq_frame *frame)
+{
+	if (frame == NULL || --frame->refcnt > 0)
+		return;
+
+	wpabuf_free(frame->buf);
+	os_free(frame);
+}
+
+void afq_mes_free(struct hostapd_data *hapd, struct afq_mes *mes)
+{
+	if (mes->jseq)
+		afq_journal_del(hapd, mes);
+	afq_timer_del(&mes->ttl);
+	afq_frame_put(mes->frame);
+	os_free(mes);
 }
 
-static struct wpabuf * hostapd_gen_action_resp(struct afq_mes *mes, const u16 num){
+/* Get the node for addr, a new one expires unless the station associates */
+static struct afq *afq_node_get(struct hostapd_data *hapd, const u8 *addr)
+{
+	struct afq *node;
+
+	node = getNode(hapd, addr);
+	if (node)
+		return node;
+
+	node = addNode(hapd, addr);
+	if (node && ap_get_sta(hapd, addr) == NULL)
+		afq_timer_mod(hapd, &node->expire, hapd->ntout, 0);
+
+	return node;
+}
+
+static int afq_xfer_send(struct hostapd_data *hapd, struct afq_xfer *xfer,
+			 u8 frag_id)
+{
+	const u8 *payload;
+	struct afq *node;
 	struct wpabuf *buf;
-	buf = wpabuf_alloc(4096);
-	if (buf == NULL){
-		return NULL;
+	size_t pos, frag_len;
+	u8 more = 0;
+
+	pos = (size_t) frag_id * xfer->frag_len;
+	if (pos >= xfer->paylen)
+		return -1;
+
+	frag_len = xfer->paylen - pos;
+	if (frag_len > xfer->frag_len){
+		frag_len = xfer->frag_len;
+		more = AFQ_FRAG_MORE;
 	}
 
-	wpa_printf(MSG_INFO, "Preparing action frame for message id %u", mes->mid);
+	buf = wpabuf_alloc(AFQ_FRAME_HDR_LEN + AFQ_FRAG_HDR_LEN + frag_len + 2);
+	if (buf == NULL)
+		return -1;
+
+	payload = wpabuf_head_u8(xfer->frame->buf) + AFQ_FRAME_HDR_LEN +
+		AFQ_MES_HDR_LEN;
 
 	wpabuf_put_u8(buf, WLAN_ACTION_PUBLIC);
 /*NEWANDROID*/
 	wpabuf_put_u8(buf, WLAN_PA_GAS_INITIAL_RESP);
 	wpabuf_put_u8(buf, 255);
 /*NEWANDROID*/
-	wpabuf_put_u8(buf, WLAN_PA_HYPERLOCAL_RESP);
-	wpabuf_put_u8(buf, mes->type);
-	wpabuf_put_le32(buf, mes->mid);
-	wpabuf_put_le16(buf, strlen(mes->payload));
-	wpabuf_put_data(buf, mes->payload, mes->paylen);
-	wpabuf_put_le16(buf, num);
+	wpabuf_put_u8(buf, WLAN_PA_HYPERLOCAL_FRAG_RESP);
+	wpabuf_put_u8(buf, xfer->type);
+	wpabuf_put_le32(buf, xfer->mid);
+	wpabuf_put_le16(buf, xfer->paylen);
+	wpabuf_put_u8(buf, frag_id | more);
+	wpabuf_put_le16(buf, frag_len);
+	wpabuf_put_data(buf, payload + pos, frag_len);
+	wpabuf_put_le16(buf, xfer->num);
+
+	AFQ_TRACE(AFQ_TR_FRAG, xfer->addr, xfer->mid, frag_id | more);
+
+	node = afq_node_get(hapd, xfer->addr);
+	if (node == NULL){
+		wpabuf_free(buf);
+		return -1;
+	}
 
-	return buf;
+	return afq_sched_buf(hapd, node, buf, xfer->prio);
+}
+
+static struct afq_xfer * afq_xfer_find(struct hostapd_data *hapd,
+				       const u8 *addr, u32 mid)
+{
+	struct afq_xfer *xfer;
+
+	dl_list_for_each(xfer, &hapd->xfer_list, struct afq_xfer, list) {
+		if (xfer->mid == mid &&
+		    os_memcmp(xfer->addr, addr, ETH_ALEN) == 0)
+			return xfer;
+	}
+
+	return NULL;
+}
+
+static void afq_xfer_free(struct hostapd_data *hapd, struct afq_xfer *xfer)
+{
+	afq_timer_del(&xfer->timer);
+	dl_list_del(&xfer->list);
+	hapd->num_xfer--;
+	afq_frame_put(xfer->frame);
+	os_free(xfer);
 }
 
-static void hapd_not_iface_send(struct hostapd_data *hapd,
+static void afq_xfer_timeout(struct hostapd_data *hapd, void *ctx)
+{
+	struct afq_xfer *xfer = ctx;
+
+	wpa_printf(MSG_DEBUG, "Fragmented transfer of message %u to " MACSTR " expired",
+		   xfer->mid, MAC2STR(xfer->addr));
+	afq_xfer_free(hapd, xfer);
+}
+
+/* Start (or restart) the fragmented transfer of mes and send fragment 0 */
+static int afq_xfer_start(struct hostapd_data *hapd, struct afq *node,
+			  struct afq_mes *mes, u16 num)
+{
+	const u8 *addr = node->addr;
+	struct afq_xfer *xfer;
+
+	xfer = afq_xfer_find(hapd, addr, mes->mid);
+	if (xfer == NULL){
+		if (hapd->num_xfer >= AFQ_XFER_MAX){
+			wpa_printf(MSG_DEBUG, "Too many fragmented transfers, dropping the oldest");
+			afq_xfer_free(hapd, dl_list_first(&hapd->xfer_list,
+							  struct afq_xfer,
+							  list));
+		}
+
+		xfer = os_zalloc(sizeof(*xfer));
+		if (xfer == NULL)
+			return -1;
+
+		os_memcpy(xfer->addr, addr, ETH_ALEN);
+		xfer->frame = afq_frame_get(mes->frame);
+		xfer->paylen = mes->paylen;
+		xfer->type = mes->type;
+		xfer->prio = mes->prio;
+		xfer->mid = mes->mid;
+		/* A SETFRAGLEN now must not move the fragments being sent */
+		xfer->frag_len = hapd->frag_len;
+		afq_timer_init(&xfer->timer, afq_xfer_timeout, xfer);
+		dl_list_add_tail(&hapd->xfer_list, &xfer->list);
+		hapd->num_xfer++;
+	}
+
+	xfer->num = num;
+	afq_timer_mod(hapd, &xfer->timer, hapd->xfer_tout, 0);
+
+	return afq_xfer_send(hapd, xfer, 0);
+}
+
+/* Send a queued message either as one frame or as the first fragment */
+int afq_mes_send(struct hostapd_data *hapd, struct afq *node,
+		 struct afq_mes *mes, u16 num)
+{
+	if (mes->paylen > hapd->frag_len)
+		return afq_xfer_start(hapd, node, mes, num);
+
+	return afq_sched_frame(hapd, node, mes->frame, num, mes->prio);
+}
+
+static void handle_hyperlocal_comeback(struct hostapd_data *hapd,
+				       const u8 *addr,
+				       const u8 *data, size_t len)
+{
+	struct afq_xfer *xfer;
+	u32 mid;
+	u8 frag_id;
+
+	if (len < 5)
+		return;
+
+	mid = WPA_GET_LE32(data);
+	frag_id = data[4] & ~AFQ_FRAG_MORE;
+
+	xfer = afq_xfer_find(hapd, addr, mid);
+	if (xfer == NULL){
+		wpa_printf(MSG_DEBUG, "No fragmented transfer of message %u for " MACSTR,
+			   mid, MAC2STR(addr));
+		return;
+	}
+
+	if (afq_xfer_send(hapd, xfer, frag_id)){
+		wpa_printf(MSG_DEBUG, "Fragment %u of message %u not sent to " MACSTR,
+			   frag_id, mid, MAC2STR(addr));
+		afq_xfer_free(hapd, xfer);
+		return;
+	}
+
+	afq_timer_mod(hapd, &xfer->timer, hapd->xfer_tout, 0);
+}
+
+/* The station acknowledged the last fragment of mid, nothing to resume */
+void afq_xfer_done(struct hostapd_data *hapd, const u8 *addr, u32 mid)
+{
+	struct afq_xfer *xfer;
+
+	xfer = afq_xfer_find(hapd, addr, mid);
+	if (xfer == NULL)
+		return;
+
+	wpa_printf(MSG_DEBUG, "Last fragment of message %u acknowledged by " MACSTR,
+		   mid, MAC2STR(addr));
+	afq_xfer_free(hapd, xfer);
+}
+
+static void afq_agg_init(struct afq_agg *agg, struct afq *node)
+{
+	agg->node = node;
+	agg->buf = NULL;
+	agg->first = NULL;
+	agg->count = 0;
+}
+
+static int afq_agg_flush(struct hostapd_data *hapd, struct afq_agg *agg,
+			 u16 num)
+{
+	struct afq *node = agg->node;
+	int ret;
+
+	if (agg->count == 0)
+		return 0;
+
+	if (agg->count == 1){
+		/* Nothing to aggregate, the plain frame is shorter */
+		wpabuf_free(agg->buf);
+		ret = afq_mes_send(hapd, node, agg->first, num);
+	}else{
+		wpabuf_mhead_u8(agg->buf)[AFQ_FRAME_HDR_LEN] = agg->count;
+		wpabuf_put_le16(agg->buf, num);
+		AFQ_TRACE(AFQ_TR_AGG, node->addr, agg->count,
+			  wpabuf_len(agg->buf));
+		ret = afq_sched_buf(hapd, node, agg->buf, agg->first->prio);
+	}
+
+	afq_agg_init(agg, node);
+	return ret;
+}
+
+/*
+ * Queue a message into the aggregate. The message must stay valid until the
+ * aggregate has been flushed.
+ */
+static int afq_agg_add(struct hostapd_data *hapd, struct afq_agg *agg,
+		       struct afq_mes *mes, u16 num)
+{
+	size_t tlv_len = AFQ_MES_HDR_LEN + mes->paylen;
+	int ret = 0;
+
+	if (mes->paylen > hapd->frag_len ||
+	    AFQ_AGG_HDR_LEN + tlv_len + 2 > hapd->agg_len){
+		ret = afq_agg_flush(hapd, agg, num);
+		if (afq_mes_send(hapd, agg->node, mes, num))
+			ret = -1;
+		return ret;
+	}
+
+	if (agg->count == 255 ||
+	    (agg->buf && wpabuf_len(agg->buf) + tlv_len + 2 > hapd->agg_len))
+		ret = afq_agg_flush(hapd, agg, num);
+
+	if (agg->count == 0){
+		agg->buf = wpabuf_alloc(hapd->agg_len);
+		if (agg->buf == NULL)
+			return -1;
+		wpabuf_put_u8(agg->buf, WLAN_ACTION_PUBLIC);
+/*NEWANDROID*/
+		wpabuf_put_u8(agg->buf, WLAN_PA_GAS_INITIAL_RESP);
+		wpabuf_put_u8(agg->buf, 255);
+/*NEWANDROID*/
+		wpabuf_put_u8(agg->buf, WLAN_PA_HYPERLOCAL_AGG_RESP);
+		wpabuf_put_u8(agg->buf, 0);
+		agg->first = mes;
+	}
+
+	wpabuf_put_data(agg->buf,
+			wpabuf_head_u8(mes->frame->buf) + AFQ_FRAME_HDR_LEN,
+			tlv_len);
+	agg->count++;
+
+	return ret;
+}
+
+/*
+ * Send an event to every subscriber of it. The event is built once as an
+ * "IFNAME=<ifname> " prefix and a cmd/buf iovec pair and the same message is
+ * handed to each sendmsg().
+ */
+void hapd_not_iface_send(struct hostapd_data *hapd, u32 event,
 								const char *cmd, size_t cmdlen,
 								const char *buf, size_t buflen)
 {
-	struct iovec io[2];
+	struct afq_global *g = afq_global(hapd);
+	struct iovec io[3];
 	struct msghdr msg;
-	struct not_ctrl_dst *dst;
+	struct not_ctrl_dst *dst, *tmp;
+	char ifname[IFNAMSIZ + 8];
+	int sent = 0, len;
 
-	wpa_printf(MSG_DEBUG, "cmd: %s, cmdlen: %u", cmd, cmdlen);
-	wpa_printf(MSG_DEBUG, "buf: %s, buflen: %u", buf, buflen);
+	len = os_snprintf(ifname, sizeof(ifname), "IFNAME=%s ",
+			  hapd->conf->iface);
+	if (os_snprintf_error(sizeof(ifname), len))
+		return;
 
-	if (hapd->not_dst == NULL || hapd->not_sock < 0){
-		char mbuf[2048];
-		os_snprintf(mbuf,sizeof(mbuf), "%s %s", cmd, buf);
-		wpa_printf(MSG_DEBUG, "No notification unit, message sent thruough hostapd channels");
-		wpa_msg(hapd->msg_ctx, MSG_INFO, mbuf);
-	}else{
-		dst = hapd->not_dst;
-
-		io[0].iov_base = (char *) cmd;
-		io[0].iov_len = cmdlen;
-		io[1].iov_base = (char *) buf;
-		io[1].iov_len = buflen;
-		os_memset(&msg, 0, sizeof(msg));
-		msg.msg_iov = io;
-		msg.msg_iovlen = 2;
+	io[0].iov_base = ifname;
+	io[0].iov_len = len;
+	io[1].iov_base = (char *) cmd;
+	io[1].iov_len = cmdlen;
+	io[2].iov_base = (char *) buf;
+	io[2].iov_len = buflen;
+	os_memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = io;
+	msg.msg_iovlen = 3;
+
+	dl_list_for_each_safe(dst, tmp, &g->dst, struct not_ctrl_dst, list){
+		if (!(dst->events & event) || g->sock < 0)
+			continue;
+
+		sent++;
 		msg.msg_name = &dst->addr;
 		msg.msg_namelen = dst->addrlen;
 
-		if (sendmsg(hapd->not_sock, &msg, 0) < 0){
+		if (sendmsg(g->sock, &msg, 0) < 0){
 			int _errno = errno;
 			wpa_printf(MSG_ERROR, "NOTIFICATION IFACE error: %d - %s", errno, strerror(errno));
 			dst->errors++;
 			if (dst->errors > 10 || _errno == ENOENT){
-				stop_not_connection(hapd, &dst->addr, dst->addrlen);
+				stop_not_connection(g, &dst->addr, dst->addrlen);
 			}
 		}else{
-			wpa_printf(MSG_DEBUG, "Message sent for handling %s, %s", cmd, buf);
 			dst->errors = 0;
 		}
 	}
+
+	AFQ_TRACE(AFQ_TR_EVENT, NULL, event, sent);
+
+	if (sent == 0 && dl_list_empty(&g->dst)){
+		wpa_msg(hapd->msg_ctx, MSG_INFO, "%.*s %.*s", (int) cmdlen, cmd,
+			(int) buflen, buf);
+	}
+}
+
+/* Whether an event is worth formatting, see hapd_not_iface_send() */
+static int not_iface_wanted(struct hostapd_data *hapd, u32 event)
+{
+	struct afq_global *g = afq_global(hapd);
+	struct not_ctrl_dst *dst;
+
+	if (dl_list_empty(&g->dst))
+		return 1;
+
+	dl_list_for_each(dst, &g->dst, struct not_ctrl_dst, list){
+		if (dst->events & event)
+			return 1;
+	}
+
+	return 0;
 }
 
 static void notify(struct hostapd_data *hapd, const u8 *addr, u32 mid, int type){
@@ -176,6 +600,10 @@ static void notify(struct hostapd_data *hapd, const u8 *addr, u32 mid, int type)
 	char buf[1024];
 	int cmdlen, buflen;
 
+	/* Sent for every broadcast a station gets, usually not subscribed */
+	if (!not_iface_wanted(hapd, HAPD_NOT_EV_SENDMSG))
+		return;
+
 	cmdlen = os_snprintf(cmd, 1023, "SENDMSG");
 	if(cmdlen < 0 || cmdlen > 1023){
 		return;
@@ -187,16 +615,20 @@ static void notify(struct hostapd_data *hapd, const u8 *addr, u32 mid, int type)
 		return;
 	}
 
-	hapd_not_iface_send(hapd, cmd, cmdlen, buf, buflen);
+	hapd_not_iface_send(hapd, HAPD_NOT_EV_SENDMSG, cmd, cmdlen, buf, buflen);
 
 }
 
+/*
+ * Tell the station when to come back for its messages: timeout (2) and, for
+ * the answer to a query, the query id (4) so that it knows which one is taken
+ */
 static void hapd_not_indicate_tout(struct hostapd_data *hapd,
-										const u8 *addr)
+										struct afq *node, u32 qid)
 {
 	struct wpabuf *buf;
 
-	buf = wpabuf_alloc(4096);
+	buf = wpabuf_alloc(AFQ_FRAME_HDR_LEN + 6);
 	if (buf == NULL){
 		return;
 	}
@@ -209,14 +641,13 @@ static void hapd_not_indicate_tout(struct hostapd_data *hapd,
 	wpabuf_put_u8(buf, WLAN_PA_HYPERLOCAL_TTF_REQ);
 
 	wpabuf_put_le16(buf, hapd->mtout);
+	if (qid)
+		wpabuf_put_le32(buf, qid);
 
-	if (hostapd_drv_send_action(hapd, hapd->iface->freq, 0, addr,
-								wpabuf_head(buf), wpabuf_len(buf)))
-		wpa_printf(MSG_ERROR, "send afn indication: indicator not sent to " MACSTR, MAC2STR(addr));
-
-	wpa_printf(MSG_DEBUG, "Indicator request is sent to " MACSTR, MAC2STR(addr));
-
-	os_free(buf);
+	if (afq_sched_buf(hapd, node, buf, AFQ_PRIO_NORMAL))
+		wpa_printf(MSG_ERROR, "send afn indication: indicator not sent to " MACSTR, MAC2STR(node->addr));
+	else
+		AFQ_TRACE(AFQ_TR_FETCH_REQ, node->addr, hapd->mtout, 0);
 }
 
 static void compute_notification_for_sta(struct hostapd_data *hapd,
@@ -231,102 +662,72 @@ static void compute_notification_for_sta(struct hostapd_data *hapd,
 	cmdlen = os_snprintf(cmd, 32, "%s", "NEWNODE");
 
 	wpa_printf(MSG_DEBUG, "Informing the handling unit about the new node " MACSTR, MAC2STR(addr));
-	hapd_not_iface_send(hapd, cmd, cmdlen, hwaddr, hwlen);
+	hapd_not_iface_send(hapd, HAPD_NOT_EV_NEWNODE, cmd, cmdlen, hwaddr, hwlen);
 
 }
 
 static void send_broadcast_messages(struct hostapd_data *hapd,
 							   struct afq *node, const u16 num){
-	struct wpabuf *actresp;
-
-	struct afq *brdcst;
 	struct afq_mes *mes;
+	struct afq_agg agg;
+	u32 seq;
+	int prio;
 
-	brdcst = hapd->pend_list[0];
-
-	mes = brdcst->pending;
-	while (mes){
-		if (node->last_bcst_mes_id < mes->mid){
-			actresp = hostapd_gen_action_resp(mes, num);
+	if (!afq_bcast_unseen(hapd, node))
+		return;
 
-			wpa_printf(MSG_DEBUG, "Sending a broadcast notification %u to " MACSTR, mes->mid, MAC2STR(node->addr));
+	afq_agg_init(&agg, node);
 
-			if (actresp) {
-				if (hostapd_drv_send_action(hapd, hapd->iface->freq, 0, node->addr,
-											wpabuf_head(actresp), wpabuf_len(actresp)))
-					wpa_printf(MSG_ERROR, "action frame notification not sent to " MACSTR, MAC2STR(node->addr));
-			}
-			node->last_bcst_mes_id = mes->mid;
+	/* One pass over the unseen broadcasts per class, most urgent first */
+	for (prio = 0; prio < AFQ_PRIO_NUM; prio++){
+		seq = node->bcast_seq;
+		while ((mes = afq_bcast_next(hapd, &seq))){
+			if (mes->prio != prio)
+				continue;
 
-			notify(hapd, node->addr, mes->mid, 0);
+			AFQ_TRACE(AFQ_TR_SEND_BCAST, node->addr, mes->mid, 0);
 
-			os_free(actresp);
+			afq_agg_add(hapd, &agg, mes, num);
 
-		}else{
-			wpa_printf(MSG_DEBUG, "Broadcast notification %u already sent to " MACSTR, mes->mid, MAC2STR(node->addr));
+			notify(hapd, node->addr, mes->mid, 0);
 		}
-		mes = mes->next;
 	}
+	node->bcast_seq = seq;
 
+	afq_agg_flush(hapd, &agg, num);
 }
 
 static void send_node_messages(struct hostapd_data *hapd,
 							   struct afq *node){
-	struct wpabuf *actresp;
 	struct afq_mes *mes, *idx;
+	struct afq_agg agg;
 
 	if (node == NULL){
 		wpa_printf(MSG_ERROR, "There is no node ");
 		return;
 	}
 
+	/* Detach the queue first, aggregated messages are freed after the flush */
 	mes = node->pending;
-	while (mes){
-		actresp = hostapd_gen_action_resp(mes, 0);
-		if (actresp) {
-			wpa_printf(MSG_DEBUG, "Sending a directed notification %u to " MACSTR, mes->mid, MAC2STR(node->addr));
-			if (hostapd_drv_send_action(hapd, hapd->iface->freq, 0, node->addr,
-										wpabuf_head(actresp), wpabuf_len(actresp)))
-				wpa_printf(MSG_ERROR, "action frame notification not sent to " MACSTR, MAC2STR(node->addr));
+	afq_pending_reset(node);
+	if (mes)
+		afq_ind_dst_del(hapd, node->addr);
+
+	afq_agg_init(&agg, node);
+	for (idx = mes; idx; idx = idx->next){
+		AFQ_TRACE(AFQ_TR_SEND_DIRECT, node->addr, idx->mid, 0);
+		afq_stats_lat(hapd, AFQ_LAT_PUSH, &idx->queued);
+		afq_agg_add(hapd, &agg, idx, 0);
+		//notify(hapd, node->addr, idx->mid, 0);
+	}
+	afq_agg_flush(hapd, &agg, 0);
 
-		}
-		//notify(hapd, node->addr, mes->mid, 0);
+	/* Directed messages are kept until the station has acknowledged them */
+	while (mes){
 		idx = mes;
 		mes = mes->next;
-		node->pending = mes;
-
-		os_free(idx->payload);
-		os_free(idx);
-		os_free(actresp);
-	}
-}
-
-static void send_new_broadcast_message(struct hostapd_data *hapd, struct afq_mes *mes){
-	struct afq *node;
-	struct wpabuf *actresp;
-	struct sta_info *sta;
-
-	wpa_printf(MSG_DEBUG, "New broadcast notification is registered with id %u", mes->mid);
-
-	actresp = hostapd_gen_action_resp(mes, 0);
-	if (actresp == NULL)
-		return;
-
-	for (sta = hapd->sta_list; sta; sta = sta->next) {
-		node = getNode(hapd, sta->addr);
-		if (node){
-			wpa_printf(MSG_DEBUG, "Message %u is being sent to " MACSTR, mes->mid, MAC2STR(node->addr));
-			if (hostapd_drv_send_action(hapd, hapd->iface->freq, 0, node->addr,
-										wpabuf_head(actresp), wpabuf_len(actresp))){
-				wpa_printf(MSG_ERROR, "action frame notification not sent to " MACSTR, MAC2STR(node->addr));
-				continue;
-			}
-			node->last_bcst_mes_id = mes->mid;
-		}
+		afq_ack_track(hapd, node, idx);
 	}
-
-	os_free(actresp);
-
 }
 
 static void resolve_hyperlocal_query_for_sta(struct hostapd_data *hapd, const u8 *sa,
@@ -368,8 +769,8 @@ static void resolve_hyperlocal_query_for_sta(struct hostapd_data *hapd, const u8
 	//}
 
 
-	buflen = os_snprintf(buf, sizeof(buf), MACSTR"%d", MAC2STR(sa), mid);
-	if(slen + buflen > 4096)
+	buflen = os_snprintf(buf, sizeof(buf), "Addr:" MACSTR " MID:%u-", MAC2STR(sa), mid);
+	if(slen + buflen >= 4096)
 		return;
 
 	os_memcpy(buf+buflen, pos, slen);
@@ -377,7 +778,7 @@ static void resolve_hyperlocal_query_for_sta(struct hostapd_data *hapd, const u8
 
 	wpa_printf(MSG_DEBUG, "Sending hyperlocal query upstream for handling");
 
-	hapd_not_iface_send(hapd, cmd, res, buf, buflen+slen);
+	hapd_not_iface_send(hapd, HAPD_NOT_EV_NOT_RESP, cmd, res, buf, buflen+slen);
 
 }
 
@@ -385,32 +786,98 @@ static void handle_hyperlocal_query(struct hostapd_data *hapd, const u8 *addr,
 						const u8 *data, size_t len){
 	struct afq *node;
 	struct sta_info *sta;
+	u16 flags = 0;
+	int cached;
 
 	if(is_broadcast_ether_addr(addr))
 		return;
 
 	node = getNode(hapd, addr);
 
-	if (node == NULL){
-		wpa_printf(MSG_DEBUG, "First time for " MACSTR, MAC2STR(addr));
+	if (node == NULL)
 		node = addNode(hapd, addr);
-	}
 
 	if(node == NULL){
 		return;
 	}
 
+	afq_stats_inc(hapd, AFQ_CNT_QUERIES);
+	AFQ_TRACE(AFQ_TR_QUERY, addr, len >= 4 ? WPA_GET_LE32(data) : 0, len);
+
+	/* data is the query mid (4), payload length (2), payload and flags (2) */
+	if (len >= 8 && WPA_GET_LE16(data + 4) <= len - 8)
+		flags = WPA_GET_LE16(data + 6 + WPA_GET_LE16(data + 4));
+
+	/* An answer is the station's own, it goes upstream with its address */
+	cached = -1;
+	if (len >= 6 && WPA_GET_LE16(data + 4) <= len - 6 &&
+	    !(flags & WLAN_PA_HYPERLOCAL_QUERY_F_ANSWER))
+		cached = afq_qcache_query(hapd, addr, WPA_GET_LE32(data),
+					  data + 6, WPA_GET_LE16(data + 4));
+
+	if (cached == 1){
+		/* The station is still listening right after its query */
+		send_node_messages(hapd, node);
+	}else{
 	//if (node->computed == 0){
-		hapd_not_indicate_tout(hapd, addr);
-		wpa_printf(MSG_DEBUG, "Computing notifications for " MACSTR, MAC2STR(addr));
-		resolve_hyperlocal_query_for_sta(hapd, addr, data, len);
+		hapd_not_indicate_tout(hapd, node,
+				       len >= 4 ? WPA_GET_LE32(data) : 0);
+		if (cached < 0){
+			resolve_hyperlocal_query_for_sta(hapd, addr, data, len);
+			if (len >= 4 &&
+			    !(flags & WLAN_PA_HYPERLOCAL_QUERY_F_ANSWER)){
+				os_get_reltime(&node->query);
+				node->query_id = WPA_GET_LE32(data);
+			}
+		}
 		node->computed = 1;
 	//}
+	}
+
+	if ((sta = ap_get_sta(hapd, addr)) == NULL)
+		afq_timer_mod(hapd, &node->expire, hapd->ntout, 0);
+	else
+		afq_timer_del(&node->expire);
+}
+
+/* data is join (1) or leave (0), the number of topics and the le16 topic ids */
+static void handle_hyperlocal_subscribe(struct hostapd_data *hapd,
+					const u8 *addr, const u8 *data,
+					size_t len)
+{
+	struct afq *node;
+	char buf[64];
+	int buflen, join;
+	u8 count;
+	u16 id;
+
+	if (is_broadcast_ether_addr(addr) || len < 2 || data[0] > 1)
+		return;
+
+	join = data[0];
+	count = data[1];
+	data += 2;
+	len -= 2;
+	if (len < (size_t) count * 2)
+		return;
+
+	node = afq_node_get(hapd, addr);
+	if (node == NULL)
+		return;
 
-	eloop_cancel_timeout(hapd_not_node_timeout, hapd, node);
-	if ((sta = ap_get_sta(hapd, addr)) == NULL){
-		eloop_register_timeout(hapd->ntout, 0, hapd_not_node_timeout,
-							   hapd, node);
+	while (count--){
+		id = WPA_GET_LE16(data);
+		data += 2;
+
+		if (join ? afq_topic_join(hapd, node, id) :
+		    afq_topic_leave(hapd, node, id))
+			continue;
+
+		buflen = os_snprintf(buf, sizeof(buf), "Addr:" MACSTR " Topic:%u Join:%d",
+				     MAC2STR(addr), id, join);
+		if (!os_snprintf_error(sizeof(buf), buflen))
+			hapd_not_iface_send(hapd, HAPD_NOT_EV_SUBSCRIBE,
+					    "SUBSCRIBE", 9, buf, buflen);
 	}
 }
 
@@ -428,7 +895,13 @@ void send_hyperlocal_response(struct hostapd_data *hapd, const u8 *addr){
 		return;
 	}
 
-	wpa_printf(MSG_DEBUG, "Sending directed hyperlocal information to " MACSTR, MAC2STR(addr));
+	afq_stats_inc(hapd, AFQ_CNT_FETCHES);
+	AFQ_TRACE(AFQ_TR_FETCH, addr, 0, 0);
+	if (os_reltime_initialized(&node->fetch)){
+		afq_stats_lat(hapd, AFQ_LAT_FETCH, &node->fetch);
+		os_memset(&node->fetch, 0, sizeof(node->fetch));
+	}
+
 	send_node_messages(hapd, node);
 }
 
@@ -443,10 +916,8 @@ void send_buffered_push_messages(struct hostapd_data *hapd,
 
 	node = getNode(hapd, addr);
 
-	if (node == NULL){
-		wpa_printf(MSG_DEBUG, "First time for " MACSTR, MAC2STR(addr));
+	if (node == NULL)
 		node = addNode(hapd, addr);
-	}
 
 	if(node == NULL){
 		return;
@@ -454,25 +925,20 @@ void send_buffered_push_messages(struct hostapd_data *hapd,
 
 	if (node->computed == 0){
 		if(hapd->fastnot){
-			hapd_not_indicate_tout(hapd, addr);
-			wpa_printf(MSG_DEBUG, "Tell the new node " MACSTR " to send something for directed messages", MAC2STR(addr));
+			hapd_not_indicate_tout(hapd, node, 0);
+			os_get_reltime(&node->fetch);
 		}
 
-		wpa_printf(MSG_DEBUG, "Computing notifications for " MACSTR, MAC2STR(addr));
 		compute_notification_for_sta(hapd, addr);
 		node->computed = 1;
 	}
 
-	eloop_cancel_timeout(hapd_not_node_timeout, hapd, node);
-	if ((sta = ap_get_sta(hapd, addr)) == NULL){
-		eloop_register_timeout(hapd->ntout, 0, hapd_not_node_timeout,
-							   hapd, node);
-	}
+	if ((sta = ap_get_sta(hapd, addr)) == NULL)
+		afq_timer_mod(hapd, &node->expire, hapd->ntout, 0);
+	else
+		afq_timer_del(&node->expire);
 
-	wpa_printf(MSG_DEBUG, "Sending broadcast notifications to " MACSTR, MAC2STR(addr));
 	send_broadcast_messages(hapd, node, num);
-
-	wpa_printf(MSG_DEBUG, "Sending directed notifications to " MACSTR, MAC2STR(addr));
 	send_node_messages(hapd, node);
 }
 
@@ -499,55 +965,410 @@ void send_buffered_push_messages(struct hostapd_data *hapd,
 	return 0;
 }*/
 
-u8 * hostapd_eid_afn_indication(struct hostapd_data *hapd, u8 *eid)
+/* Next message id, 0 is reserved for rejected records in binary replies */
+u32 afq_mid_next(struct hostapd_data *hapd)
 {
-	u8 *pos = eid;
-	//if(hapd->fastnot == 0)
-	//	return eid;
+	struct afq_global *g = afq_global(hapd);
+	struct hostapd_data *h;
+	u32 mid;
 
-	*pos++ = WLAN_EID_NOT_INDICATOR;
-	*pos++ = 2;
+	if (g->msg_id == 0)
+		g->msg_id++;
 
-	//WPA_PUT_LE16(pos, hapd->mtout);
-	WPA_PUT_LE16(pos, 1000);
+	mid = g->msg_id++;
+	g->msg_id_random = 0;
+	/* Every journal keeps the counter, any of them may be replayed */
+	dl_list_for_each(h, &g->bss, struct hostapd_data, not_list)
+		afq_journal_mid(h);
 
-	pos += 2;
+	return mid;
+}
+
+/* New message carrying frame, which gets another reference */
+struct afq_mes * afq_mes_alloc(struct hostapd_data *hapd,
+			       struct afq_frame *frame, u8 type, u8 prio,
+			       u32 mid, size_t paylen, u32 ttl)
+{
+	struct afq_mes *mes;
+
+	mes = os_malloc(sizeof(struct afq_mes));
+	if (mes == NULL){
+		wpa_printf(MSG_ERROR, "malloc failed");
+		return NULL;
+	}
+
+	mes->next = NULL;
+	mes->mid = mid;
+	mes->type = type;
+	mes->prio = prio < AFQ_PRIO_NUM ? prio : AFQ_PRIO_NORMAL;
+	mes->paylen = paylen;
+	mes->owner = NULL;
+	mes->jseq = 0;
+	mes->expiry = 0;
+	mes->fanout = 0;
+	os_get_reltime(&mes->queued);
+	mes->frame = afq_frame_get(frame);
+	afq_timer_init(&mes->ttl, hapd_not_mes_timeout, mes);
+
+	if (ttl){
+		struct os_time now;
+
+		wpa_printf(MSG_DEBUG, "Message timeout is %u seconds", ttl);
+		afq_timer_mod(hapd, &mes->ttl, ttl, 0);
+		os_get_time(&now);
+		mes->expiry = now.sec + ttl;
+	}
+
+	return mes;
+}
+
+/*
+ * Queue a directed message for node behind the pending messages of the same
+ * or a more urgent class. Unless defer is set it is sent right away if the
+ * station is in the BSS, otherwise it waits for activity from the station.
+ * A full bulk class drops its oldest message, a full urgent or normal class
+ * rejects mes and returns -1, the caller still owns it then.
+ */
+int afq_mes_queue(struct hostapd_data *hapd, struct afq *node,
+		  struct afq_mes *mes, int defer)
+{
+	struct afq_mes *prev, *old;
+
+	if (node->qlen[mes->prio] >= afq_prio_qlen[mes->prio]){
+		if (mes->prio != AFQ_PRIO_BULK){
+			wpa_printf(MSG_INFO, "Too many %s messages pending for " MACSTR,
+				   afq_prio_names[mes->prio], MAC2STR(node->addr));
+			afq_stats_inc(hapd, AFQ_CNT_PUSH_REJECTED);
+			return -1;
+		}
+
+		/* The oldest bulk message follows the last more urgent one */
+		prev = node->tail[AFQ_PRIO_NORMAL];
+		if (prev == NULL)
+			prev = node->tail[AFQ_PRIO_URGENT];
+		old = prev ? prev->next : node->pending;
+		wpa_printf(MSG_DEBUG, "Dropping bulk message %u for " MACSTR,
+			   old->mid, MAC2STR(node->addr));
+		afq_pending_unlink(node, old, prev);
+		afq_mes_free(hapd, old);
+		afq_stats_inc(hapd, AFQ_CNT_BULK_DROPPED);
+	}
+
+	if (node->pending == NULL)
+		afq_ind_dst_add(hapd, node->addr);
+	afq_pending_insert(node, mes);
+	mes->owner = node;
+	afq_journal_add(hapd, node->addr, mes);
+
+	if (defer)
+		return 0;
+
+	/* A directed message can be sent and released right away */
+	if (ap_get_sta(hapd, node->addr)) {
+		AFQ_TRACE(AFQ_TR_QUEUE, node->addr, mes->mid, 1);
+		send_node_messages(hapd, node);
+	}
+	else
+		AFQ_TRACE(AFQ_TR_QUEUE, node->addr, mes->mid, 0);
+
+	return 0;
+}
+
+/*
+ * Queue a new message for addr, the broadcast address queues it for every
+ * station. Unless defer is set the message is sent right away to the
+ * stations in the BSS, otherwise afq_push_flush() sends it later. Returns
+ * the assigned message id or 0 on failure.
+ */
+u32 afq_push(struct hostapd_data *hapd, const u8 *addr, u8 type, u8 prio,
+	     const u8 *payload, size_t len, u32 ttl, int defer)
+{
+	if (len == 0 || len > HYPERLOCAL_MAX_PAYLOAD){
+		wpa_printf(MSG_ERROR, "Invalid message length %zu", len);
+		return 0;
+	}
+
+	return afq_push_mid(hapd, addr, type, prio, afq_mid_next(hapd),
+			    payload, len, ttl, defer, 0);
+}
+
+/*
+ * The payload of a WLAN_PA_QUERY_RESP message answering the query qid of a
+ * station, which matches the answer to the app that asked by the query id
+ */
+struct wpabuf * afq_qresp_payload(u32 qid, const u8 *payload, size_t len)
+{
+	struct wpabuf *buf;
+
+	buf = wpabuf_alloc(4 + len);
+	if (buf == NULL)
+		return NULL;
+	wpabuf_put_le32(buf, qid);
+	wpabuf_put_data(buf, payload, len);
+
+	return buf;
+}
+
+
+/*
+ * afq_push() with the message id mid, which restores journaled messages, and
+ * fanout set if the message was also queued on the other BSSes
+ */
+u32 afq_push_mid(struct hostapd_data *hapd, const u8 *addr, u8 type, u8 prio,
+		 u32 mid, const u8 *payload, size_t len, u32 ttl, int defer,
+		 int fanout)
+{
+	struct afq_frame *frame;
+	int ret;
+
+	frame = afq_frame_build(type, mid, (const char *) payload, len);
+	if (frame == NULL){
+		wpa_printf(MSG_ERROR, "Could not encode message %u", mid);
+		return 0;
+	}
+
+	ret = afq_push_frame(hapd, addr, frame, type, prio, mid, len, ttl, defer,
+			     fanout);
+	afq_frame_put(frame);
+
+	return ret ? 0 : mid;
+}
+
+/* Queue the encoded message frame on hapd, the frame gets another reference */
+static int afq_push_frame(struct hostapd_data *hapd, const u8 *addr,
+			  struct afq_frame *frame, u8 type, u8 prio, u32 mid,
+			  size_t len, u32 ttl, int defer, int fanout)
+{
+	struct afq_mes *outgoing;
+	struct afq *node;
+
+	outgoing = afq_mes_alloc(hapd, frame, type, prio, mid, len, ttl);
+	if (outgoing == NULL)
+		return -1;
+	outgoing->fanout = fanout;
+
+	AFQ_TRACE(AFQ_TR_PUSH, addr, mid, (u32) prio << 16 | len);
+
+	if (is_broadcast_ether_addr(addr)){
+		if (afq_bcast_add(hapd, outgoing)){
+			afq_mes_free(hapd, outgoing);
+			return -1;
+		}
+		afq_journal_add(hapd, addr, outgoing);
+		afq_stats_inc(hapd, AFQ_CNT_PUSHED);
+
+		if (!defer)
+			afq_push_flush(hapd, addr);
+		return 0;
+	}
+
+	node = getNode(hapd, addr);
+
+	if(node == NULL)
+		node = addNode(hapd, addr);
+
+	if(node == NULL || afq_mes_queue(hapd, node, outgoing, defer)){
+		afq_mes_free(hapd, outgoing);
+		return -1;
+	}
+	afq_stats_inc(hapd, AFQ_CNT_PUSHED);
+
+	/*
+	 * Without the query cache the answer is a WLAN_PA_QUERY_RESP push for
+	 * the station that starts with the query id
+	 */
+	if (type == WLAN_PA_QUERY_RESP && len >= 4 &&
+	    os_reltime_initialized(&node->query) &&
+	    WPA_GET_LE32(wpabuf_head_u8(frame->buf) + AFQ_FRAME_HDR_LEN +
+			 AFQ_MES_HDR_LEN) == node->query_id){
+		afq_stats_lat(hapd, AFQ_LAT_QUERY, &node->query);
+		os_memset(&node->query, 0, sizeof(node->query));
+	}
+
+	return 0;
+}
+
+/*
+ * afq_push() without a BSS given. A broadcast is queued on every BSS. A
+ * directed message goes to the BSS the station is associated with or, if
+ * it is known to exactly one BSS, to that one. Otherwise every BSS queues
+ * it and the first one to deliver it drops the copies of the others.
+ */
+u32 afq_push_any(struct afq_global *g, const u8 *addr, u8 type, u8 prio,
+		 const u8 *payload, size_t len, u32 ttl, int defer)
+{
+	struct hostapd_data *hapd, *target = NULL;
+	struct afq_frame *frame;
+	unsigned int known = 0, queued = 0;
+	int fanout = 0;
+	u32 mid;
+
+	if (dl_list_empty(&g->bss))
+		return 0;
+
+	if (!is_broadcast_ether_addr(addr)){
+		dl_list_for_each(hapd, &g->bss, struct hostapd_data, not_list){
+			if (ap_get_sta(hapd, addr)){
+				target = hapd;
+				known = 1;
+				break;
+			}
+			if (getNode(hapd, addr)){
+				target = hapd;
+				known++;
+			}
+		}
+		if (known == 1)
+			return afq_push(target, addr, type, prio, payload, len,
+					ttl, defer);
+		fanout = g->num_bss > 1;
+	}
+
+	if (len == 0 || len > HYPERLOCAL_MAX_PAYLOAD){
+		wpa_printf(MSG_ERROR, "Invalid message length %zu", len);
+		return 0;
+	}
+
+	/* One encoded copy and message id for all BSSes */
+	hapd = dl_list_first(&g->bss, struct hostapd_data, not_list);
+	mid = afq_mid_next(hapd);
+	frame = afq_frame_build(type, mid, (const char *) payload, len);
+	if (frame == NULL)
+		return 0;
+
+	dl_list_for_each(hapd, &g->bss, struct hostapd_data, not_list){
+		if (afq_push_frame(hapd, addr, frame, type, prio, mid, len, ttl,
+				   defer, fanout) == 0)
+			queued++;
+	}
+	afq_frame_put(frame);
+
+	return queued ? mid : 0;
+}
+
+/* Send the messages deferred by afq_push_any() for addr */
+void afq_push_flush_any(struct afq_global *g, const u8 *addr)
+{
+	struct hostapd_data *hapd;
+
+	dl_list_for_each(hapd, &g->bss, struct hostapd_data, not_list)
+		afq_push_flush(hapd, addr);
+}
+
+/*
+ * A message hapd has delivered to addr was queued on other BSSes as well,
+ * their copies go whether still pending or sent and waiting for the ACK
+ */
+void afq_fanout_delivered(struct hostapd_data *hapd, const u8 *addr, u32 mid)
+{
+	struct afq_global *g = afq_global(hapd);
+	struct hostapd_data *h;
+	struct afq_mes *mes, *prev;
+	struct afq *node;
+
+	dl_list_for_each(h, &g->bss, struct hostapd_data, not_list){
+		node = h == hapd ? NULL : getNode(h, addr);
+		if (node == NULL)
+			continue;
+		afq_ack_drop(h, node, mid);
+		for (prev = NULL, mes = node->pending; mes;
+		     prev = mes, mes = mes->next){
+			if (mes->mid != mid || !mes->fanout)
+				continue;
+			afq_pending_unlink(node, mes, prev);
+			if (node->pending == NULL)
+				afq_ind_dst_del(h, addr);
+			afq_mes_free(h, mes);
+			break;
+		}
+	}
+}
+
+/* Send the messages deferred by afq_push() for addr */
+void afq_push_flush(struct hostapd_data *hapd, const u8 *addr)
+{
+	struct sta_info *sta;
+	struct afq *node;
+
+	if (is_broadcast_ether_addr(addr)){
+		for (sta = hapd->sta_list; sta; sta = sta->next){
+			node = getNode(hapd, sta->addr);
+			if (node)
+				send_broadcast_messages(hapd, node, 0);
+		}
+		return;
+	}
 
-	wpa_printf(MSG_DEBUG, "Mallesh: action handler: afn indication\n");
-	return pos;
+	node = getNode(hapd, addr);
+	if (node && node->pending && ap_get_sta(hapd, addr))
+		send_node_messages(hapd, node);
 }
 
-
-int afn_pending_append(struct hostapd_data *hapd, const char *cmd,
-					   char *buf, size_t buflen)
+/*
+ * "PUSH <addr|topic:id> <type>[,<class>] <payload>[ :ENDNOT:<ttl>]" for
+ * hapd, or routed with afq_push_any() if hapd is NULL. Type 2:<qid> answers
+ * the query qid of the station addr.
+ */
+static int afn_push_cmd(struct afq_global *g, struct hostapd_data *hapd,
+			const char *cmd, char *buf, size_t buflen)
 {
 	u8 addr[ETH_ALEN];
-	struct afq_mes *outgoing;
-	struct afq *node;
 	const char *ptr, *p2;
 	size_t len;
 	int addr_len;
 	int type;
+	int prio = AFQ_PRIO_NORMAL;
+	int topic = -1;
 	int ret = 0;
+	u32 mid, tout = 0, qid = 0;
+	struct wpabuf *qresp = NULL;
 	char *end = buf + buflen;
+	char *pend;
 
 	ptr = cmd;
 
-	addr_len = hwaddr_aton2(ptr, addr);
-	if (addr_len < 0)
-		return -1;
+	if (os_strncmp(ptr, "topic:", 6) == 0){
+		unsigned long id;
+
+		/* Nothing but the decimal id up to the space */
+		if (ptr[6] < '0' || ptr[6] > '9')
+			return -1;
+		id = strtoul(ptr + 6, &pend, 10);
+		if (*pend != ' ' || id > 0xffff)
+			return -1;
+		topic = id;
+		ptr = pend;
+	}else{
+		addr_len = hwaddr_aton2(ptr, addr);
+		if (addr_len < 0)
+			return -1;
+		ptr += addr_len;
+	}
 
-	ptr += addr_len;
 	if(*ptr++ != ' ')
 		return -1;
 
 	type = *ptr - '0';
-	if (type < 0 || type > 1){
+	if (type == 2 && ptr[1] == ':' && topic < 0 &&
+	    !is_broadcast_ether_addr(addr)){
+		qid = strtoul(ptr + 2, &pend, 10);
+		if (pend == ptr + 2)
+			return -1;
+		ptr = pend - 1;
+	}else if (type < 0 || type > 1){
 		wpa_printf(MSG_ERROR, "Undefined message type");
-		ret = -1;
+		return -1;
 	}
 	type += WLAN_PA_NO_RESP;
 	ptr++;
+	if (*ptr == ','){
+		prio = afq_prio_parse(++ptr);
+		if (prio < 0){
+			wpa_printf(MSG_ERROR, "Undefined message class");
+			return -1;
+		}
+		ptr += os_strlen(afq_prio_names[prio]);
+	}
 	if(*ptr++ != ' ')
 		return -1;
 
@@ -567,129 +1388,93 @@ int afn_pending_append(struct hostapd_data *hapd, const char *cmd,
 		wpa_printf(MSG_ERROR, "No message given");
 		return -1;
 	}
-#define max_len 2048
-	if (len > max_len - 1){
+	if (len > HYPERLOCAL_MAX_PAYLOAD){
 		wpa_printf(MSG_ERROR, "The size of the message larger than the allowed size");
 		return -1;
 	}
 
-	outgoing = os_malloc(sizeof(struct afq_mes));
-
-	if (outgoing == NULL){
-		wpa_printf(MSG_ERROR, "malloc failed");
-		return -1;
-	}
-
-	outgoing->payload = os_malloc(len+1);
-	os_snprintf(outgoing->payload, len+1, "%s", ptr);
-
-	outgoing->next = NULL;
-	outgoing->mid = hapd->msg_id++;
-	outgoing->type = type;
-	outgoing->paylen = len;
-
-	wpa_printf(MSG_DEBUG, "outgoing dst " MACSTR, MAC2STR(addr));
-	wpa_printf(MSG_DEBUG, "outgoint msg %s with length %d", outgoing->payload, outgoing->paylen);
-
-	node = getNode(hapd, addr);
-
-	if(node == NULL)
-		node = addNode(hapd, addr);
-
-	if(node == NULL)
-		return -1;
-
-	if (node->pending == NULL){
-		node->pending = outgoing;
-	}else{
-		node->last->next = outgoing;
-	}
-	node->last = outgoing;
-
-	if (is_broadcast_ether_addr(addr)){
-		wpa_printf(MSG_DEBUG, "This is a broadcast message");
-		send_new_broadcast_message(hapd, outgoing);
-	}else{
-		struct sta_info *sta = ap_get_sta(hapd, addr);
-		if (sta) {
-			wpa_printf(MSG_DEBUG, "This is a message for a node in the BSS. Sending now");
-			send_node_messages(hapd, node);
-		}	
-		else
-			wpa_printf(MSG_DEBUG, "This is a message for another node. We need to wait for activity from" MACSTR, MAC2STR(addr));
-	}
-
 	if(p2){
-		u32 tout;
 		p2++;
 		p2 = os_strchr(p2, ':') + 1;
 		tout = atoi(p2);
-		wpa_printf(MSG_DEBUG, "Message timeout is %u seconds", tout);
-		eloop_register_timeout(tout, 0, hapd_not_brct_timeout,
-							   hapd, &outgoing->mid);
+	}
 
+	if (type == WLAN_PA_QUERY_RESP){
+		qresp = afq_qresp_payload(qid, (const u8 *) ptr, len);
+		if (qresp == NULL)
+			return -1;
+		ptr = wpabuf_head(qresp);
+		len = wpabuf_len(qresp);
 	}
 
-	ret = os_snprintf(buf, end-buf, "MID: %u", outgoing->mid);
+	if (topic >= 0 && hapd)
+		mid = afq_topic_push(hapd, topic, type, prio, (const u8 *) ptr,
+				     len, tout, 0);
+	else if (topic >= 0)
+		mid = afq_topic_push_any(g, topic, type, prio,
+					 (const u8 *) ptr, len, tout, 0);
+	else if (hapd)
+		mid = afq_push(hapd, addr, type, prio, (const u8 *) ptr, len,
+			       tout, 0);
+	else
+		mid = afq_push_any(g, addr, type, prio, (const u8 *) ptr, len,
+				   tout, 0);
+	wpabuf_free(qresp);
+	if (mid == 0)
+		return -1;
+
+	ret = os_snprintf(buf, end-buf, "MID: %u", mid);
 	if (ret < 0 || ret >= end-buf )
 		return -1;
 
 	return ret;
 }
 
+int afn_pending_append(struct hostapd_data *hapd, const char *cmd,
+					   char *buf, size_t buflen)
+{
+	return afn_push_cmd(afq_global(hapd), hapd, cmd, buf, buflen);
+}
+
 void hostapd_not_node_delete(struct hostapd_data *hapd, const u8 *addr){
 	struct afq *node;
-	struct afq *prev;
 	struct afq_mes *mes, *m;
 	char hwaddr[256];
 	char cmd[32];
 	int hwlen;
 	int cmdlen;
 
-	int loc = getLoc(addr);
-
-	node = hapd->pend_list[loc];
-	prev = NULL;
-
-	while (node != NULL && os_memcmp(node->addr, addr, ETH_ALEN) != 0){
-		prev = node;
-		node = node->next;
-	}
+	node = getNode(hapd, addr);
 
 	if (node == NULL)
 		return;
 
-	if (prev == NULL){
-		hapd->pend_list[loc] = node->next;
-	}else{
-		prev->next = node->next;
-	}
-
 	mes = node->pending;
+	if (mes)
+		afq_ind_dst_del(hapd, node->addr);
 	while (mes){
 		m = mes->next;
-		os_free(mes->payload);
-		os_free(mes);
+		afq_mes_free(hapd, mes);
 		mes = m;
 	}
+	afq_ack_node_flush(hapd, node, 1);
+	afq_sched_node_flush(hapd, node);
+	afq_topic_node_flush(hapd, node);
+	afq_timer_del(&node->expire);
 
 	hwlen = os_snprintf(hwaddr, 256, "Addr:" MACSTR, MAC2STR(addr));
 	cmdlen = os_snprintf(cmd, 32, "%s", "OLDNODE");
 
-	wpa_printf(MSG_DEBUG, "Informing the handling unit about the old node " MACSTR, MAC2STR(addr));
-	hapd_not_iface_send(hapd, cmd, cmdlen, hwaddr, hwlen);
+	hapd_not_iface_send(hapd, HAPD_NOT_EV_OLDNODE, cmd, cmdlen, hwaddr, hwlen);
 
-	wpa_printf(MSG_DEBUG, "Messages for " MACSTR " are deleted", MAC2STR(addr));
-
-	wpa_printf(MSG_DEBUG, "Node " MACSTR " is deleted", MAC2STR(addr));
-	os_free(node);
+	AFQ_TRACE(AFQ_TR_NODE_DEL, addr, 0, 0);
+	afq_node_release(hapd, node);
 
 }
 
-static void hapd_not_node_timeout(void *eloop_ctx, void *timeout_ctx)
+static void hapd_not_node_timeout(struct hostapd_data *hapd, void *ctx)
 {
-	struct hostapd_data *hapd = eloop_ctx;
-	struct afq *node = timeout_ctx;
+	struct afq *node = ctx;
 	struct sta_info *sta;
 
 	wpa_printf(MSG_DEBUG, "No activity from the node " MACSTR, MAC2STR(node->addr));
@@ -755,7 +1540,7 @@ static void not_serv_rx_not_res(struct hostapd_data *hapd, const u8 *sa,
 
 	wpa_printf(MSG_DEBUG, "Sending notification for handling");
 
-	hapd_not_iface_send(hapd, cmd, res, buf, buflen+slen);
+	hapd_not_iface_send(hapd, HAPD_NOT_EV_NOT_RESP, cmd, res, buf, buflen+slen);
 
 }
 
@@ -778,22 +1563,23 @@ static void hostapd_recv_not_action_rx(void *ctx, const u8 *buf, size_t len, int
 	data = buf + IEEE80211_HDRLEN + 1;
 	sa = mgmt->sa;
 
-	wpa_printf(MSG_DEBUG, "Action frame is received from station " MACSTR, MAC2STR(sa));
 /*NEWANDROID*/
 	if(len > 2 && data[0] == WLAN_PA_GAS_INITIAL_REQ && data[1] == 255){
 		len -= 2;
 		data += 2;
-		wpa_printf(MSG_DEBUG, "I received notification response disguised in the form of GAS req from " MACSTR, MAC2STR(sa));
 	}
 /*NEWANDROID*/
 
+	AFQ_TRACE(AFQ_TR_RX, sa, data[0], len);
 
 	if(data[0] == WLAN_PA_HYPERLOCAL_QUERY){
-		wpa_printf(MSG_DEBUG, "It is a request for hyperlocal information");
 		handle_hyperlocal_query(hapd, sa, data+1, len-1);
 		//not_serv_rx_not_res(hapd, sa, data+1, len-1);
+	} else if (data[0] == WLAN_PA_HYPERLOCAL_COMEBACK_REQ) {
+		handle_hyperlocal_comeback(hapd, sa, data+1, len-1);
+	} else if (data[0] == WLAN_PA_HYPERLOCAL_SUBSCRIBE) {
+		handle_hyperlocal_subscribe(hapd, sa, data+1, len-1);
 	} else if (data[0] == WLAN_PA_HYPERLOCAL_TTF_RESP) {
-		wpa_printf(MSG_DEBUG, "It is a fetch response to previous hyperlocal query");
 		//send_buffered_push_messages(hapd, sa, 0);
 		send_hyperlocal_response(hapd, sa);
 	} else
@@ -801,14 +1587,83 @@ static void hostapd_recv_not_action_rx(void *ctx, const u8 *buf, size_t len, int
 }
 
 
-static int start_not_connection(struct hostapd_data *hapd,
+static struct not_ctrl_dst * not_dst_find(struct afq_global *g,
+					  struct sockaddr_un *from,
+					  socklen_t fromlen)
+{
+	struct not_ctrl_dst *dst;
+
+	dl_list_for_each(dst, &g->dst, struct not_ctrl_dst, list){
+		if (fromlen == dst->addrlen &&
+		    os_memcmp(from->sun_path, dst->addr.sun_path,
+			      fromlen - offsetof(struct sockaddr_un, sun_path))
+		    == 0)
+			return dst;
+	}
+
+	return NULL;
+}
+
+/* Parse a comma separated event list, an empty list selects all events */
+static int not_parse_events(const char *buf, u32 *events)
+{
+	const char *pos = buf, *end;
+	size_t len;
+	int i;
+
+	*events = 0;
+	if (*pos == '\0'){
+		*events = HAPD_NOT_EV_ALL;
+		return 0;
+	}
+
+	while (*pos){
+		end = os_strchr(pos, ',');
+		len = end ? (size_t) (end - pos) : os_strlen(pos);
+		for (i = 0; not_events[i].name; i++){
+			if (os_strlen(not_events[i].name) == len &&
+			    os_strncmp(pos, not_events[i].name, len) == 0)
+				break;
+		}
+		if (not_events[i].name == NULL){
+			wpa_printf(MSG_DEBUG, "Unknown notification event '%.*s'",
+				   (int) len, pos);
+			return -1;
+		}
+		*events |= not_events[i].event;
+		pos += len;
+		if (*pos == ',')
+			pos++;
+	}
+
+	return 0;
+}
+
+/*
+ * Attach a handling unit for the given events, "ATTACH" alone subscribes to
+ * everything. Attaching again from the same address updates the filter.
+ */
+static int start_not_connection(struct afq_global *g,
 								struct sockaddr_un *from,
-								socklen_t fromlen)
+								socklen_t fromlen,
+								const char *filter)
 {
 	struct not_ctrl_dst *dst;
+	u32 events;
 
-	if (hapd->not_dst){
-		return 1;
+	if (not_parse_events(filter, &events))
+		return -1;
+
+	dst = not_dst_find(g, from, fromlen);
+	if (dst){
+		dst->events = events;
+		wpa_printf(MSG_DEBUG, "Notification unit events updated to 0x%x", events);
+		return 0;
+	}
+
+	if (g->num_dst >= HAPD_NOT_MAX_DST){
+		wpa_printf(MSG_DEBUG, "Too many notification units");
+		return -1;
 	}
 
 	dst = os_zalloc(sizeof(*dst));
@@ -817,27 +1672,26 @@ static int start_not_connection(struct hostapd_data *hapd,
 
 	os_memcpy(&dst->addr, from, sizeof(struct sockaddr_un));
 	dst->addrlen = fromlen;
-	hapd->not_dst = dst;
+	dst->events = events;
+	dl_list_add_tail(&g->dst, &dst->list);
+	g->num_dst++;
 
-	wpa_printf(MSG_DEBUG, "Notification unit started");
+	wpa_printf(MSG_DEBUG, "Notification unit started (events 0x%x)", events);
 
 	return 0;
 
 }
 
-static int stop_not_connection(struct hostapd_data *hapd,
+static int stop_not_connection(struct afq_global *g,
 								struct sockaddr_un *from,
 								socklen_t fromlen){
 
 	struct not_ctrl_dst *dst;
 
-	dst = hapd->not_dst;
-
-	if (fromlen == dst->addrlen &&
-	   os_memcmp(from->sun_path, dst->addr.sun_path,
-				 fromlen - offsetof(struct sockaddr_un, sun_path))
-	   == 0){
-		hapd->not_dst = NULL;
+	dst = not_dst_find(g, from, fromlen);
+	if (dst){
+		dl_list_del(&dst->list);
+		g->num_dst--;
 		os_free(dst);
 		wpa_printf(MSG_DEBUG, "Notification unit is stopped");
 		return 0;
@@ -862,30 +1716,42 @@ static int afn_set_node_timeout(struct hostapd_data *hapd, const char *buf)
 	return 0;
 }
 
+static int afn_set_frag_len(struct hostapd_data *hapd, const char *buf)
+{
+	int len = atoi(buf);
+
+	if (len < AFQ_FRAG_MIN_LEN || len > AFQ_FRAG_MAX_LEN)
+		return -1;
+
+	hapd->frag_len = len;
+	wpa_printf(MSG_DEBUG, "Fragment size is set to %u", hapd->frag_len);
+
+	return 0;
+}
+
+static int afn_set_agg_len(struct hostapd_data *hapd, const char *buf)
+{
+	int len = atoi(buf);
+
+	if (len < 0 || len > AFQ_AGG_MAX_LEN)
+		return -1;
+
+	hapd->agg_len = len;
+	wpa_printf(MSG_DEBUG, "Aggregated frame limit is set to %u", hapd->agg_len);
+
+	return 0;
+}
+
 static int hapd_delete_brdcst_not(struct hostapd_data *hapd, u32 mid){
-	struct afq *node;
-	struct afq_mes *idx, *prev;
+	struct afq_mes *mes;
 
-	node = hapd->pend_list[0];
-	if (node){
-		idx = node->pending;
-		prev  = NULL;
-		while (idx){
-			if (idx->mid == mid){
-				if (prev){
-					prev->next = idx->next;
-				}else{
-					node->pending = idx->next;
-				}
-				os_free(idx->payload);
-				os_free(idx);
-				wpa_printf(MSG_DEBUG, "Broadcast %u is deleted", mid);
-
-				return 0;
-			}
-			prev = idx;
-			idx = idx->next;
-		}
+	mes = afq_bcast_find(hapd, mid);
+	if (mes){
+		afq_bcast_remove(hapd, mes);
+		afq_mes_free(hapd, mes);
+		wpa_printf(MSG_DEBUG, "Broadcast %u is deleted", mid);
+
+		return 0;
 	}
 	wpa_printf(MSG_DEBUG, "Broadcast %u is not found", mid);
 	return -1;
@@ -897,29 +1763,36 @@ int hapd_cmd_delete_brdcst_not(struct hostapd_data *hapd, char *cmd){
 }
 
 static int hostapd_cmd_delete_all_mes(struct hostapd_data *hapd, int end){
-	struct afq *node, *n;
+	struct afq *node;
 	struct afq_mes *mes, *m;
-	int loc;
+	size_t iter = 0;
 
 	wpa_printf(MSG_DEBUG, "Deleting all the messages");
 
-	for(loc = 0; loc < STA_HASH_SIZE + 1; loc++){
-		node = hapd->pend_list[loc];
-		while(node){
-			n = node->next;
-			mes = node->pending;
-			while (mes){
-				m = mes->next;
-				os_free(mes->payload);
-				os_free(mes);
-				mes = m;
-			}
-			node = n;
-			if(end)
-				os_free(n);
+	afq_bcast_clear(hapd);
+
+	while ((node = afq_node_next(hapd, &iter))){
+		mes = node->pending;
+		while (mes){
+			m = mes->next;
+			afq_mes_free(hapd, mes);
+			mes = m;
+		}
+		afq_pending_reset(node);
+		afq_ack_node_flush(hapd, node, 0);
+		if(end){
+			afq_sched_node_flush(hapd, node);
+			afq_timer_del(&node->expire);
 		}
 	}
 
+	afq_ind_dst_clear(hapd);
+
+	if(end){
+		afq_topic_clear(hapd);
+		afq_nodes_clear(hapd);
+	}
+
 	return 0;
 
 }
@@ -935,58 +1808,45 @@ static int update_fast_not(struct hostapd_data *hapd, char *buf){
 }
 
 
-static void hapd_not_brct_timeout(void *eloop_ctx, void *timeout_ctx){
-	struct hostapd_data *hapd = eloop_ctx;
-	u32 mid = *((u32*)timeout_ctx);
-	hapd_delete_brdcst_not(hapd, mid);
-}
-
-
-static void hostapd_not_iface_receive(int sock, void *eloop_ctx,
-				       void *sock_ctx){
-	struct hostapd_data *hapd = eloop_ctx;
-	char buf[4096];
-	int res;
-	struct sockaddr_un from;
-	socklen_t fromlen = sizeof(from);
-	char *reply;
-	const int reply_size = 4096;
-	int reply_len;
+/* Lifetime of a message still waiting in a pending list has ended */
+static void hapd_not_mes_timeout(struct hostapd_data *hapd, void *ctx){
+	struct afq_mes *mes = ctx;
+	struct afq *node = mes->owner;
+	struct afq_mes *idx, *prev = NULL;
 
-	res = recvfrom(sock, buf, sizeof(buf) - 1, 0,
-				   (struct sockaddr *) &from, &fromlen);
+	afq_stats_inc(hapd, AFQ_CNT_EXPIRED);
 
-	if (res < 0) {
-		perror("recvfrom(not_iface)");
+	if (node == NULL){
+		wpa_printf(MSG_DEBUG, "Broadcast %u expired", mes->mid);
+		afq_bcast_remove(hapd, mes);
+		afq_mes_free(hapd, mes);
 		return;
 	}
 
-	wpa_printf(MSG_DEBUG, "A message from the notification unit is received");
+	for (idx = node->pending; idx; prev = idx, idx = idx->next){
+		if (idx != mes)
+			continue;
+		afq_pending_unlink(node, idx, prev);
+		if (node->pending == NULL)
+			afq_ind_dst_del(hapd, node->addr);
+		break;
+	}
 
-	buf[res] = '\0';
+	wpa_printf(MSG_DEBUG, "Message %u for " MACSTR " expired", mes->mid, MAC2STR(node->addr));
+	afq_mes_free(hapd, mes);
+}
 
-	reply = os_malloc(reply_size);
-	if (reply == NULL) {
-		wpa_printf(MSG_ERROR, "Can't generate response");
-		sendto(sock, "FAIL\n", 5, 0, (struct sockaddr *) &from,
-			   fromlen);
-		return;
-	}
+
+/* Commands that act on one BSS, returns the reply length or -1 */
+static int hostapd_not_iface_cmd(struct hostapd_data *hapd, char *buf,
+				 char *reply, int reply_size)
+{
+	int reply_len;
 
 	os_memcpy(reply, "OK\n", 3);
 	reply_len = 3;
 
-	if (os_strcmp(buf, "ATTACH") == 0){
-		wpa_printf(MSG_DEBUG, "Start message is received");
-		if (start_not_connection(hapd, &from, fromlen)){
-			reply_len = -1;
-		}
-	} else if (os_strcmp(buf, "DETACH") == 0){
-		wpa_printf(MSG_DEBUG, "Stop message is received");
-		if (stop_not_connection(hapd, &from, fromlen)) {
-			reply_len = -1;
-		}
-	} else if (os_strncmp(buf, "PUSH ", 5) == 0){
+	if (os_strncmp(buf, "PUSH ", 5) == 0){
 		wpa_printf(MSG_DEBUG, "New push is received");
 		reply_len = afn_pending_append(hapd, buf + 5, reply, reply_size);
 	} else if(os_strncmp(buf, "SETTIME ", 8) ==0) {
@@ -1004,10 +1864,6 @@ static void hostapd_not_iface_receive(int sock, void *eloop_ctx,
 		if(hostapd_cmd_delete_all_mes(hapd, 0)){
 			reply_len = -1;
 		}
-	} else if (os_strncmp(buf, "PING", 4) == 0){
-		wpa_printf(MSG_DEBUG, "Ping is received");
-		os_memcpy(reply, "PONG\n", 5);
-		reply_len = 5;
 	} else if (os_strncmp(buf, "CHECK_FAST ", 11) == 0){
 		if(update_fast_not(hapd, buf + 11)){
 			reply_len = -1;
@@ -1015,29 +1871,218 @@ static void hostapd_not_iface_receive(int sock, void *eloop_ctx,
 	} else if (os_strncmp(buf, "SETNODETIME ", 12) == 0){
 		if(afn_set_node_timeout(hapd, buf + 12))
 			reply_len = -1;
+	} else if (os_strncmp(buf, "SETAGGLEN ", 10) == 0){
+		if(afn_set_agg_len(hapd, buf + 10))
+			reply_len = -1;
+	} else if (os_strncmp(buf, "SETFRAGLEN ", 11) == 0){
+		if(afn_set_frag_len(hapd, buf + 11))
+			reply_len = -1;
+	} else if (os_strncmp(buf, "SETTXRATE ", 10) == 0){
+		if(afq_sched_set_rate(hapd, buf + 10))
+			reply_len = -1;
+	} else if (os_strcmp(buf, "TXSTATS") == 0){
+		reply_len = afq_sched_stats(hapd, reply, reply_size);
+	} else if (os_strcmp(buf, "HYPERLOCAL_STATS") == 0){
+		reply_len = hostapd_not_stats(hapd, reply, reply_size);
+	} else if (os_strcmp(buf, "HYPERLOCAL_STATS_RESET") == 0){
+		hostapd_not_stats_reset(hapd);
+	} else if (os_strncmp(buf, "QCACHE ", 7) == 0){
+		if(afq_qcache_set(hapd, buf + 7))
+			reply_len = -1;
+	} else if (os_strncmp(buf, "QRESP ", 6) == 0){
+		if(afq_qcache_resp(hapd, buf + 6))
+			reply_len = -1;
+	} else if (os_strncmp(buf, "SETNODEMAX ", 11) == 0){
+		if(afq_nodes_set_max(hapd, buf + 11))
+			reply_len = -1;
+	} else if (os_strncmp(buf, "SETTXATTEMPTS ", 14) == 0){
+		if(afq_ack_set_attempts(hapd, buf + 14))
+			reply_len = -1;
 	} else{
 		reply_len = -1;
 	}
 
+	return reply_len;
+}
+
+
+struct hostapd_data * not_bss_find(struct afq_global *g, const char *ifname)
+{
+	struct hostapd_data *hapd;
+
+	dl_list_for_each(hapd, &g->bss, struct hostapd_data, not_list){
+		if (os_strcmp(hapd->conf->iface, ifname) == 0)
+			return hapd;
+	}
+
+	return NULL;
+}
+
+
+/* Statistics of every BSS, each one introduced by an "IFNAME=<ifname>" line */
+static int not_iface_stats(struct afq_global *g, char *reply, int reply_size,
+			   int (*stats)(struct hostapd_data *hapd, char *buf,
+					size_t buflen))
+{
+	struct hostapd_data *hapd;
+	int len = 0, ret;
+
+	dl_list_for_each(hapd, &g->bss, struct hostapd_data, not_list){
+		ret = os_snprintf(reply + len, reply_size - len, "IFNAME=%s\n",
+				  hapd->conf->iface);
+		if (os_snprintf_error(reply_size - len, ret))
+			break;
+		len += ret;
+		ret = stats(hapd, reply + len, reply_size - len);
+		if (ret < 0)
+			break;
+		len += ret;
+	}
+
+	return len;
+}
+
+
+/*
+ * A command for every BSS, it fails only if it failed on every BSS. When a
+ * BSS answers more than "OK", the replies come one per BSS as the statistics
+ * do, with "FAIL" for the BSSes it failed on.
+ */
+static int not_iface_broadcast(struct afq_global *g, char *buf, char *reply,
+			       int reply_size)
+{
+	struct hostapd_data *hapd;
+	int len = 0, hdr, ret, ok = 0, data = 0;
+
+	dl_list_for_each(hapd, &g->bss, struct hostapd_data, not_list){
+		hdr = os_snprintf(reply + len, reply_size - len, "IFNAME=%s\n",
+				  hapd->conf->iface);
+		if (os_snprintf_error(reply_size - len, hdr) ||
+		    reply_size - len - hdr < 5)
+			break;
+		ret = hostapd_not_iface_cmd(hapd, buf, reply + len + hdr,
+					    reply_size - len - hdr);
+		if (ret < 0){
+			os_memcpy(reply + len + hdr, "FAIL\n", 5);
+			ret = 5;
+		}else{
+			ok++;
+			if (ret != 3 || os_memcmp(reply + len + hdr, "OK\n", 3))
+				data = 1;
+		}
+		len += hdr + ret;
+	}
+
+	if (!ok)
+		return -1;
+	if (!data){
+		os_memcpy(reply, "OK\n", 3);
+		return 3;
+	}
+	return len;
+}
+
+
+/*
+ * Commands prefixed with "IFNAME=<ifname> " act on that BSS only. Without
+ * the prefix a push is routed to the BSS that serves the station and any
+ * other command is applied to every BSS.
+ */
+static void hostapd_not_iface_receive(int sock, void *eloop_ctx,
+				       void *sock_ctx){
+	struct afq_global *g = eloop_ctx;
+	struct hostapd_data *hapd;
+	char *buf = g->rxbuf;
+	char *pos;
+	int res;
+	struct sockaddr_un from;
+	socklen_t fromlen = sizeof(from);
+	char *reply = g->txbuf;
+	const int reply_size = HAPD_NOT_TEXT_REPLY_LEN;
+	int reply_len;
+
+	res = recvfrom(sock, buf, HAPD_NOT_RXBUF_LEN - 1, 0,
+				   (struct sockaddr *) &from, &fromlen);
+
+	if (res < 0) {
+		perror("recvfrom(not_iface)");
+		return;
+	}
+
+	wpa_printf(MSG_DEBUG, "A message from the notification unit is received");
+
+	if (res > 0 && buf[0] == HL_CTRL_MAGIC){
+		reply_len = hostapd_not_ctrl_binary(g, (const u8 *) buf, res,
+						    (u8 *) reply,
+						    HAPD_NOT_TXBUF_LEN);
+		if (reply_len > 0)
+			sendto(sock, reply, reply_len, 0,
+			       (struct sockaddr *) &from, fromlen);
+		return;
+	}
+
+	buf[res] = '\0';
+
+	os_memcpy(reply, "OK\n", 3);
+	reply_len = 3;
+
+	if (os_strncmp(buf, "IFNAME=", 7) == 0){
+		pos = os_strchr(buf + 7, ' ');
+		if (pos)
+			*pos++ = '\0';
+		hapd = pos ? not_bss_find(g, buf + 7) : NULL;
+		if (hapd == NULL){
+			wpa_printf(MSG_DEBUG, "No hyperlocal BSS %s", buf + 7);
+			reply_len = -1;
+		} else
+			reply_len = hostapd_not_iface_cmd(hapd, pos, reply,
+							  reply_size);
+	} else if (os_strcmp(buf, "ATTACH") == 0 || os_strncmp(buf, "ATTACH ", 7) == 0){
+		wpa_printf(MSG_DEBUG, "Start message is received");
+		if (start_not_connection(g, &from, fromlen,
+					 buf[6] ? buf + 7 : "")){
+			reply_len = -1;
+		}
+	} else if (os_strcmp(buf, "DETACH") == 0){
+		wpa_printf(MSG_DEBUG, "Stop message is received");
+		if (stop_not_connection(g, &from, fromlen)) {
+			reply_len = -1;
+		}
+	} else if (os_strncmp(buf, "PING", 4) == 0){
+		wpa_printf(MSG_DEBUG, "Ping is received");
+		os_memcpy(reply, "PONG\n", 5);
+		reply_len = 5;
+	} else if (os_strncmp(buf, "PUSH ", 5) == 0){
+		wpa_printf(MSG_DEBUG, "New push is received");
+		reply_len = afn_push_cmd(g, NULL, buf + 5, reply, reply_size);
+	} else if (os_strcmp(buf, "TXSTATS") == 0){
+		reply_len = not_iface_stats(g, reply, reply_size,
+					    afq_sched_stats);
+	} else if (os_strcmp(buf, "HYPERLOCAL_STATS") == 0){
+		reply_len = not_iface_stats(g, reply, reply_size,
+					    hostapd_not_stats);
+	} else{
+		reply_len = not_iface_broadcast(g, buf, reply, reply_size);
+	}
+
 	if (reply_len < 0){
 		os_memcpy(reply, "FAIL\n", 5);
 		reply_len = 5;
 	}
 
 	sendto(sock, reply, reply_len, 0, (struct sockaddr *) &from, fromlen);
-	os_free(reply);
 }
 
-static int not_iface_init(struct hostapd_data *hapd){
+/* The socket is shared by every BSS and lives in the first one's ctrl_interface */
+static int not_iface_init(struct afq_global *g, struct hostapd_data *hapd){
 	struct sockaddr_un addr;
 	int s = -1;
 	char *fname = NULL;
 	size_t len;
-	struct afq *brdct;
 
 	wpa_printf(MSG_DEBUG, "Starting Notification Interface");
 
-	if (hapd->not_sock > -1){
+	if (g->sock > -1){
 		wpa_printf(MSG_ERROR, "Notification Interface already exists");
 		return -1;
 	}
@@ -1112,18 +2157,31 @@ static int not_iface_init(struct hostapd_data *hapd){
 		goto fail;
 	}
 
-	os_free(fname);
-	hapd->not_sock = s;
+	g->rxbuf = os_malloc(HAPD_NOT_RXBUF_LEN);
+	g->txbuf = os_malloc(HAPD_NOT_TXBUF_LEN);
+	if (g->rxbuf == NULL || g->txbuf == NULL)
+		goto fail;
+
+	g->sock = s;
+	g->sock_path = fname;
+	fname = NULL;
 
 	wpa_printf(MSG_DEBUG, "Socket initialized");
 
-	eloop_register_read_sock(s, hostapd_not_iface_receive, hapd,
-							 NULL);
+#ifdef CONFIG_HYPERLOCAL_TRACE
+	{
+		char trace[256];
 
-	brdct = addNode(hapd, broadcast_ether_addr);
-	if(brdct == NULL){
-		goto fail;
+		/* Left in place on exit for a reader that comes late */
+		if (!os_snprintf_error(sizeof(trace),
+				       os_snprintf(trace, sizeof(trace), "%s.trace",
+						   g->sock_path)))
+			afq_trace_open(trace);
 	}
+#endif /* CONFIG_HYPERLOCAL_TRACE */
+
+	eloop_register_read_sock(s, hostapd_not_iface_receive, g,
+							 NULL);
 
 	return 0;
 
@@ -1134,46 +2192,119 @@ fail:
 		unlink(fname);
 		os_free(fname);
 	}
+	os_free(g->rxbuf);
+	g->rxbuf = NULL;
+	os_free(g->txbuf);
+	g->txbuf = NULL;
 	return -1;
 
 }
 
-void hostapd_deinit_notification(struct hostapd_data *hapd){
-	wpa_printf(MSG_DEBUG, "Removing the notification unit");
-
-	if (hapd->not_sock > -1){
-		char *fname;
-		size_t len;
-
-		eloop_unregister_read_sock(hapd->not_sock);
-		close(hapd->not_sock);
-		hapd->not_sock = -1;
 
-		len = os_strlen(hapd->conf->ctrl_interface) + 2 + os_strlen("notification");
-		fname = os_malloc(len);
-		os_snprintf(fname, len, "%s/notification",
-					hapd->conf->ctrl_interface);
+/* Drop the state shared by every BSS once the last one has left */
+static void afq_global_free(struct hapd_interfaces *interfaces)
+{
+	struct afq_global *g = interfaces->afq;
 
-		if (fname)
-			unlink(fname);
-		os_free(fname);
+	if (g->sock > -1){
+		eloop_unregister_read_sock(g->sock);
+		close(g->sock);
+		g->sock = -1;
+		if (g->sock_path)
+			unlink(g->sock_path);
 
 		wpa_printf(MSG_DEBUG, "Notification socket is unlinked");
+	}
+	os_free(g->sock_path);
+	afq_trace_close();
+
+	while (!dl_list_empty(&g->dst)){
+		struct not_ctrl_dst *dst;
 
+		dst = dl_list_first(&g->dst, struct not_ctrl_dst, list);
+		dl_list_del(&dst->list);
+		os_free(dst);
 	}
+	os_free(g->rxbuf);
+	os_free(g->txbuf);
+	os_free(g);
+	interfaces->afq = NULL;
+}
+
+
+static struct afq_global * afq_global_get(struct hapd_interfaces *interfaces)
+{
+	struct afq_global *g;
+
+	if (interfaces == NULL)
+		return NULL;
+	if (interfaces->afq)
+		return interfaces->afq;
+
+	g = os_zalloc(sizeof(*g));
+	if (g == NULL)
+		return NULL;
+	dl_list_init(&g->bss);
+	dl_list_init(&g->dst);
+	/*
+	 * Stations suppress duplicates by message id for a while, so without a
+	 * journal to continue from the ids must not start where the ones of a
+	 * previous run did
+	 */
+	if (os_get_random((u8 *) &g->msg_id, sizeof(g->msg_id)) < 0)
+		g->msg_id = (u32) os_random();
+	g->msg_id_random = 1;
+	g->sock = -1;
+
+	interfaces->afq = g;
+	return g;
+}
+
+void hostapd_deinit_notification(struct hostapd_data *hapd){
+	struct afq_global *g;
+
+	wpa_printf(MSG_DEBUG, "Removing the notification unit");
 
-	os_free(hapd->not_dst);
+	/* Never attached, see hostapd_init_notification() */
+	if (hapd->not_list.next == NULL)
+		return;
+	g = afq_global(hapd);
+
+	while (!dl_list_empty(&hapd->xfer_list))
+		afq_xfer_free(hapd, dl_list_first(&hapd->xfer_list,
+						  struct afq_xfer, list));
 
+	/* Closed first so that the pending messages stay in the journal */
+	afq_journal_deinit(hapd);
 	hostapd_cmd_delete_all_mes(hapd, 1);
+
+	afq_qcache_deinit(hapd);
+	afq_bcast_deinit(hapd);
+	afq_ind_deinit(hapd);
+	afq_topic_deinit(hapd);
+	afq_sched_deinit(hapd);
+	afq_nodes_deinit(hapd);
+	afq_wheel_deinit(hapd);
+	afq_stats_deinit(hapd);
+
+	dl_list_del(&hapd->not_list);
+	g->num_bss--;
+	if (g->num_bss == 0)
+		afq_global_free(hapd->iface->interfaces);
 }
 
 
 int hostapd_init_notification(struct hostapd_data *hapd){
-	wpa_printf(MSG_DEBUG, "Initializing notification unit");
+	struct afq_global *g;
 
-	/*Only use wlan0 for Wi-Push for now */
-	if(os_strncmp(hapd->conf->iface, "wlan0", 5))
-		return 0;
+	wpa_printf(MSG_DEBUG, "Initializing notification unit on %s",
+		   hapd->conf->iface);
+
+	g = afq_global_get(hapd->iface->interfaces);
+	if (g == NULL)
+		return -1;
+	dl_list_add_tail(&g->bss, &hapd->not_list);
+	g->num_bss++;
 
 	hapd->public_action_cb = hostapd_recv_not_action_rx;
 	hapd->public_action_cb_ctx = hapd;
@@ -1182,13 +2313,23 @@ int hostapd_init_notification(struct hostapd_data *hapd){
 
 	/*hostapd_register_probereq_cb(hapd, hostapd_not_probe_req_rx, hapd);
 	wpa_printf(MSG_DEBUG, "Probe req call back function is registered");*/
-	hapd->msg_id = 1;
 	hapd->mtout = 1000;
 	hapd->ntout = 500;
 	hapd->fastnot = 1;
-	os_memset(&hapd->pend_list, 0, sizeof(hapd->pend_list));
+	hapd->agg_len = AFQ_AGG_DEFAULT_LEN;
+	hapd->frag_len = AFQ_FRAG_DEFAULT_LEN;
+	hapd->xfer_tout = AFQ_XFER_DEFAULT_TIMEOUT;
+	hapd->ack_attempts = AFQ_ACK_DEFAULT_ATTEMPTS;
+	if (afq_stats_init(hapd) ||
+	    afq_wheel_init(hapd) || afq_nodes_init(hapd) ||
+	    afq_sched_init(hapd) || afq_qcache_init(hapd) ||
+	    afq_bcast_init(hapd) || afq_ind_init(hapd) ||
+	    afq_topic_init(hapd) || afq_journal_init(hapd))
+		return -1;
 
-	return not_iface_init(hapd);
+	if (g->sock > -1)
+		return 0;
+	return not_iface_init(g, hapd);
 }
 
 #endif /* CONFIG_ACTION_NOTIFICATION */
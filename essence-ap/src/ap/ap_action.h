@@ -7,9 +7,14 @@ int afn_pending_append(struct hostapd_data *hapd, const char *cmd, char *buf, si
 int hapd_cmd_delete_not(struct hostapd_data *hapd, char *cmd);
 void hostapd_not_node_delete(struct hostapd_data *hapd, const u8 *sa);
 u8 * hostapd_eid_afn_indication(struct hostapd_data *hapd, u8 *eid);
+size_t hostapd_eid_afn_indication_len(struct hostapd_data *hapd);
 int afn_set_timeout(struct hostapd_data *hapd, const char *buf);
 int hapd_cmd_delete_brdcst_not(struct hostapd_data *hapd, char *cmd);
 void send_buffered_push_messages(struct hostapd_data *hapd,
 								 const u8 *addr, const u16 num);
+void hostapd_not_tx_status(struct hostapd_data *hapd, const u8 *dst,
+			   const u8 *data, size_t len, int ok);
+int hostapd_not_stats(struct hostapd_data *hapd, char *buf, size_t buflen);
+void hostapd_not_stats_reset(struct hostapd_data *hapd);
 
 #endif
@@ -0,0 +1,319 @@
+/*
+ * hostapd / Hyperlocal action frame delivery tracking
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * Directed notifications are kept after transmission until the TX status of
+ * the frame that carried them reports an ACK from the station. Frames that
+ * were not acknowledged (or whose status never arrived) are resent with an
+ * exponential backoff and dropped after hapd->ack_attempts sends. The result
+ * is reported to the notification unit as DELIVERED or FAILED.
+ */
+
+#include "utils/includes.h"
+
+#ifdef CONFIG_ACTION_NOTIFICATION
+
+#include "utils/common.h"
+#include "common/ieee802_11_defs.h"
+#include "hostapd.h"
+#include "ap_action.h"
+#include "ap_action_i.h"
+
+#define AFQ_ACK_MAX_ATTEMPTS 16
+#define AFQ_ACK_BACKOFF_MS 200
+#define AFQ_ACK_BACKOFF_MAX_MS 5000
+/*
+ * The frame can wait in the TX scheduler before it reaches the driver, so
+ * the status is given plenty of time before the send is considered lost.
+ */
+#define AFQ_ACK_STATUS_TIMEOUT_MS 3000
+
+struct afq_ack {
+	struct dl_list list; /* afq::acks */
+	struct hostapd_data *hapd;
+	struct afq *node;
+	struct afq_mes *mes;
+	unsigned int attempts;
+	struct os_reltime sent; /* last send */
+	int resend; /* timer runs the backoff rather than the status wait */
+	struct afq_timer timer;
+};
+
+static void afq_ack_timeout(struct hostapd_data *hapd, void *ctx);
+
+
+static void afq_ack_report(struct hostapd_data *hapd, struct afq_ack *ack,
+			   u32 event)
+{
+	const char *cmd = event == HAPD_NOT_EV_DELIVERED ? "DELIVERED" :
+		"FAILED";
+	char buf[128];
+	int buflen;
+
+	buflen = os_snprintf(buf, sizeof(buf), "Addr:" MACSTR " MID:%u Attempts:%u",
+			     MAC2STR(ack->node->addr), ack->mes->mid,
+			     ack->attempts);
+	if (os_snprintf_error(sizeof(buf), buflen))
+		return;
+
+	hapd_not_iface_send(hapd, event, cmd, os_strlen(cmd), buf, buflen);
+}
+
+
+static void afq_ack_free(struct afq_ack *ack)
+{
+	afq_timer_del(&ack->timer);
+	dl_list_del(&ack->list);
+	afq_mes_free(ack->hapd, ack->mes);
+	os_free(ack);
+}
+
+
+static void afq_ack_arm(struct afq_ack *ack)
+{
+	ack->resend = 0;
+	afq_timer_mod(ack->hapd, &ack->timer, 0, AFQ_ACK_STATUS_TIMEOUT_MS);
+}
+
+
+/* The last send of ack->mes was not acknowledged */
+static void afq_ack_lost(struct hostapd_data *hapd, struct afq_ack *ack)
+{
+	unsigned int backoff;
+
+	if (ack->attempts >= hapd->ack_attempts){
+		wpa_printf(MSG_DEBUG, "Notification %u to " MACSTR " dropped after %u attempts",
+			   ack->mes->mid, MAC2STR(ack->node->addr),
+			   ack->attempts);
+		afq_ack_report(hapd, ack, HAPD_NOT_EV_FAILED);
+		afq_stats_inc(hapd, AFQ_CNT_FAILED);
+		afq_ack_free(ack);
+		return;
+	}
+
+	backoff = AFQ_ACK_BACKOFF_MS << (ack->attempts - 1);
+	if (backoff > AFQ_ACK_BACKOFF_MAX_MS)
+		backoff = AFQ_ACK_BACKOFF_MAX_MS;
+
+	wpa_printf(MSG_DEBUG, "Notification %u to " MACSTR " not acknowledged, retry in %u ms",
+		   ack->mes->mid, MAC2STR(ack->node->addr), backoff);
+
+	ack->resend = 1;
+	afq_timer_mod(hapd, &ack->timer, 0, backoff);
+}
+
+
+static void afq_ack_timeout(struct hostapd_data *hapd, void *ctx)
+{
+	struct afq_ack *ack = ctx;
+
+	if (!ack->resend){
+		wpa_printf(MSG_DEBUG, "No TX status for notification %u to " MACSTR,
+			   ack->mes->mid, MAC2STR(ack->node->addr));
+		afq_ack_lost(hapd, ack);
+		return;
+	}
+
+	ack->attempts++;
+	afq_stats_inc(hapd, AFQ_CNT_RETRIES);
+	os_get_reltime(&ack->sent);
+	if (afq_mes_send(hapd, ack->node, ack->mes, 0)){
+		afq_ack_lost(hapd, ack);
+		return;
+	}
+
+	afq_ack_arm(ack);
+}
+
+
+/*
+ * Take ownership of a directed message that has just been handed to the
+ * scheduler. The message is freed once its fate is known.
+ */
+int afq_ack_track(struct hostapd_data *hapd, struct afq *node,
+		  struct afq_mes *mes)
+{
+	struct afq_ack *ack;
+
+	if (hapd->ack_attempts == 0){
+		/* Without TX status tracking it is as delivered as it gets */
+		if (mes->fanout)
+			afq_fanout_delivered(hapd, node->addr, mes->mid);
+		afq_mes_free(hapd, mes);
+		return 0;
+	}
+
+	ack = os_zalloc(sizeof(*ack));
+	if (ack == NULL){
+		afq_mes_free(hapd, mes);
+		return -1;
+	}
+
+	ack->hapd = hapd;
+	ack->node = node;
+	ack->mes = mes;
+	ack->mes->next = NULL;
+	ack->attempts = 1;
+	os_get_reltime(&ack->sent);
+	/* The message has left the pending list, its lifetime no longer applies */
+	afq_timer_del(&mes->ttl);
+	afq_timer_init(&ack->timer, afq_ack_timeout, ack);
+	dl_list_add_tail(&node->acks, &ack->list);
+	afq_ack_arm(ack);
+
+	return 0;
+}
+
+
+/* Drop all tracked messages of a node that is going away */
+void afq_ack_node_flush(struct hostapd_data *hapd, struct afq *node,
+			int report)
+{
+	struct afq_ack *ack, *tmp;
+
+	dl_list_for_each_safe(ack, tmp, &node->acks, struct afq_ack, list){
+		if (report){
+			afq_ack_report(hapd, ack, HAPD_NOT_EV_FAILED);
+			afq_stats_inc(hapd, AFQ_CNT_FAILED);
+		}
+		afq_ack_free(ack);
+	}
+}
+
+
+/* Forget the message mid of node without a report, another BSS delivered it */
+void afq_ack_drop(struct hostapd_data *hapd, struct afq *node, u32 mid)
+{
+	struct afq_ack *ack;
+
+	dl_list_for_each(ack, &node->acks, struct afq_ack, list){
+		if (ack->mes->mid == mid){
+			afq_ack_free(ack);
+			return;
+		}
+	}
+}
+
+
+/* Call cb for every message of node that is waiting for its ACK */
+void afq_ack_node_for_each(struct afq *node,
+			   void (*cb)(struct afq_mes *mes, const u8 *dst,
+				      void *ctx),
+			   void *ctx)
+{
+	struct afq_ack *ack;
+
+	dl_list_for_each(ack, &node->acks, struct afq_ack, list)
+		cb(ack->mes, node->addr, ctx);
+}
+
+
+static void afq_ack_status(struct hostapd_data *hapd, struct afq *node,
+			   u32 mid, int final, int ok)
+{
+	struct afq_ack *ack;
+
+	dl_list_for_each(ack, &node->acks, struct afq_ack, list){
+		if (ack->mes->mid != mid)
+			continue;
+
+		if (!ok){
+			afq_ack_lost(hapd, ack);
+		}else if (!final){
+			/* Fragments are pulled by the station, keep waiting */
+			afq_ack_arm(ack);
+		}else{
+			wpa_printf(MSG_DEBUG, "Notification %u delivered to " MACSTR " (%u attempts)",
+				   mid, MAC2STR(node->addr), ack->attempts);
+			afq_ack_report(hapd, ack, HAPD_NOT_EV_DELIVERED);
+			afq_stats_inc(hapd, AFQ_CNT_DELIVERED);
+			afq_stats_lat(hapd, AFQ_LAT_ACK, &ack->sent);
+			if (ack->mes->fanout)
+				afq_fanout_delivered(hapd, node->addr, mid);
+			afq_ack_free(ack);
+		}
+		return;
+	}
+}
+
+
+/*
+ * TX status of a public action frame sent to dst. data starts at the
+ * category and is ignored unless it is a hyperlocal response.
+ */
+void hostapd_not_tx_status(struct hostapd_data *hapd, const u8 *dst,
+			   const u8 *data, size_t len, int ok)
+{
+	const u8 *pos, *end = data + len;
+	struct afq *node;
+	u16 slen;
+	u8 count;
+
+	if (hapd->sched == NULL || len < AFQ_FRAME_HDR_LEN ||
+	    data[0] != WLAN_ACTION_PUBLIC ||
+	    data[1] != WLAN_PA_GAS_INITIAL_RESP || data[2] != 255)
+		return;
+
+	if (data[3] != WLAN_PA_HYPERLOCAL_RESP &&
+	    data[3] != WLAN_PA_HYPERLOCAL_AGG_RESP &&
+	    data[3] != WLAN_PA_HYPERLOCAL_FRAG_RESP)
+		return;
+
+	AFQ_TRACE(AFQ_TR_TX_STATUS, dst, data[3], ok);
+
+	/* A fragmented transfer stays for comeback requests until this */
+	if (data[3] == WLAN_PA_HYPERLOCAL_FRAG_RESP && ok &&
+	    len >= AFQ_FRAME_HDR_LEN + AFQ_FRAG_HDR_LEN &&
+	    !(data[AFQ_FRAME_HDR_LEN + 7] & AFQ_FRAG_MORE))
+		afq_xfer_done(hapd, dst,
+			      WPA_GET_LE32(data + AFQ_FRAME_HDR_LEN + 1));
+
+	node = getNode(hapd, dst);
+	if (node == NULL || dl_list_empty(&node->acks))
+		return;
+
+	pos = data + AFQ_FRAME_HDR_LEN;
+
+	switch (data[3]){
+	case WLAN_PA_HYPERLOCAL_RESP:
+		if (end - pos < AFQ_MES_HDR_LEN)
+			return;
+		afq_ack_status(hapd, node, WPA_GET_LE32(pos + 1), 1, ok);
+		break;
+	case WLAN_PA_HYPERLOCAL_AGG_RESP:
+		if (end - pos < 1)
+			return;
+		count = *pos++;
+		while (count-- && end - pos >= AFQ_MES_HDR_LEN){
+			slen = WPA_GET_LE16(pos + 5);
+			afq_ack_status(hapd, node, WPA_GET_LE32(pos + 1), 1, ok);
+			if (slen > end - pos - AFQ_MES_HDR_LEN)
+				break;
+			pos += AFQ_MES_HDR_LEN + slen;
+		}
+		break;
+	case WLAN_PA_HYPERLOCAL_FRAG_RESP:
+		if (end - pos < AFQ_FRAG_HDR_LEN)
+			return;
+		afq_ack_status(hapd, node, WPA_GET_LE32(pos + 1),
+			       !(pos[7] & AFQ_FRAG_MORE), ok);
+		break;
+	}
+}
+
+
+int afq_ack_set_attempts(struct hostapd_data *hapd, const char *buf)
+{
+	int attempts = atoi(buf);
+
+	if (attempts < 0 || attempts > AFQ_ACK_MAX_ATTEMPTS)
+		return -1;
+
+	hapd->ack_attempts = attempts;
+	wpa_printf(MSG_DEBUG, "Directed notifications are sent up to %d times", attempts);
+	return 0;
+}
+
+#endif /* CONFIG_ACTION_NOTIFICATION */
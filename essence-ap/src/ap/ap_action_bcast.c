@@ -0,0 +1,267 @@
+/*
+ * hostapd / Hyperlocal broadcast log
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * Broadcast notifications get a dense sequence number when they are queued
+ * and are kept in a ring indexed by it. Every node remembers the sequence
+ * of the next broadcast it has not been sent (afq::bcast_seq), so a station
+ * that is up to date costs one comparison per probe and any other station
+ * only walks the broadcasts it has not seen. Deleted and expired broadcasts
+ * leave a hole that is skipped, which keeps the sequence numbers of the
+ * remaining ones stable. Message ids are never compared, so they may wrap.
+ * Bulk broadcasts are capped, the oldest one makes room for a new one.
+ */
+
+#include "utils/includes.h"
+
+#ifdef CONFIG_ACTION_NOTIFICATION
+
+#include "utils/common.h"
+#include "hostapd.h"
+#include "ap_action_i.h"
+
+#define AFQ_BCAST_MIN_SLOTS 64
+/* Bounds the span from the oldest live broadcast to the newest one */
+#define AFQ_BCAST_MAX_SLOTS 65536
+#define AFQ_BCAST_MAX_BULK 256
+
+struct afq_bcast {
+	struct afq_mes **ring;
+	u32 size; /* power of two */
+	u32 head; /* oldest sequence that may still be live */
+	u32 tail; /* sequence of the next broadcast */
+	unsigned int count;
+	unsigned int bulk; /* live AFQ_PRIO_BULK broadcasts */
+};
+
+
+static int afq_bcast_grow(struct afq_bcast *log)
+{
+	struct afq_mes **ring;
+	u32 size = log->size * 2, seq;
+
+	if (size > AFQ_BCAST_MAX_SLOTS)
+		return -1;
+
+	ring = os_calloc(size, sizeof(struct afq_mes *));
+	if (ring == NULL)
+		return -1;
+
+	for (seq = log->head; seq != log->tail; seq++)
+		ring[seq & (size - 1)] = log->ring[seq & (log->size - 1)];
+
+	os_free(log->ring);
+	log->ring = ring;
+	log->size = size;
+
+	return 0;
+}
+
+
+/* Free the oldest live bulk broadcast */
+static void afq_bcast_drop_bulk(struct hostapd_data *hapd)
+{
+	struct afq_bcast *log = hapd->bcast;
+	struct afq_mes *mes;
+	u32 seq;
+
+	for (seq = log->head; seq != log->tail; seq++){
+		mes = log->ring[seq & (log->size - 1)];
+		if (mes == NULL || mes->prio != AFQ_PRIO_BULK)
+			continue;
+		wpa_printf(MSG_DEBUG, "Dropping bulk broadcast %u", mes->mid);
+		afq_bcast_remove(hapd, mes);
+		afq_mes_free(hapd, mes);
+		return;
+	}
+}
+
+
+/* Append a broadcast to the log and assign its sequence number */
+int afq_bcast_add(struct hostapd_data *hapd, struct afq_mes *mes)
+{
+	struct afq_bcast *log = hapd->bcast;
+
+	if (log == NULL)
+		return -1;
+
+	if (mes->prio == AFQ_PRIO_BULK && log->bulk >= AFQ_BCAST_MAX_BULK)
+		afq_bcast_drop_bulk(hapd);
+
+	if (log->tail - log->head == log->size && afq_bcast_grow(log)){
+		wpa_printf(MSG_ERROR, "Broadcast log is full, oldest live broadcast is %u",
+			   log->ring[log->head & (log->size - 1)]->mid);
+		return -1;
+	}
+
+	mes->bseq = log->tail++;
+	mes->owner = NULL;
+	mes->next = NULL;
+	log->ring[mes->bseq & (log->size - 1)] = mes;
+	log->count++;
+	if (mes->prio == AFQ_PRIO_BULK)
+		log->bulk++;
+	afq_ind_changed(hapd);
+
+	return 0;
+}
+
+
+/* Take a broadcast out of the log, the caller frees it */
+void afq_bcast_remove(struct hostapd_data *hapd, struct afq_mes *mes)
+{
+	struct afq_bcast *log = hapd->bcast;
+	u32 mask = log->size - 1;
+
+	if (log->ring[mes->bseq & mask] != mes)
+		return;
+
+	log->ring[mes->bseq & mask] = NULL;
+	log->count--;
+	if (mes->prio == AFQ_PRIO_BULK)
+		log->bulk--;
+
+	while (log->head != log->tail && log->ring[log->head & mask] == NULL)
+		log->head++;
+
+	afq_ind_changed(hapd);
+}
+
+
+struct afq_mes * afq_bcast_find(struct hostapd_data *hapd, u32 mid)
+{
+	struct afq_bcast *log = hapd->bcast;
+	struct afq_mes *mes;
+	u32 seq;
+
+	if (log == NULL)
+		return NULL;
+
+	for (seq = log->head; seq != log->tail; seq++){
+		mes = log->ring[seq & (log->size - 1)];
+		if (mes && mes->mid == mid)
+			return mes;
+	}
+
+	return NULL;
+}
+
+
+/* MID of the newest live broadcast, 0 if there is none */
+u32 afq_bcast_newest(struct hostapd_data *hapd)
+{
+	struct afq_bcast *log = hapd->bcast;
+	struct afq_mes *mes;
+	u32 seq;
+
+	if (log == NULL)
+		return 0;
+
+	for (seq = log->tail; seq != log->head; seq--){
+		mes = log->ring[(seq - 1) & (log->size - 1)];
+		if (mes)
+			return mes->mid;
+	}
+
+	return 0;
+}
+
+
+/* Sequence a new node starts from, it is sent every live broadcast */
+u32 afq_bcast_head(struct hostapd_data *hapd)
+{
+	return hapd->bcast ? hapd->bcast->head : 0;
+}
+
+
+/* Whether node has broadcasts it has not been sent yet */
+int afq_bcast_unseen(struct hostapd_data *hapd, const struct afq *node)
+{
+	return hapd->bcast && node->bcast_seq != hapd->bcast->tail;
+}
+
+
+/*
+ * Next live broadcast at or after *seq, *seq is moved past it. Returns NULL
+ * and leaves *seq at the end of the log once everything has been seen.
+ */
+struct afq_mes * afq_bcast_next(struct hostapd_data *hapd, u32 *seq)
+{
+	struct afq_bcast *log = hapd->bcast;
+	struct afq_mes *mes;
+
+	if (log == NULL)
+		return NULL;
+
+	/* Everything before the head has been deleted or has expired */
+	if ((s32) (*seq - log->head) < 0)
+		*seq = log->head;
+
+	while (*seq != log->tail){
+		mes = log->ring[(*seq)++ & (log->size - 1)];
+		if (mes)
+			return mes;
+	}
+
+	return NULL;
+}
+
+
+/* Free every broadcast, sequence numbers keep counting from where they were */
+void afq_bcast_clear(struct hostapd_data *hapd)
+{
+	struct afq_bcast *log = hapd->bcast;
+	struct afq_mes *mes;
+
+	if (log == NULL)
+		return;
+
+	for (; log->head != log->tail; log->head++){
+		mes = log->ring[log->head & (log->size - 1)];
+		if (mes == NULL)
+			continue;
+		log->ring[log->head & (log->size - 1)] = NULL;
+		afq_mes_free(hapd, mes);
+	}
+	log->count = 0;
+	log->bulk = 0;
+	afq_ind_changed(hapd);
+}
+
+
+int afq_bcast_init(struct hostapd_data *hapd)
+{
+	struct afq_bcast *log;
+
+	log = os_zalloc(sizeof(*log));
+	if (log == NULL)
+		return -1;
+
+	log->ring = os_calloc(AFQ_BCAST_MIN_SLOTS, sizeof(struct afq_mes *));
+	if (log->ring == NULL){
+		os_free(log);
+		return -1;
+	}
+	log->size = AFQ_BCAST_MIN_SLOTS;
+
+	hapd->bcast = log;
+	return 0;
+}
+
+
+void afq_bcast_deinit(struct hostapd_data *hapd)
+{
+	struct afq_bcast *log = hapd->bcast;
+
+	if (log == NULL)
+		return;
+
+	afq_bcast_clear(hapd);
+	os_free(log->ring);
+	os_free(log);
+	hapd->bcast = NULL;
+}
+
+#endif /* CONFIG_ACTION_NOTIFICATION */
@@ -0,0 +1,220 @@
+/*
+ * hostapd / Hyperlocal notification socket binary requests
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * See common/hyperlocal_ctrl.h for the wire format. PUSH_BATCH records are
+ * routed like text commands without "IFNAME=", PUSH_BSS ones are queued on
+ * the BSS the request names.
+ */
+
+#include "utils/includes.h"
+
+#ifdef CONFIG_ACTION_NOTIFICATION
+
+#include "utils/common.h"
+#include "common/ieee802_11_defs.h"
+#include "common/hyperlocal_ctrl.h"
+#include "hostapd.h"
+#include "ap_action_i.h"
+
+
+static size_t hl_ctrl_reply_hdr(const u8 *req, u8 *reply, u8 status,
+				u16 count)
+{
+	reply[0] = HL_CTRL_MAGIC;
+	reply[1] = HL_CTRL_VERSION;
+	reply[HL_CTRL_HDR_OP] = req[HL_CTRL_HDR_OP];
+	reply[HL_CTRL_HDR_STATUS] = status;
+	os_memcpy(reply + HL_CTRL_HDR_SEQ, req + HL_CTRL_HDR_SEQ, 4);
+	WPA_PUT_LE16(reply + HL_CTRL_HDR_COUNT, count);
+
+	return HL_CTRL_HDR_LEN;
+}
+
+
+/* enum afq_prio of a HL_CTRL_PUSH_PRIO_* value, AFQ_PRIO_NUM if unknown */
+static u8 hl_ctrl_prio(u8 prio)
+{
+	switch (prio){
+	case HL_CTRL_PUSH_PRIO_NORMAL:
+		return AFQ_PRIO_NORMAL;
+	case HL_CTRL_PUSH_PRIO_URGENT:
+		return AFQ_PRIO_URGENT;
+	case HL_CTRL_PUSH_PRIO_BULK:
+		return AFQ_PRIO_BULK;
+	}
+
+	return AFQ_PRIO_NUM;
+}
+
+
+/*
+ * Queue the records at recs, on hapd or, if it is NULL, routed over every
+ * BSS
+ */
+static int hl_ctrl_push_batch(struct afq_global *g, struct hostapd_data *bss,
+			      const u8 *req, const u8 *recs, size_t len,
+			      u8 *reply, size_t reply_size)
+{
+	const u8 *pos = recs, *end = req + len;
+	u16 count = WPA_GET_LE16(req + HL_CTRL_HDR_COUNT);
+	struct hostapd_data *hapd;
+	u8 *mids = reply + HL_CTRL_HDR_LEN;
+	int bcast = 0, rejected = 0;
+	u16 i, plen;
+	u32 mid;
+	u8 type, flags, prio;
+
+	if (count > HL_CTRL_MAX_RECORDS ||
+	    HL_CTRL_HDR_LEN + (size_t) count * HL_CTRL_PUSH_MID_LEN >
+	    reply_size)
+		return hl_ctrl_reply_hdr(req, reply, HL_CTRL_STATUS_MALFORMED,
+					 0);
+
+	/* Validate the whole request before queueing anything */
+	for (i = 0; i < count; i++){
+		if (end - pos < HL_CTRL_PUSH_HDR_LEN)
+			break;
+		plen = WPA_GET_LE16(pos + 12);
+		if (end - pos - HL_CTRL_PUSH_HDR_LEN < plen)
+			break;
+		pos += HL_CTRL_PUSH_HDR_LEN + plen;
+	}
+	if (i < count || pos != end)
+		return hl_ctrl_reply_hdr(req, reply, HL_CTRL_STATUS_MALFORMED,
+					 0);
+
+	/*
+	 * Queue everything first so that each station gets its new messages
+	 * aggregated instead of one frame per record.
+	 */
+	pos = recs;
+	for (i = 0; i < count; i++){
+		type = pos[6];
+		flags = pos[7] & ~HL_CTRL_PUSH_PRIO_MASK;
+		prio = hl_ctrl_prio((pos[7] & HL_CTRL_PUSH_PRIO_MASK) >>
+				    HL_CTRL_PUSH_PRIO_SHIFT);
+		plen = WPA_GET_LE16(pos + 12);
+
+		mid = 0;
+		if (type > 1 || prio >= AFQ_PRIO_NUM)
+			flags = 0xff;
+
+		if (flags == HL_CTRL_PUSH_TOPIC && bss)
+			mid = afq_topic_push(bss, WPA_GET_LE16(pos),
+					     WLAN_PA_NO_RESP + type, prio,
+					     pos + HL_CTRL_PUSH_HDR_LEN, plen,
+					     WPA_GET_LE32(pos + 8), 1);
+		else if (flags == HL_CTRL_PUSH_TOPIC)
+			mid = afq_topic_push_any(g, WPA_GET_LE16(pos),
+					     WLAN_PA_NO_RESP + type, prio,
+					     pos + HL_CTRL_PUSH_HDR_LEN, plen,
+					     WPA_GET_LE32(pos + 8), 1);
+		else if (flags == 0 && bss)
+			mid = afq_push(bss, pos, WLAN_PA_NO_RESP + type, prio,
+				       pos + HL_CTRL_PUSH_HDR_LEN, plen,
+				       WPA_GET_LE32(pos + 8), 1);
+		else if (flags == 0)
+			mid = afq_push_any(g, pos, WLAN_PA_NO_RESP + type, prio,
+				       pos + HL_CTRL_PUSH_HDR_LEN, plen,
+				       WPA_GET_LE32(pos + 8), 1);
+		if (mid == 0)
+			rejected++;
+		else if (!(flags & HL_CTRL_PUSH_TOPIC) &&
+			 is_broadcast_ether_addr(pos))
+			bcast = 1;
+
+		WPA_PUT_LE32(mids + i * HL_CTRL_PUSH_MID_LEN, mid);
+		pos += HL_CTRL_PUSH_HDR_LEN + plen;
+	}
+
+	pos = recs;
+	for (i = 0; i < count; i++){
+		if (pos[7] & HL_CTRL_PUSH_TOPIC){
+			dl_list_for_each(hapd, &g->bss, struct hostapd_data,
+					 not_list){
+				if (bss == NULL || hapd == bss)
+					afq_topic_flush(hapd,
+							WPA_GET_LE16(pos));
+			}
+		}else if (!is_broadcast_ether_addr(pos)){
+			if (bss)
+				afq_push_flush(bss, pos);
+			else
+				afq_push_flush_any(g, pos);
+		}
+		pos += HL_CTRL_PUSH_HDR_LEN + WPA_GET_LE16(pos + 12);
+	}
+	if (bcast && bss)
+		afq_push_flush(bss, broadcast_ether_addr);
+	else if (bcast)
+		afq_push_flush_any(g, broadcast_ether_addr);
+
+	wpa_printf(MSG_DEBUG, "Batch of %u notifications queued, %d rejected",
+		   count, rejected);
+
+	hl_ctrl_reply_hdr(req, reply, rejected ? HL_CTRL_STATUS_PARTIAL :
+			  HL_CTRL_STATUS_OK, count);
+
+	return HL_CTRL_HDR_LEN + count * HL_CTRL_PUSH_MID_LEN;
+}
+
+
+/* HL_CTRL_OP_PUSH_BSS, the records of a PUSH_BATCH for one BSS */
+static int hl_ctrl_push_bss(struct afq_global *g, const u8 *req, size_t len,
+			    u8 *reply, size_t reply_size)
+{
+	const u8 *pos = req + HL_CTRL_HDR_LEN;
+	struct hostapd_data *hapd;
+	char ifname[IFNAMSIZ + 1];
+	u8 nlen;
+
+	if (len < HL_CTRL_HDR_LEN + 1)
+		return hl_ctrl_reply_hdr(req, reply, HL_CTRL_STATUS_MALFORMED,
+					 0);
+	nlen = *pos++;
+	if (nlen == 0 || nlen > IFNAMSIZ || len - HL_CTRL_HDR_LEN - 1 < nlen)
+		return hl_ctrl_reply_hdr(req, reply, HL_CTRL_STATUS_MALFORMED,
+					 0);
+	os_memcpy(ifname, pos, nlen);
+	ifname[nlen] = '\0';
+
+	hapd = not_bss_find(g, ifname);
+	if (hapd == NULL){
+		wpa_printf(MSG_DEBUG, "No hyperlocal BSS %s", ifname);
+		return hl_ctrl_reply_hdr(req, reply, HL_CTRL_STATUS_NO_BSS, 0);
+	}
+
+	return hl_ctrl_push_batch(g, hapd, req, pos + nlen, len, reply,
+				  reply_size);
+}
+
+
+/*
+ * Handle a binary request from the notification socket. Returns the length
+ * of the reply written to reply or -1 if no reply can be generated.
+ */
+int hostapd_not_ctrl_binary(struct afq_global *g, const u8 *req,
+			    size_t len, u8 *reply, size_t reply_size)
+{
+	if (len < HL_CTRL_HDR_LEN || reply_size < HL_CTRL_HDR_LEN)
+		return -1;
+
+	if (req[1] != HL_CTRL_VERSION)
+		return hl_ctrl_reply_hdr(req, reply,
+					 HL_CTRL_STATUS_BAD_VERSION, 0);
+
+	switch (req[HL_CTRL_HDR_OP]){
+	case HL_CTRL_OP_PUSH_BATCH:
+		return hl_ctrl_push_batch(g, NULL, req, req + HL_CTRL_HDR_LEN,
+					  len, reply, reply_size);
+	case HL_CTRL_OP_PUSH_BSS:
+		return hl_ctrl_push_bss(g, req, len, reply, reply_size);
+	default:
+		return hl_ctrl_reply_hdr(req, reply, HL_CTRL_STATUS_BAD_OP, 0);
+	}
+}
+
+#endif /* CONFIG_ACTION_NOTIFICATION */
@@ -0,0 +1,301 @@
+/*
+ * hostapd / Hyperlocal action frame notification - internal definitions
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+#ifndef AP_ACTION_I_H
+#define AP_ACTION_I_H
+
+#include "utils/list.h"
+#include "ap_action_trace.h"
+
+/* Category, GAS initial response, 255 and the hyperlocal subtype */
+#define AFQ_FRAME_HDR_LEN 4
+/* type (1), mid (4), payload length (2) */
+#define AFQ_MES_HDR_LEN 7
+/* Frame header followed by the message count of an aggregated response */
+#define AFQ_AGG_HDR_LEN (AFQ_FRAME_HDR_LEN + 1)
+/* type (1), mid (4), total length (2), fragment id (1), fragment length (2) */
+#define AFQ_FRAG_HDR_LEN 10
+#define AFQ_FRAG_MORE 0x80
+/* Largest payload the 16-bit length fields can describe */
+#define HYPERLOCAL_MAX_PAYLOAD 65535
+
+/* Topics a station can be subscribed to at the same time */
+#define AFQ_TOPIC_NODE_MAX 8
+
+/*
+ * Message priority classes, most urgent first. Pending messages are sent in
+ * class order and urgent frames overtake the TX backlog of a station.
+ */
+enum afq_prio {
+	AFQ_PRIO_URGENT,
+	AFQ_PRIO_NORMAL,
+	AFQ_PRIO_BULK,
+	AFQ_PRIO_NUM
+};
+
+struct afq_wheel;
+
+/* Event counters of HYPERLOCAL_STATS, see afq_cnt_names */
+enum afq_cnt {
+	AFQ_CNT_PUSHED,
+	AFQ_CNT_PUSH_REJECTED,
+	AFQ_CNT_BULK_DROPPED,
+	AFQ_CNT_EXPIRED,
+	AFQ_CNT_DELIVERED,
+	AFQ_CNT_FAILED,
+	AFQ_CNT_RETRIES,
+	AFQ_CNT_FETCHES,
+	AFQ_CNT_QUERIES,
+	AFQ_CNT_QCACHE_HITS,
+	AFQ_CNT_QCACHE_MISSES,
+	AFQ_CNT_QCACHE_COALESCED,
+	AFQ_CNT_NODES_EVICTED,
+	AFQ_CNT_NUM
+};
+
+/* Latency histograms of HYPERLOCAL_STATS, see afq_lat_names */
+enum afq_lat {
+	AFQ_LAT_PUSH,
+	AFQ_LAT_SCHED,
+	AFQ_LAT_ACK,
+	AFQ_LAT_FETCH,
+	AFQ_LAT_QUERY,
+	AFQ_LAT_NUM
+};
+
+/*
+ * Engine state shared by every BSS of the process (hapd_interfaces::afq):
+ * the message id counter and the notification socket, which addresses a
+ * BSS with an "IFNAME=<ifname> " command prefix.
+ */
+struct afq_global {
+	struct dl_list bss; /* struct hostapd_data::not_list */
+	unsigned int num_bss;
+	u32 msg_id;
+	int msg_id_random; /* msg_id is the random start, none issued yet */
+	u32 query_id; /* query cache ids, unique across the BSSes */
+	int sock;
+	char *sock_path;
+	struct dl_list dst; /* struct not_ctrl_dst */
+	unsigned int num_dst;
+	char *rxbuf;
+	char *txbuf;
+};
+
+static inline struct afq_global * afq_global(struct hostapd_data *hapd)
+{
+	return hapd->iface->interfaces->afq;
+}
+
+/* Timer in the hyperlocal timer wheel, list.next is NULL while not armed */
+struct afq_timer {
+	struct dl_list list;
+	struct afq_wheel *wheel;
+	u32 expires; /* in wheel ticks */
+	void (*handler)(struct hostapd_data *hapd, void *ctx);
+	void *ctx;
+};
+
+/*
+ * Encoded WLAN_PA_HYPERLOCAL_RESP frame. It is built once when the message is
+ * queued and shared by every station the message is sent to; only the
+ * trailing 16-bit num field is rewritten before each transmission.
+ */
+struct afq_frame {
+	unsigned int refcnt;
+	struct wpabuf *buf;
+};
+
+struct afq_mes{
+	struct afq_frame *frame;
+	size_t paylen;
+	u8 type;
+	u8 prio; /* enum afq_prio */
+	u8 fanout; /* also queued on other BSSes, see afq_push_any() */
+	u32 mid;
+	struct afq *owner; /* node whose pending list holds it, NULL for broadcasts */
+	u32 bseq; /* broadcast log sequence */
+	u32 jseq; /* journal record, 0 if not journaled */
+	os_time_t expiry; /* end of the lifetime in wall clock seconds, 0 = none */
+	struct os_reltime queued;
+	struct afq_timer ttl;
+	struct afq_mes *next;
+};
+
+/* Token bucket, tokens are kept in 1/1000 units */
+struct afq_bucket {
+	u64 tokens;
+	u32 rate; /* per second, 0 = unlimited */
+	u32 burst;
+	struct os_reltime last;
+};
+
+struct afq {
+	u8 addr[ETH_ALEN];
+	u32 bcast_seq; /* next broadcast log sequence to send */
+	int computed;
+	struct afq_mes *pending; /* in class order, FIFO within a class */
+	struct afq_mes *tail[AFQ_PRIO_NUM]; /* last pending message per class */
+	u16 qlen[AFQ_PRIO_NUM];
+	struct afq *next; /* node pool free list */
+	struct dl_list lru; /* afq_nodes::lru */
+
+	/* TX scheduler state */
+	struct dl_list txq; /* struct afq_tx */
+	struct dl_list sched_list; /* in afq_sched::active while txq is used */
+	unsigned int txq_len;
+	int deficit;
+	struct afq_bucket tb;
+
+	struct dl_list acks; /* struct afq_ack, directed messages awaiting ACK */
+	struct afq_timer expire; /* passer-by node expiry */
+
+	u16 topics[AFQ_TOPIC_NODE_MAX];
+	u8 num_topics;
+
+	/* Start of the fetch and the upstream query in progress, 0 if none */
+	struct os_reltime fetch;
+	struct os_reltime query;
+	u32 query_id; /* of the query asked at query, without the cache */
+};
+
+void afq_timer_init(struct afq_timer *t,
+		    void (*handler)(struct hostapd_data *hapd, void *ctx),
+		    void *ctx);
+int afq_timer_pending(const struct afq_timer *t);
+void afq_timer_del(struct afq_timer *t);
+void afq_timer_mod(struct hostapd_data *hapd, struct afq_timer *t,
+		   unsigned int sec, unsigned int msec);
+int afq_wheel_init(struct hostapd_data *hapd);
+void afq_wheel_deinit(struct hostapd_data *hapd);
+
+struct afq * getNode(struct hostapd_data *hapd, const u8 *addr);
+struct afq * afq_node_alloc(struct hostapd_data *hapd, const u8 *addr);
+void afq_node_release(struct hostapd_data *hapd, struct afq *node);
+struct afq * afq_node_next(struct hostapd_data *hapd, size_t *iter);
+void afq_nodes_clear(struct hostapd_data *hapd);
+int afq_nodes_set_max(struct hostapd_data *hapd, const char *buf);
+int afq_nodes_init(struct hostapd_data *hapd);
+void afq_nodes_deinit(struct hostapd_data *hapd);
+
+int afq_bcast_add(struct hostapd_data *hapd, struct afq_mes *mes);
+void afq_bcast_remove(struct hostapd_data *hapd, struct afq_mes *mes);
+struct afq_mes * afq_bcast_find(struct hostapd_data *hapd, u32 mid);
+u32 afq_bcast_newest(struct hostapd_data *hapd);
+u32 afq_bcast_head(struct hostapd_data *hapd);
+int afq_bcast_unseen(struct hostapd_data *hapd, const struct afq *node);
+struct afq_mes * afq_bcast_next(struct hostapd_data *hapd, u32 *seq);
+void afq_bcast_clear(struct hostapd_data *hapd);
+int afq_bcast_init(struct hostapd_data *hapd);
+void afq_bcast_deinit(struct hostapd_data *hapd);
+
+void afq_ind_changed(struct hostapd_data *hapd);
+void afq_ind_dst_add(struct hostapd_data *hapd, const u8 *addr);
+void afq_ind_dst_del(struct hostapd_data *hapd, const u8 *addr);
+void afq_ind_dst_clear(struct hostapd_data *hapd);
+int afq_ind_init(struct hostapd_data *hapd);
+void afq_ind_deinit(struct hostapd_data *hapd);
+struct afq_frame * afq_frame_build(u8 type, u32 mid, const char *payload,
+				   size_t paylen);
+struct afq_frame * afq_frame_get(struct afq_frame *frame);
+void afq_frame_put(struct afq_frame *frame);
+u32 afq_mid_next(struct hostapd_data *hapd);
+struct afq_mes * afq_mes_alloc(struct hostapd_data *hapd,
+			       struct afq_frame *frame, u8 type, u8 prio,
+			       u32 mid, size_t paylen, u32 ttl);
+int afq_mes_queue(struct hostapd_data *hapd, struct afq *node,
+		  struct afq_mes *mes, int defer);
+int afq_prio_parse(const char *name);
+const char * afq_prio_name(u8 prio);
+void afq_mes_free(struct hostapd_data *hapd, struct afq_mes *mes);
+void afq_xfer_done(struct hostapd_data *hapd, const u8 *addr, u32 mid);
+int afq_mes_send(struct hostapd_data *hapd, struct afq *node,
+		 struct afq_mes *mes, u16 num);
+/* Events on the notification socket, selected per subscriber with ATTACH */
+#define HAPD_NOT_EV_NEWNODE BIT(0)
+#define HAPD_NOT_EV_OLDNODE BIT(1)
+#define HAPD_NOT_EV_NOT_RESP BIT(2)
+#define HAPD_NOT_EV_SENDMSG BIT(3)
+#define HAPD_NOT_EV_DELIVERED BIT(4)
+#define HAPD_NOT_EV_FAILED BIT(5)
+#define HAPD_NOT_EV_NOT_QRY BIT(6)
+#define HAPD_NOT_EV_SUBSCRIBE BIT(7)
+#define HAPD_NOT_EV_ALL (BIT(8) - 1)
+
+void hapd_not_iface_send(struct hostapd_data *hapd, u32 event,
+			 const char *cmd, size_t cmdlen,
+			 const char *buf, size_t buflen);
+
+u32 afq_push(struct hostapd_data *hapd, const u8 *addr, u8 type, u8 prio,
+	     const u8 *payload, size_t len, u32 ttl, int defer);
+struct wpabuf * afq_qresp_payload(u32 qid, const u8 *payload, size_t len);
+u32 afq_push_mid(struct hostapd_data *hapd, const u8 *addr, u8 type, u8 prio,
+		 u32 mid, const u8 *payload, size_t len, u32 ttl, int defer,
+		 int fanout);
+u32 afq_push_any(struct afq_global *g, const u8 *addr, u8 type, u8 prio,
+		 const u8 *payload, size_t len, u32 ttl, int defer);
+void afq_push_flush_any(struct afq_global *g, const u8 *addr);
+void afq_push_flush(struct hostapd_data *hapd, const u8 *addr);
+void afq_fanout_delivered(struct hostapd_data *hapd, const u8 *addr, u32 mid);
+int afq_topic_join(struct hostapd_data *hapd, struct afq *node, u16 id);
+int afq_topic_leave(struct hostapd_data *hapd, struct afq *node, u16 id);
+void afq_topic_node_flush(struct hostapd_data *hapd, struct afq *node);
+void afq_topic_clear(struct hostapd_data *hapd);
+u32 afq_topic_push(struct hostapd_data *hapd, u16 id, u8 type, u8 prio,
+		   const u8 *payload, size_t len, u32 ttl, int defer);
+u32 afq_topic_push_any(struct afq_global *g, u16 id, u8 type, u8 prio,
+		       const u8 *payload, size_t len, u32 ttl, int defer);
+void afq_topic_flush(struct hostapd_data *hapd, u16 id);
+int afq_topic_init(struct hostapd_data *hapd);
+void afq_topic_deinit(struct hostapd_data *hapd);
+struct hostapd_data * not_bss_find(struct afq_global *g, const char *ifname);
+int hostapd_not_ctrl_binary(struct afq_global *g, const u8 *req,
+			    size_t len, u8 *reply, size_t reply_size);
+
+int afq_qcache_query(struct hostapd_data *hapd, const u8 *addr, u32 qid,
+		     const u8 *query, size_t len);
+int afq_qcache_resp(struct hostapd_data *hapd, const char *buf);
+int afq_qcache_set(struct hostapd_data *hapd, const char *buf);
+int afq_qcache_init(struct hostapd_data *hapd);
+void afq_qcache_deinit(struct hostapd_data *hapd);
+
+int afq_ack_track(struct hostapd_data *hapd, struct afq *node,
+		  struct afq_mes *mes);
+void afq_ack_node_flush(struct hostapd_data *hapd, struct afq *node,
+			int report);
+void afq_ack_drop(struct hostapd_data *hapd, struct afq *node, u32 mid);
+int afq_ack_set_attempts(struct hostapd_data *hapd, const char *buf);
+void afq_ack_node_for_each(struct afq *node,
+			   void (*cb)(struct afq_mes *mes, const u8 *dst,
+				      void *ctx),
+			   void *ctx);
+
+void afq_journal_add(struct hostapd_data *hapd, const u8 *dst,
+		     struct afq_mes *mes);
+void afq_journal_del(struct hostapd_data *hapd, struct afq_mes *mes);
+void afq_journal_mid(struct hostapd_data *hapd);
+int afq_journal_init(struct hostapd_data *hapd);
+void afq_journal_deinit(struct hostapd_data *hapd);
+
+int afq_sched_init(struct hostapd_data *hapd);
+void afq_sched_deinit(struct hostapd_data *hapd);
+void afq_sched_node_init(struct hostapd_data *hapd, struct afq *node);
+void afq_sched_node_flush(struct hostapd_data *hapd, struct afq *node);
+int afq_sched_frame(struct hostapd_data *hapd, struct afq *node,
+		    struct afq_frame *frame, u16 num, u8 prio);
+int afq_sched_buf(struct hostapd_data *hapd, struct afq *node,
+		  struct wpabuf *buf, u8 prio);
+int afq_sched_set_rate(struct hostapd_data *hapd, const char *buf);
+int afq_sched_stats(struct hostapd_data *hapd, char *buf, size_t buflen);
+
+void afq_stats_inc(struct hostapd_data *hapd, enum afq_cnt cnt);
+void afq_stats_lat(struct hostapd_data *hapd, enum afq_lat lat,
+		   struct os_reltime *start);
+int afq_stats_init(struct hostapd_data *hapd);
+void afq_stats_deinit(struct hostapd_data *hapd);
+
+#endif /* AP_ACTION_I_H */
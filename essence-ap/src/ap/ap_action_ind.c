@@ -0,0 +1,183 @@
+/*
+ * hostapd / Hyperlocal notification indicator element
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * The indicator in beacons and probe responses carries the newest broadcast
+ * and a Bloom filter of the stations with directed notifications waiting
+ * (common/hyperlocal_ind.h), so that a station with nothing new can skip
+ * the fetch. The filter is kept as per bit counters updated whenever a
+ * node's pending list becomes empty or non-empty. Beacon updates are
+ * coalesced and only done when the advertised values change.
+ */
+
+#include "utils/includes.h"
+
+#ifdef CONFIG_ACTION_NOTIFICATION
+
+#include "utils/common.h"
+#include "utils/eloop.h"
+#include "common/ieee802_11_defs.h"
+#include "common/hyperlocal_ind.h"
+#include "hostapd.h"
+#include "beacon.h"
+#include "ap_action.h"
+#include "ap_action_i.h"
+
+/* Changes within this window end up in one beacon update */
+#define AFQ_IND_UPDATE_MS 100
+
+struct afq_ind {
+	u32 filter[HL_IND_FILTER_BITS]; /* stations per filter bit */
+	/* What the beacon currently advertises */
+	u32 bcast_mid;
+	u64 dst_filter;
+};
+
+
+static u64 afq_ind_filter(struct afq_ind *ind)
+{
+	u64 filter = 0;
+	int i;
+
+	for (i = 0; i < HL_IND_FILTER_BITS; i++){
+		if (ind->filter[i])
+			filter |= 1ULL << i;
+	}
+
+	return filter;
+}
+
+
+static void afq_ind_update(void *eloop_ctx, void *timeout_ctx)
+{
+	struct hostapd_data *hapd = eloop_ctx;
+	struct afq_ind *ind = hapd->ind;
+
+	ind->bcast_mid = afq_bcast_newest(hapd);
+	ind->dst_filter = afq_ind_filter(ind);
+
+	if (!(hapd->beacon_set_done && hapd->started))
+		return;
+
+	wpa_printf(MSG_DEBUG, "Updating the notification indicator, newest broadcast %u",
+		   ind->bcast_mid);
+	ieee802_11_set_beacon(hapd);
+}
+
+
+/* Schedule a beacon update if the indicator no longer matches it */
+void afq_ind_changed(struct hostapd_data *hapd)
+{
+	struct afq_ind *ind = hapd->ind;
+
+	if (ind == NULL)
+		return;
+
+	if (ind->bcast_mid == afq_bcast_newest(hapd) &&
+	    ind->dst_filter == afq_ind_filter(ind))
+		return;
+
+	if (!eloop_is_timeout_registered(afq_ind_update, hapd, NULL))
+		eloop_register_timeout(0, AFQ_IND_UPDATE_MS * 1000,
+				       afq_ind_update, hapd, NULL);
+}
+
+
+/* addr got its first pending directed notification */
+void afq_ind_dst_add(struct hostapd_data *hapd, const u8 *addr)
+{
+	struct afq_ind *ind = hapd->ind;
+	unsigned int b1, b2;
+
+	if (ind == NULL)
+		return;
+
+	hl_ind_filter_bits(addr, &b1, &b2);
+	ind->filter[b1]++;
+	ind->filter[b2]++;
+	afq_ind_changed(hapd);
+}
+
+
+/* addr has no pending directed notifications left */
+void afq_ind_dst_del(struct hostapd_data *hapd, const u8 *addr)
+{
+	struct afq_ind *ind = hapd->ind;
+	unsigned int b1, b2;
+
+	if (ind == NULL)
+		return;
+
+	hl_ind_filter_bits(addr, &b1, &b2);
+	if (ind->filter[b1])
+		ind->filter[b1]--;
+	if (ind->filter[b2])
+		ind->filter[b2]--;
+	afq_ind_changed(hapd);
+}
+
+
+void afq_ind_dst_clear(struct hostapd_data *hapd)
+{
+	struct afq_ind *ind = hapd->ind;
+
+	if (ind == NULL)
+		return;
+
+	os_memset(ind->filter, 0, sizeof(ind->filter));
+	afq_ind_changed(hapd);
+}
+
+
+size_t hostapd_eid_afn_indication_len(struct hostapd_data *hapd)
+{
+	return 2 + (hapd->ind ? HL_IND_LEN : HL_IND_BASE_LEN);
+}
+
+
+u8 * hostapd_eid_afn_indication(struct hostapd_data *hapd, u8 *eid)
+{
+	struct afq_ind *ind = hapd->ind;
+	u8 *pos = eid;
+	//if(hapd->fastnot == 0)
+	//	return eid;
+
+	*pos++ = WLAN_EID_NOT_INDICATOR;
+	*pos++ = ind ? HL_IND_LEN : HL_IND_BASE_LEN;
+
+	//WPA_PUT_LE16(pos, hapd->mtout);
+	WPA_PUT_LE16(pos, 1000);
+
+	pos += 2;
+
+	/* The engine does not run on this BSS, stations always fetch */
+	if (ind == NULL)
+		return pos;
+
+	WPA_PUT_LE32(pos, afq_bcast_newest(hapd));
+	pos += 4;
+	WPA_PUT_LE64(pos, afq_ind_filter(ind));
+	pos += 8;
+
+	return pos;
+}
+
+
+int afq_ind_init(struct hostapd_data *hapd)
+{
+	hapd->ind = os_zalloc(sizeof(struct afq_ind));
+
+	return hapd->ind ? 0 : -1;
+}
+
+
+void afq_ind_deinit(struct hostapd_data *hapd)
+{
+	eloop_cancel_timeout(afq_ind_update, hapd, NULL);
+	os_free(hapd->ind);
+	hapd->ind = NULL;
+}
+
+#endif /* CONFIG_ACTION_NOTIFICATION */
@@ -0,0 +1,488 @@
+/*
+ * hostapd / Hyperlocal message journal
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * With notification_journal set, every queued message is appended to a
+ * memory mapped file and a delete record is appended once it has been
+ * delivered, has expired or was deleted. The file is replayed when the
+ * engine starts, so pending messages and the message id counter survive a
+ * restart of hostapd. A partially written record fails its CRC and ends the
+ * replay. The journal is compacted into a new file, which then replaces the
+ * old one by rename(), whenever it fills up or consists mostly of deleted
+ * records, so the replay never reads more than one file worth of records.
+ * Topic memberships are not journaled, stations subscribe again.
+ */
+
+#include "utils/includes.h"
+
+#ifdef CONFIG_ACTION_NOTIFICATION
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "utils/common.h"
+#include "utils/eloop.h"
+#include "utils/crc32.h"
+#include "hostapd.h"
+#include "ap_config.h"
+#include "ap_action_i.h"
+
+#define AFQ_JOURNAL_MAGIC 0x4a4c4801 /* "\x01HLJ" */
+#define AFQ_JOURNAL_VERSION 1
+#define AFQ_JOURNAL_DEFAULT_SIZE (4 * 1024 * 1024)
+/* Room for at least one record with the largest payload */
+#define AFQ_JOURNAL_MIN_SIZE (128 * 1024)
+/*
+ * Compactions are at least this far apart, messages queued while the
+ * journal is full are written by the next one.
+ */
+#define AFQ_JOURNAL_COMPACT_MS 1000
+
+/*
+ * File header:
+ *	le32 magic, le32 version, le32 file size, le32 next message id,
+ *	16 reserved bytes
+ */
+#define AFQ_JOURNAL_HDR_LEN 32
+#define AFQ_JOURNAL_HDR_MSG_ID 12
+
+/*
+ * Record:
+ *	le32 crc	crc32() of the rest of the record
+ *	u8 op		AFQ_JOURNAL_ADD or AFQ_JOURNAL_DEL
+ *	u8 type, u8 prio, u8 flags	AFQ_JOURNAL_F_*
+ *	le32 seq	sequence of the ADD record, DEL refers to an earlier one
+ *	le32 mid
+ *	u8 dst[6]	station, ff:ff:ff:ff:ff:ff for a broadcast
+ *	le16 len	payload length, 0 in DEL records
+ *	le64 expiry	wall clock seconds, 0 = no lifetime
+ *	u8 payload[len]
+ */
+#define AFQ_JOURNAL_REC_LEN 32
+#define AFQ_JOURNAL_ADD 1
+#define AFQ_JOURNAL_DEL 2
+/* The message was fanned out to every BSS, see afq_push_any() */
+#define AFQ_JOURNAL_F_FANOUT 0x01
+
+struct afq_journal {
+	char *path;
+	int fd;
+	u8 *base;
+	size_t size;
+	size_t used; /* end of the last record */
+	size_t live; /* bytes of ADD records not deleted yet */
+	u32 seq; /* sequence of the next ADD record */
+};
+
+static void afq_journal_compact(void *eloop_ctx, void *timeout_ctx);
+
+
+static int afq_journal_put(struct afq_journal *j, u8 op, u32 seq,
+			   const u8 *dst, const struct afq_mes *mes)
+{
+	size_t len = op == AFQ_JOURNAL_ADD ? mes->paylen : 0;
+	u8 *pos = j->base + j->used;
+
+	if (j->size - j->used < AFQ_JOURNAL_REC_LEN + len)
+		return -1;
+
+	pos[4] = op;
+	pos[5] = mes->type;
+	pos[6] = mes->prio;
+	pos[7] = mes->fanout ? AFQ_JOURNAL_F_FANOUT : 0;
+	WPA_PUT_LE32(pos + 8, seq);
+	WPA_PUT_LE32(pos + 12, mes->mid);
+	os_memcpy(pos + 16, dst, ETH_ALEN);
+	WPA_PUT_LE16(pos + 22, len);
+	WPA_PUT_LE64(pos + 24, mes->expiry);
+	os_memcpy(pos + AFQ_JOURNAL_REC_LEN,
+		  wpabuf_head_u8(mes->frame->buf) + AFQ_FRAME_HDR_LEN +
+		  AFQ_MES_HDR_LEN, len);
+	/* The CRC goes last, a record cut short by a crash does not match */
+	WPA_PUT_LE32(pos, crc32(pos + 4, AFQ_JOURNAL_REC_LEN - 4 + len));
+
+	j->used += AFQ_JOURNAL_REC_LEN + len;
+	return 0;
+}
+
+
+/* Compact once the journal is full or holds mostly deleted records */
+static void afq_journal_check(struct hostapd_data *hapd, int full)
+{
+	struct afq_journal *j = hapd->journal;
+
+	if (!full && (j->used < j->size / 2 || j->live >= j->used / 4))
+		return;
+
+	if (!eloop_is_timeout_registered(afq_journal_compact, hapd, NULL))
+		eloop_register_timeout(0, AFQ_JOURNAL_COMPACT_MS * 1000,
+				       afq_journal_compact, hapd, NULL);
+}
+
+
+/* mes has been queued for dst */
+void afq_journal_add(struct hostapd_data *hapd, const u8 *dst,
+		     struct afq_mes *mes)
+{
+	struct afq_journal *j = hapd->journal;
+
+	if (j == NULL)
+		return;
+
+	if (afq_journal_put(j, AFQ_JOURNAL_ADD, j->seq, dst, mes)){
+		/* The compaction picks it up with the other live messages */
+		afq_journal_check(hapd, 1);
+		return;
+	}
+
+	mes->jseq = j->seq++;
+	j->live += AFQ_JOURNAL_REC_LEN + mes->paylen;
+}
+
+
+/* mes is going away for good */
+void afq_journal_del(struct hostapd_data *hapd, struct afq_mes *mes)
+{
+	struct afq_journal *j = hapd->journal;
+	int full;
+
+	if (j == NULL)
+		return;
+
+	full = afq_journal_put(j, AFQ_JOURNAL_DEL, mes->jseq,
+			       broadcast_ether_addr, mes) < 0;
+	j->live -= AFQ_JOURNAL_REC_LEN + mes->paylen;
+	mes->jseq = 0;
+	afq_journal_check(hapd, full);
+}
+
+
+/* Record the message id counter, a single store into the mapping */
+void afq_journal_mid(struct hostapd_data *hapd)
+{
+	struct afq_journal *j = hapd->journal;
+
+	if (j)
+		WPA_PUT_LE32(j->base + AFQ_JOURNAL_HDR_MSG_ID,
+			     afq_global(hapd)->msg_id);
+}
+
+
+/* Call cb for every live message, always in the same order */
+static void afq_journal_walk(struct hostapd_data *hapd,
+			     void (*cb)(struct afq_mes *mes, const u8 *dst,
+					void *ctx),
+			     void *ctx)
+{
+	struct afq_mes *mes;
+	struct afq *node;
+	size_t iter = 0;
+	u32 seq = afq_bcast_head(hapd);
+
+	while ((mes = afq_bcast_next(hapd, &seq)))
+		cb(mes, broadcast_ether_addr, ctx);
+
+	while ((node = afq_node_next(hapd, &iter))){
+		for (mes = node->pending; mes; mes = mes->next)
+			cb(mes, node->addr, ctx);
+		/* Delivery was not confirmed yet, they are sent again */
+		afq_ack_node_for_each(node, cb, ctx);
+	}
+}
+
+
+/* The messages after the first one that does not fit are left out */
+struct afq_journal_compaction {
+	struct afq_journal *j;
+	u32 seq;
+	int full;
+};
+
+
+static void afq_journal_write_cb(struct afq_mes *mes, const u8 *dst,
+				 void *ctx)
+{
+	struct afq_journal_compaction *c = ctx;
+
+	if (c->full)
+		return;
+
+	if (afq_journal_put(c->j, AFQ_JOURNAL_ADD, c->seq, dst, mes))
+		c->full = 1;
+	else
+		c->seq++;
+}
+
+
+/* Number the messages in the order afq_journal_write_cb() wrote them */
+static void afq_journal_seq_cb(struct afq_mes *mes, const u8 *dst,
+			       void *ctx)
+{
+	struct afq_journal_compaction *c = ctx;
+	struct afq_journal *j = c->j;
+
+	if (j->seq >= c->seq){
+		mes->jseq = 0;
+		return;
+	}
+
+	mes->jseq = j->seq++;
+	j->live += AFQ_JOURNAL_REC_LEN + mes->paylen;
+}
+
+
+/*
+ * Write every live message to a new file and make it the journal. The old
+ * journal stays in place until the new one is complete on disk.
+ */
+static int afq_journal_create(struct hostapd_data *hapd,
+			      struct afq_journal *j)
+{
+	struct afq_journal n;
+	struct afq_journal_compaction c;
+	char *tmp;
+	size_t len;
+
+	len = os_strlen(j->path) + 5;
+	tmp = os_malloc(len);
+	if (tmp == NULL)
+		return -1;
+	os_snprintf(tmp, len, "%s.tmp", j->path);
+
+	os_memset(&n, 0, sizeof(n));
+	n.size = j->size;
+	n.fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (n.fd < 0){
+		wpa_printf(MSG_ERROR, "journal: open(%s) failed: %s",
+			   tmp, strerror(errno));
+		os_free(tmp);
+		return -1;
+	}
+	if (ftruncate(n.fd, n.size) < 0){
+		wpa_printf(MSG_ERROR, "journal: ftruncate(%s) failed: %s",
+			   tmp, strerror(errno));
+		goto fail;
+	}
+	n.base = mmap(NULL, n.size, PROT_READ | PROT_WRITE, MAP_SHARED, n.fd,
+		      0);
+	if (n.base == MAP_FAILED){
+		n.base = NULL;
+		wpa_printf(MSG_ERROR, "journal: mmap(%s) failed: %s",
+			   tmp, strerror(errno));
+		goto fail;
+	}
+
+	WPA_PUT_LE32(n.base, AFQ_JOURNAL_MAGIC);
+	WPA_PUT_LE32(n.base + 4, AFQ_JOURNAL_VERSION);
+	WPA_PUT_LE32(n.base + 8, n.size);
+	WPA_PUT_LE32(n.base + AFQ_JOURNAL_HDR_MSG_ID, afq_global(hapd)->msg_id);
+	n.used = AFQ_JOURNAL_HDR_LEN;
+	c.j = &n;
+	c.seq = 1;
+	c.full = 0;
+	afq_journal_walk(hapd, afq_journal_write_cb, &c);
+	if (c.full)
+		wpa_printf(MSG_ERROR, "journal: %s is too small for the pending messages, only %u were written",
+			   j->path, c.seq - 1);
+
+	if (msync(n.base, n.size, MS_SYNC) < 0 || fsync(n.fd) < 0 ||
+	    rename(tmp, j->path) < 0){
+		wpa_printf(MSG_ERROR, "journal: could not replace %s: %s",
+			   j->path, strerror(errno));
+		goto fail;
+	}
+	os_free(tmp);
+
+	if (j->base)
+		munmap(j->base, j->size);
+	if (j->fd >= 0)
+		close(j->fd);
+	j->fd = n.fd;
+	j->base = n.base;
+	j->used = n.used;
+
+	/* Only now the records replace the ones the messages referred to */
+	j->seq = 1;
+	j->live = 0;
+	c.j = j;
+	afq_journal_walk(hapd, afq_journal_seq_cb, &c);
+
+	wpa_printf(MSG_DEBUG, "journal: %s compacted to %u messages, %zu bytes",
+		   j->path, j->seq - 1, j->used);
+	return 0;
+
+fail:
+	if (n.base)
+		munmap(n.base, n.size);
+	close(n.fd);
+	unlink(tmp);
+	os_free(tmp);
+	return -1;
+}
+
+
+static void afq_journal_compact(void *eloop_ctx, void *timeout_ctx)
+{
+	struct hostapd_data *hapd = eloop_ctx;
+
+	if (hapd->journal)
+		afq_journal_create(hapd, hapd->journal);
+}
+
+
+/* Queue the messages of the journal at path again */
+static int afq_journal_replay(struct hostapd_data *hapd, const char *path)
+{
+	struct afq_global *g = afq_global(hapd);
+	struct os_time now;
+	struct stat st;
+	const u8 *base, *rec;
+	u32 *offs, seq, max, mid;
+	size_t pos, len;
+	u64 expiry;
+	unsigned int restored = 0, expired = 0;
+	int fd, ret = -1;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0){
+		if (errno == ENOENT)
+			return 0;
+		wpa_printf(MSG_ERROR, "journal: open(%s) failed: %s",
+			   path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < AFQ_JOURNAL_HDR_LEN){
+		wpa_printf(MSG_ERROR, "journal: %s is not a journal", path);
+		close(fd);
+		return -1;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED){
+		wpa_printf(MSG_ERROR, "journal: mmap(%s) failed: %s",
+			   path, strerror(errno));
+		return -1;
+	}
+
+	/* Do not overwrite a file that is not ours */
+	if (WPA_GET_LE32(base) != AFQ_JOURNAL_MAGIC ||
+	    WPA_GET_LE32(base + 4) != AFQ_JOURNAL_VERSION){
+		wpa_printf(MSG_ERROR, "journal: %s is not a version %d journal",
+			   path, AFQ_JOURNAL_VERSION);
+		goto out;
+	}
+
+	/* Offset of every ADD record that has no DEL record, by sequence */
+	max = (st.st_size - AFQ_JOURNAL_HDR_LEN) / AFQ_JOURNAL_REC_LEN;
+	offs = os_calloc(max + 1, sizeof(u32));
+	if (offs == NULL)
+		goto out;
+
+	for (pos = AFQ_JOURNAL_HDR_LEN;
+	     (size_t) st.st_size - pos >= AFQ_JOURNAL_REC_LEN; pos += len){
+		rec = base + pos;
+		len = AFQ_JOURNAL_REC_LEN + WPA_GET_LE16(rec + 22);
+		if (len > (size_t) st.st_size - pos ||
+		    WPA_GET_LE32(rec) != crc32(rec + 4, len - 4))
+			break;
+		seq = WPA_GET_LE32(rec + 8);
+		if (seq == 0 || seq > max)
+			break;
+		if (rec[4] == AFQ_JOURNAL_ADD)
+			offs[seq] = pos;
+		else if (rec[4] == AFQ_JOURNAL_DEL)
+			offs[seq] = 0;
+		else
+			break;
+	}
+
+	os_get_time(&now);
+	for (seq = 1; seq <= max; seq++){
+		if (offs[seq] == 0)
+			continue;
+		rec = base + offs[seq];
+		expiry = WPA_GET_LE64(rec + 24);
+		if (expiry && expiry <= (u64) now.sec){
+			expired++;
+			continue;
+		}
+		mid = WPA_GET_LE32(rec + 12);
+		if (afq_push_mid(hapd, rec + 16, rec[5], rec[6], mid,
+				 rec + AFQ_JOURNAL_REC_LEN,
+				 WPA_GET_LE16(rec + 22),
+				 expiry ? expiry - now.sec : 0, 1,
+				 !!(rec[7] & AFQ_JOURNAL_F_FANOUT)))
+			restored++;
+	}
+	os_free(offs);
+
+	/*
+	 * The BSSes share the counter, the journal written last is ahead. A
+	 * journal replaces the random start of afq_global_get() though.
+	 */
+	mid = WPA_GET_LE32(base + AFQ_JOURNAL_HDR_MSG_ID);
+	if (g->msg_id_random || (s32) (mid - g->msg_id) > 0)
+		g->msg_id = mid;
+	g->msg_id_random = 0;
+
+	wpa_printf(MSG_INFO, "journal: restored %u messages from %s, %u expired meanwhile, next message id %u",
+		   restored, path, expired, g->msg_id);
+	ret = 0;
+
+out:
+	munmap((void *) base, st.st_size);
+	return ret;
+}
+
+
+int afq_journal_init(struct hostapd_data *hapd)
+{
+	struct hostapd_bss_config *conf = hapd->conf;
+	struct afq_journal *j;
+
+	if (conf->notification_journal == NULL)
+		return 0;
+
+	j = os_zalloc(sizeof(*j));
+	if (j == NULL)
+		return -1;
+	j->fd = -1;
+	j->size = conf->notification_journal_size ?
+		conf->notification_journal_size : AFQ_JOURNAL_DEFAULT_SIZE;
+	if (j->size < AFQ_JOURNAL_MIN_SIZE)
+		j->size = AFQ_JOURNAL_MIN_SIZE;
+	j->path = os_strdup(conf->notification_journal);
+
+	/* Messages restored here are written by the compaction below */
+	if (j->path == NULL || afq_journal_replay(hapd, j->path) ||
+	    afq_journal_create(hapd, j)){
+		os_free(j->path);
+		os_free(j);
+		return -1;
+	}
+
+	hapd->journal = j;
+	return 0;
+}
+
+
+void afq_journal_deinit(struct hostapd_data *hapd)
+{
+	struct afq_journal *j = hapd->journal;
+
+	if (j == NULL)
+		return;
+
+	eloop_cancel_timeout(afq_journal_compact, hapd, NULL);
+	munmap(j->base, j->size);
+	close(j->fd);
+	os_free(j->path);
+	os_free(j);
+	hapd->journal = NULL;
+}
+
+#endif /* CONFIG_ACTION_NOTIFICATION */
@@ -0,0 +1,342 @@
+/*
+ * hostapd / Hyperlocal per-station node index
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * Every station that probes with the hyperlocal indicator gets a node, and
+ * with randomized addresses a busy venue sees tens of thousands of them per
+ * hour. Nodes are indexed by an open addressing hash on the full address
+ * (linear probing, backward shift deletion) that grows with the load, come
+ * from a pool allocated in chunks, and are kept in LRU order so that idle
+ * passer-by nodes can be evicted once hapd->nodes holds max_nodes entries.
+ */
+
+#include "utils/includes.h"
+
+#ifdef CONFIG_ACTION_NOTIFICATION
+
+#include "utils/common.h"
+#include "hostapd.h"
+#include "sta_info.h"
+#include "ap_action.h"
+#include "ap_action_i.h"
+
+#define AFQ_NODE_MIN_SLOTS 256
+#define AFQ_NODE_CHUNK 128
+#define AFQ_NODE_DEFAULT_MAX 16384
+#define AFQ_NODE_MIN_MAX 64
+/* LRU entries looked at for an idle node before giving up */
+#define AFQ_NODE_EVICT_SCAN 32
+
+struct afq_node_chunk {
+	struct afq_node_chunk *next;
+	struct afq nodes[AFQ_NODE_CHUNK];
+};
+
+struct afq_nodes {
+	struct afq **slots;
+	size_t size; /* power of two */
+	size_t count;
+	u32 seed;
+
+	struct dl_list lru; /* struct afq, least recently used first */
+	unsigned int max_nodes;
+
+	struct afq_node_chunk *chunks;
+	struct afq *free_list; /* linked through afq::next */
+};
+
+
+static u32 afq_node_hash(struct afq_nodes *tbl, const u8 *addr)
+{
+	u64 v;
+
+	v = ((u64) WPA_GET_BE16(addr) << 32) | WPA_GET_BE32(addr + 2);
+	v ^= tbl->seed;
+	v ^= v >> 33;
+	v *= 0xff51afd7ed558ccdULL;
+	v ^= v >> 33;
+	v *= 0xc4ceb9fe1a85ec53ULL;
+	v ^= v >> 33;
+
+	return (u32) v;
+}
+
+
+static size_t afq_node_slot(struct afq_nodes *tbl, const u8 *addr)
+{
+	size_t i = afq_node_hash(tbl, addr) & (tbl->size - 1);
+
+	while (tbl->slots[i] &&
+	       os_memcmp(tbl->slots[i]->addr, addr, ETH_ALEN) != 0)
+		i = (i + 1) & (tbl->size - 1);
+
+	return i;
+}
+
+
+static int afq_node_resize(struct afq_nodes *tbl, size_t size)
+{
+	struct afq **old = tbl->slots;
+	size_t old_size = tbl->size, i;
+
+	tbl->slots = os_calloc(size, sizeof(struct afq *));
+	if (tbl->slots == NULL){
+		tbl->slots = old;
+		return -1;
+	}
+	tbl->size = size;
+
+	for (i = 0; i < old_size; i++){
+		if (old[i])
+			tbl->slots[afq_node_slot(tbl, old[i]->addr)] = old[i];
+	}
+	os_free(old);
+
+	return 0;
+}
+
+
+static void afq_node_unindex(struct afq_nodes *tbl, struct afq *node)
+{
+	size_t mask = tbl->size - 1;
+	size_t i, j, home;
+
+	i = afq_node_slot(tbl, node->addr);
+	if (tbl->slots[i] != node)
+		return;
+
+	/* Shift the rest of the probe sequence back over the hole */
+	tbl->slots[i] = NULL;
+	for (j = (i + 1) & mask; tbl->slots[j]; j = (j + 1) & mask){
+		home = afq_node_hash(tbl, tbl->slots[j]->addr) & mask;
+		if (((j - home) & mask) >= ((j - i) & mask)){
+			tbl->slots[i] = tbl->slots[j];
+			tbl->slots[j] = NULL;
+			i = j;
+		}
+	}
+	tbl->count--;
+}
+
+
+static struct afq * afq_node_pool_get(struct afq_nodes *tbl)
+{
+	struct afq_node_chunk *chunk;
+	struct afq *node;
+	int i;
+
+	if (tbl->free_list == NULL){
+		chunk = os_malloc(sizeof(*chunk));
+		if (chunk == NULL)
+			return NULL;
+		chunk->next = tbl->chunks;
+		tbl->chunks = chunk;
+		for (i = AFQ_NODE_CHUNK - 1; i >= 0; i--){
+			chunk->nodes[i].next = tbl->free_list;
+			tbl->free_list = &chunk->nodes[i];
+		}
+	}
+
+	node = tbl->free_list;
+	tbl->free_list = node->next;
+	os_memset(node, 0, sizeof(*node));
+
+	return node;
+}
+
+
+/* Nothing would be lost with the node, topic memberships included */
+static int afq_node_idle(struct hostapd_data *hapd, struct afq *node)
+{
+	return node->pending == NULL && node->txq_len == 0 &&
+		dl_list_empty(&node->acks) && node->num_topics == 0 &&
+		ap_get_sta(hapd, node->addr) == NULL;
+}
+
+
+/* Make room for a new node by dropping the least recently used idle one */
+static int afq_node_evict(struct hostapd_data *hapd)
+{
+	struct afq_nodes *tbl = hapd->nodes;
+	struct afq *node;
+	int scanned = 0;
+
+	dl_list_for_each(node, &tbl->lru, struct afq, lru){
+		if (scanned++ >= AFQ_NODE_EVICT_SCAN)
+			break;
+		if (!afq_node_idle(hapd, node))
+			continue;
+
+		wpa_printf(MSG_DEBUG, "Evicting idle node " MACSTR, MAC2STR(node->addr));
+		afq_stats_inc(hapd, AFQ_CNT_NODES_EVICTED);
+		hostapd_not_node_delete(hapd, node->addr);
+		return 0;
+	}
+
+	return -1;
+}
+
+
+struct afq * getNode(struct hostapd_data *hapd, const u8 *addr)
+{
+	struct afq_nodes *tbl = hapd->nodes;
+	struct afq *node;
+
+	if (tbl == NULL)
+		return NULL;
+
+	node = tbl->slots[afq_node_slot(tbl, addr)];
+	if (node){
+		dl_list_del(&node->lru);
+		dl_list_add_tail(&tbl->lru, &node->lru);
+	}
+
+	return node;
+}
+
+
+/* Allocate and index a zeroed node for addr, which must not have one yet */
+struct afq * afq_node_alloc(struct hostapd_data *hapd, const u8 *addr)
+{
+	struct afq_nodes *tbl = hapd->nodes;
+	struct afq *node;
+
+	if (tbl == NULL)
+		return NULL;
+
+	if (tbl->count >= tbl->max_nodes && afq_node_evict(hapd)){
+		wpa_printf(MSG_DEBUG, "Node limit %u reached, no idle node to evict",
+			   tbl->max_nodes);
+		return NULL;
+	}
+
+	if ((tbl->count + 1) * 4 > tbl->size * 3 &&
+	    afq_node_resize(tbl, tbl->size * 2))
+		return NULL;
+
+	node = afq_node_pool_get(tbl);
+	if (node == NULL)
+		return NULL;
+
+	os_memcpy(node->addr, addr, ETH_ALEN);
+	tbl->slots[afq_node_slot(tbl, addr)] = node;
+	tbl->count++;
+	dl_list_add_tail(&tbl->lru, &node->lru);
+
+	return node;
+}
+
+
+/* Remove a node from the index and return it to the pool */
+void afq_node_release(struct hostapd_data *hapd, struct afq *node)
+{
+	struct afq_nodes *tbl = hapd->nodes;
+
+	afq_node_unindex(tbl, node);
+	dl_list_del(&node->lru);
+
+	node->next = tbl->free_list;
+	tbl->free_list = node;
+}
+
+
+/*
+ * Iterate over all nodes, *iter starts at 0. The index must not be changed
+ * while iterating.
+ */
+struct afq * afq_node_next(struct hostapd_data *hapd, size_t *iter)
+{
+	struct afq_nodes *tbl = hapd->nodes;
+
+	if (tbl == NULL)
+		return NULL;
+
+	while (*iter < tbl->size){
+		if (tbl->slots[(*iter)++])
+			return tbl->slots[*iter - 1];
+	}
+
+	return NULL;
+}
+
+
+/* Drop every node at once, the caller has released what they held */
+void afq_nodes_clear(struct hostapd_data *hapd)
+{
+	struct afq_nodes *tbl = hapd->nodes;
+	size_t i;
+
+	if (tbl == NULL)
+		return;
+
+	for (i = 0; i < tbl->size; i++){
+		if (tbl->slots[i] == NULL)
+			continue;
+		tbl->slots[i]->next = tbl->free_list;
+		tbl->free_list = tbl->slots[i];
+		tbl->slots[i] = NULL;
+	}
+	tbl->count = 0;
+	dl_list_init(&tbl->lru);
+}
+
+
+int afq_nodes_set_max(struct hostapd_data *hapd, const char *buf)
+{
+	int max = atoi(buf);
+
+	if (hapd->nodes == NULL || max < AFQ_NODE_MIN_MAX)
+		return -1;
+
+	hapd->nodes->max_nodes = max;
+	wpa_printf(MSG_DEBUG, "Up to %d nodes are kept", max);
+	return 0;
+}
+
+
+int afq_nodes_init(struct hostapd_data *hapd)
+{
+	struct afq_nodes *tbl;
+
+	tbl = os_zalloc(sizeof(*tbl));
+	if (tbl == NULL)
+		return -1;
+
+	tbl->slots = os_calloc(AFQ_NODE_MIN_SLOTS, sizeof(struct afq *));
+	if (tbl->slots == NULL){
+		os_free(tbl);
+		return -1;
+	}
+	tbl->size = AFQ_NODE_MIN_SLOTS;
+	tbl->max_nodes = AFQ_NODE_DEFAULT_MAX;
+	dl_list_init(&tbl->lru);
+	/* Keep crafted addresses from piling up in one probe sequence */
+	if (os_get_random((u8 *) &tbl->seed, sizeof(tbl->seed)) < 0)
+		tbl->seed = (u32) os_random();
+
+	hapd->nodes = tbl;
+	return 0;
+}
+
+
+void afq_nodes_deinit(struct hostapd_data *hapd)
+{
+	struct afq_nodes *tbl = hapd->nodes;
+	struct afq_node_chunk *chunk;
+
+	if (tbl == NULL)
+		return;
+
+	while (tbl->chunks){
+		chunk = tbl->chunks;
+		tbl->chunks = chunk->next;
+		os_free(chunk);
+	}
+	os_free(tbl->slots);
+	os_free(tbl);
+	hapd->nodes = NULL;
+}
+
+#endif /* CONFIG_ACTION_NOTIFICATION */
@@ -0,0 +1,386 @@
+/*
+ * hostapd / Hyperlocal query answer cache
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * When enabled with "QCACHE 1", hyperlocal queries are keyed by their
+ * payload. The first query for a key is sent upstream as
+ * "NOT_QRY Addr:<station> QID:<qid>-<payload>" and every identical query
+ * that arrives before the answer just waits on the same entry. Answers of
+ * stations to WAIT_RESP messages are never cached, they go upstream as
+ * NOT_RESP. The handling unit answers with "QRESP <qid> <ttl> <payload>";
+ * the answer is queued for every waiting station and, with a non-zero ttl,
+ * kept to answer later queries locally for ttl seconds. Every station gets
+ * the answer as a WLAN_PA_QUERY_RESP for the query id it asked with. The
+ * ids are unique across the BSSes, so a QRESP without "IFNAME=" only
+ * answers the BSS that asked.
+ */
+
+#include "utils/includes.h"
+
+#ifdef CONFIG_ACTION_NOTIFICATION
+
+#include "utils/common.h"
+#include "common/ieee802_11_defs.h"
+#include "hostapd.h"
+#include "ap_action_i.h"
+
+#define AFQ_QCACHE_BUCKETS 256
+#define AFQ_QCACHE_MAX_ENTRIES 1024
+#define AFQ_QCACHE_MAX_WAITERS 256
+/* Upstream gets this long to answer before the waiters are given up */
+#define AFQ_QCACHE_PENDING_TIMEOUT 10
+#define AFQ_QCACHE_MAX_TTL 86400
+
+struct afq_qwaiter {
+	u8 addr[ETH_ALEN];
+	u32 qid; /* the station's query id */
+};
+
+struct afq_qentry {
+	struct dl_list list; /* hash bucket */
+	struct dl_list age; /* afq_qcache::age, oldest first */
+	struct hostapd_data *hapd;
+	u32 qid;
+	u32 hash;
+	u8 *query;
+	size_t query_len;
+
+	/* Stations waiting for the answer while upstream is asked */
+	struct afq_qwaiter *waiters;
+	unsigned int num_waiters;
+
+	/* Answer, NULL while pending */
+	struct wpabuf *answer;
+	struct afq_timer timer;
+	struct os_reltime asked; /* sent upstream */
+};
+
+struct afq_qcache {
+	int enabled;
+	struct dl_list buckets[AFQ_QCACHE_BUCKETS];
+	struct dl_list age;
+	unsigned int count;
+};
+
+
+static u32 afq_qcache_hash(const u8 *data, size_t len)
+{
+	u32 h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++){
+		h ^= data[i];
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+
+static void afq_qentry_free(struct afq_qcache *qc, struct afq_qentry *e)
+{
+	afq_timer_del(&e->timer);
+	dl_list_del(&e->list);
+	dl_list_del(&e->age);
+	qc->count--;
+	wpabuf_free(e->answer);
+	os_free(e->waiters);
+	os_free(e->query);
+	os_free(e);
+}
+
+
+static void afq_qentry_timeout(struct hostapd_data *hapd, void *ctx)
+{
+	struct afq_qentry *e = ctx;
+
+	if (e->answer == NULL)
+		wpa_printf(MSG_DEBUG, "Query %u not answered, %u stations dropped",
+			   e->qid, e->num_waiters);
+	afq_qentry_free(hapd->qcache, e);
+}
+
+
+static struct afq_qentry * afq_qcache_find(struct afq_qcache *qc,
+					   const u8 *query, size_t len,
+					   u32 hash)
+{
+	struct afq_qentry *e;
+
+	dl_list_for_each(e, &qc->buckets[hash % AFQ_QCACHE_BUCKETS],
+			 struct afq_qentry, list){
+		if (e->hash == hash && e->query_len == len &&
+		    os_memcmp(e->query, query, len) == 0)
+			return e;
+	}
+
+	return NULL;
+}
+
+
+static struct afq_qentry * afq_qcache_find_qid(struct afq_qcache *qc,
+					       u32 qid)
+{
+	struct afq_qentry *e;
+
+	dl_list_for_each(e, &qc->age, struct afq_qentry, age){
+		if (e->qid == qid)
+			return e;
+	}
+
+	return NULL;
+}
+
+
+static int afq_qentry_wait(struct afq_qentry *e, const u8 *addr, u32 qid)
+{
+	struct afq_qwaiter *n;
+	unsigned int i;
+
+	for (i = 0; i < e->num_waiters; i++){
+		if (os_memcmp(e->waiters[i].addr, addr, ETH_ALEN) == 0 &&
+		    e->waiters[i].qid == qid)
+			return 0;
+	}
+
+	if (e->num_waiters >= AFQ_QCACHE_MAX_WAITERS)
+		return -1;
+
+	n = os_realloc_array(e->waiters, e->num_waiters + 1, sizeof(*n));
+	if (n == NULL)
+		return -1;
+	e->waiters = n;
+	os_memcpy(n[e->num_waiters].addr, addr, ETH_ALEN);
+	n[e->num_waiters++].qid = qid;
+
+	return 0;
+}
+
+
+/* Queue the answer of e for the query qid of addr */
+static u32 afq_qentry_answer(struct hostapd_data *hapd, struct afq_qentry *e,
+			     const u8 *addr, u32 qid)
+{
+	struct wpabuf *buf;
+	u32 mid;
+
+	buf = afq_qresp_payload(qid, wpabuf_head(e->answer),
+				wpabuf_len(e->answer));
+	if (buf == NULL)
+		return 0;
+	mid = afq_push(hapd, addr, WLAN_PA_QUERY_RESP, AFQ_PRIO_NORMAL,
+		       wpabuf_head(buf), wpabuf_len(buf), 0, 0);
+	wpabuf_free(buf);
+
+	return mid;
+}
+
+
+/* Ask upstream for the answer of e, on behalf of the first station asking */
+static void afq_qcache_ask(struct hostapd_data *hapd, struct afq_qentry *e)
+{
+	char hdr[64];
+	int hdrlen;
+	struct wpabuf *buf;
+
+	hdrlen = os_snprintf(hdr, sizeof(hdr), "Addr:" MACSTR " QID:%u-",
+			     MAC2STR(e->waiters[0].addr), e->qid);
+	if (os_snprintf_error(sizeof(hdr), hdrlen))
+		return;
+
+	buf = wpabuf_alloc(hdrlen + e->query_len);
+	if (buf == NULL)
+		return;
+	wpabuf_put_data(buf, hdr, hdrlen);
+	wpabuf_put_data(buf, e->query, e->query_len);
+
+	wpa_printf(MSG_DEBUG, "Sending query %u upstream for handling", e->qid);
+	os_get_reltime(&e->asked);
+	hapd_not_iface_send(hapd, HAPD_NOT_EV_NOT_QRY, "NOT_QRY", 7,
+			    wpabuf_head(buf), wpabuf_len(buf));
+	wpabuf_free(buf);
+}
+
+
+/*
+ * Look up a query from addr. Returns 1 if the cached answer was queued for
+ * the station, 0 if the station waits for the upstream answer and -1 if the
+ * cache is off and the query has to be handled the old way.
+ */
+int afq_qcache_query(struct hostapd_data *hapd, const u8 *addr, u32 qid,
+		     const u8 *query, size_t len)
+{
+	struct afq_qcache *qc = hapd->qcache;
+	struct afq_global *g;
+	struct afq_qentry *e;
+	u32 hash;
+
+	if (qc == NULL || !qc->enabled)
+		return -1;
+
+	hash = afq_qcache_hash(query, len);
+	e = afq_qcache_find(qc, query, len, hash);
+
+	if (e && e->answer){
+		afq_stats_inc(hapd, AFQ_CNT_QCACHE_HITS);
+		wpa_printf(MSG_DEBUG, "Query %u answered from cache for " MACSTR,
+			   e->qid, MAC2STR(addr));
+		if (afq_qentry_answer(hapd, e, addr, qid) == 0)
+			return -1;
+		return 1;
+	}
+
+	if (e){
+		afq_stats_inc(hapd, AFQ_CNT_QCACHE_COALESCED);
+		wpa_printf(MSG_DEBUG, "Query from " MACSTR " joins pending query %u",
+			   MAC2STR(addr), e->qid);
+		return afq_qentry_wait(e, addr, qid) ? -1 : 0;
+	}
+
+	afq_stats_inc(hapd, AFQ_CNT_QCACHE_MISSES);
+
+	if (qc->count >= AFQ_QCACHE_MAX_ENTRIES)
+		afq_qentry_free(qc, dl_list_first(&qc->age, struct afq_qentry,
+						  age));
+
+	e = os_zalloc(sizeof(*e));
+	if (e == NULL)
+		return -1;
+	e->query = os_memdup(query, len);
+	if (e->query == NULL && len){
+		os_free(e);
+		return -1;
+	}
+	e->query_len = len;
+	e->hash = hash;
+	e->hapd = hapd;
+	/* Unique on every BSS, so a QRESP without IFNAME= finds only this one */
+	g = afq_global(hapd);
+	if (++g->query_id == 0)
+		g->query_id++;
+	e->qid = g->query_id;
+	afq_timer_init(&e->timer, afq_qentry_timeout, e);
+	dl_list_add_tail(&qc->buckets[hash % AFQ_QCACHE_BUCKETS], &e->list);
+	dl_list_add_tail(&qc->age, &e->age);
+	qc->count++;
+
+	if (afq_qentry_wait(e, addr, qid)){
+		afq_qentry_free(qc, e);
+		return -1;
+	}
+
+	afq_timer_mod(hapd, &e->timer, AFQ_QCACHE_PENDING_TIMEOUT, 0);
+	afq_qcache_ask(hapd, e);
+
+	return 0;
+}
+
+
+/* QRESP <qid> <ttl> <payload>, the answer goes out as a WLAN_PA_QUERY_RESP */
+int afq_qcache_resp(struct hostapd_data *hapd, const char *buf)
+{
+	struct afq_qcache *qc = hapd->qcache;
+	struct afq_qentry *e;
+	const char *pos = buf;
+	char *end;
+	unsigned long qid, ttl;
+	unsigned int i;
+	size_t len;
+
+	if (qc == NULL)
+		return -1;
+
+	qid = strtoul(pos, &end, 10);
+	if (end == pos || *end != ' ')
+		return -1;
+	pos = end + 1;
+	ttl = strtoul(pos, &end, 10);
+	if (end == pos || *end != ' ' || ttl > AFQ_QCACHE_MAX_TTL)
+		return -1;
+	pos = end + 1;
+	len = os_strlen(pos);
+
+	e = afq_qcache_find_qid(qc, qid);
+	if (e == NULL || e->answer){
+		wpa_printf(MSG_DEBUG, "No pending query %lu", qid);
+		return -1;
+	}
+
+	e->answer = wpabuf_alloc_copy(pos, len);
+	if (e->answer == NULL)
+		return -1;
+	afq_stats_lat(hapd, AFQ_LAT_QUERY, &e->asked);
+
+	wpa_printf(MSG_DEBUG, "Query %u answered, %u stations waiting",
+		   e->qid, e->num_waiters);
+	for (i = 0; i < e->num_waiters; i++)
+		afq_qentry_answer(hapd, e, e->waiters[i].addr,
+				  e->waiters[i].qid);
+	os_free(e->waiters);
+	e->waiters = NULL;
+	e->num_waiters = 0;
+
+	if (ttl == 0){
+		afq_qentry_free(qc, e);
+		return 0;
+	}
+
+	afq_timer_mod(hapd, &e->timer, ttl, 0);
+	return 0;
+}
+
+
+/* QCACHE <0|1>, turning the cache off drops every entry */
+int afq_qcache_set(struct hostapd_data *hapd, const char *buf)
+{
+	struct afq_qcache *qc = hapd->qcache;
+	int enabled = atoi(buf);
+
+	if (qc == NULL || enabled < 0 || enabled > 1)
+		return -1;
+
+	if (!enabled){
+		while (!dl_list_empty(&qc->age))
+			afq_qentry_free(qc, dl_list_first(&qc->age,
+							  struct afq_qentry,
+							  age));
+	}
+	qc->enabled = enabled;
+
+	return 0;
+}
+
+
+int afq_qcache_init(struct hostapd_data *hapd)
+{
+	struct afq_qcache *qc;
+	int i;
+
+	qc = os_zalloc(sizeof(*qc));
+	if (qc == NULL)
+		return -1;
+
+	for (i = 0; i < AFQ_QCACHE_BUCKETS; i++)
+		dl_list_init(&qc->buckets[i]);
+	dl_list_init(&qc->age);
+
+	hapd->qcache = qc;
+	return 0;
+}
+
+
+void afq_qcache_deinit(struct hostapd_data *hapd)
+{
+	struct afq_qcache *qc = hapd->qcache;
+
+	if (qc == NULL)
+		return;
+
+	afq_qcache_set(hapd, "0");
+	os_free(qc);
+	hapd->qcache = NULL;
+}
+
+#endif /* CONFIG_ACTION_NOTIFICATION */
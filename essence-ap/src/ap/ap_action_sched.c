@@ -0,0 +1,504 @@
+/*
+ * hostapd / Hyperlocal action frame TX scheduler
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * Hyperlocal frames are not handed to the driver from the probe request and
+ * PUSH handlers directly. They are queued per station and released from
+ * eloop under a global frames/s and bytes/s budget, with a token bucket per
+ * station and deficit round robin between the stations that have a backlog.
+ * Urgent frames go ahead of the rest of their station's backlog and put the
+ * station at the front of the round.
+ */
+
+#include "utils/includes.h"
+
+#ifdef CONFIG_ACTION_NOTIFICATION
+
+#include "utils/common.h"
+#include "utils/eloop.h"
+#include "hostapd.h"
+#include "ap_drv_ops.h"
+#include "ap_action_i.h"
+
+#define AFQ_SCHED_TICK_MS 10
+#define AFQ_SCHED_QUANTUM 1500
+/* Largest MMPDU, used to bound the DRR deficit and the byte budget burst */
+#define AFQ_SCHED_MAX_FRAME 2304
+#define AFQ_SCHED_STA_QLEN 64
+#define AFQ_SCHED_DEFAULT_FPS 300
+#define AFQ_SCHED_DEFAULT_BPS 200000
+#define AFQ_SCHED_DEFAULT_STA_FPS 50
+#define AFQ_SCHED_STA_BURST 16
+
+struct afq_tx {
+	struct dl_list list;
+	struct afq_frame *frame; /* shared frame, num is patched at dequeue */
+	struct wpabuf *buf; /* or a frame owned by this entry */
+	u16 num;
+	u8 prio; /* enum afq_prio */
+	size_t len;
+	struct os_reltime queued;
+};
+
+struct afq_sched {
+	struct dl_list active; /* struct afq with a backlog, in DRR order */
+	struct afq_bucket fps;
+	struct afq_bucket bps;
+	u32 sta_fps;
+	int tick_registered;
+
+	unsigned int depth;
+	unsigned int max_depth;
+	unsigned int num_active;
+	u64 enqueued;
+	u64 sent;
+	u64 sent_bytes;
+	u64 dropped;
+	u64 tx_errors;
+
+	/* Send rate over the last complete measurement window */
+	struct os_reltime win_start;
+	u64 win_sent;
+	u64 win_bytes;
+	u32 cur_fps;
+	u32 cur_bps;
+};
+
+static void afq_sched_tick(void *eloop_ctx, void *timeout_ctx);
+
+
+static void afq_bucket_init(struct afq_bucket *b, u32 rate, u32 burst)
+{
+	b->rate = rate;
+	b->burst = burst;
+	b->tokens = (u64) burst * 1000;
+	os_get_reltime(&b->last);
+}
+
+
+static void afq_bucket_fill(struct afq_bucket *b, struct os_reltime *now)
+{
+	struct os_reltime age;
+	u64 max;
+
+	if (b->rate == 0)
+		return;
+
+	os_reltime_sub(now, &b->last, &age);
+	b->last = *now;
+	max = (u64) b->burst * 1000;
+	b->tokens += ((u64) age.sec * 1000000 + age.usec) * b->rate / 1000;
+	if (b->tokens > max)
+		b->tokens = max;
+}
+
+
+static int afq_bucket_ok(struct afq_bucket *b, size_t amount)
+{
+	return b->rate == 0 || b->tokens >= (u64) amount * 1000;
+}
+
+
+static void afq_bucket_take(struct afq_bucket *b, size_t amount)
+{
+	if (b->rate == 0)
+		return;
+	b->tokens -= (u64) amount * 1000;
+}
+
+
+static u32 afq_sched_fps_burst(u32 fps)
+{
+	return fps / 10 + 1;
+}
+
+
+static u32 afq_sched_bps_burst(u32 bps)
+{
+	return bps / 10 > AFQ_SCHED_MAX_FRAME ? bps / 10 : AFQ_SCHED_MAX_FRAME;
+}
+
+
+static void afq_tx_free(struct afq_tx *tx)
+{
+	afq_frame_put(tx->frame);
+	wpabuf_free(tx->buf);
+	os_free(tx);
+}
+
+
+static void afq_sched_window(struct afq_sched *s, struct os_reltime *now)
+{
+	struct os_reltime age;
+	u64 usec;
+
+	os_reltime_sub(now, &s->win_start, &age);
+	if (age.sec < 1)
+		return;
+
+	usec = (u64) age.sec * 1000000 + age.usec;
+	s->cur_fps = s->win_sent * 1000000 / usec;
+	s->cur_bps = s->win_bytes * 1000000 / usec;
+	s->win_sent = 0;
+	s->win_bytes = 0;
+	s->win_start = *now;
+}
+
+
+static void afq_tx_send(struct hostapd_data *hapd, struct afq *node,
+			struct afq_tx *tx)
+{
+	struct afq_sched *s = hapd->sched;
+	struct wpabuf *buf = tx->frame ? tx->frame->buf : tx->buf;
+
+	if (tx->frame)
+		WPA_PUT_LE16(wpabuf_mhead_u8(buf) + wpabuf_len(buf) - 2,
+			     tx->num);
+
+	if (hostapd_drv_send_action(hapd, hapd->iface->freq, 0, node->addr,
+				    wpabuf_head(buf), wpabuf_len(buf))) {
+		wpa_printf(MSG_ERROR, "action frame notification not sent to "
+			   MACSTR, MAC2STR(node->addr));
+		s->tx_errors++;
+	} else {
+		AFQ_TRACE(AFQ_TR_TX, node->addr, tx->len, tx->prio);
+		afq_stats_lat(hapd, AFQ_LAT_SCHED, &tx->queued);
+		s->sent++;
+		s->sent_bytes += tx->len;
+		s->win_sent++;
+		s->win_bytes += tx->len;
+	}
+
+	afq_tx_free(tx);
+}
+
+
+static void afq_sched_run(struct hostapd_data *hapd)
+{
+	struct afq_sched *s = hapd->sched;
+	struct os_reltime now;
+	struct afq *node;
+	struct afq_tx *tx;
+	unsigned int stalled = 0;
+	int sent;
+
+	os_get_reltime(&now);
+	afq_bucket_fill(&s->fps, &now);
+	afq_bucket_fill(&s->bps, &now);
+
+	while ((node = dl_list_first(&s->active, struct afq, sched_list))) {
+		if (!afq_bucket_ok(&s->fps, 1))
+			break;
+
+		node->tb.rate = s->sta_fps;
+		afq_bucket_fill(&node->tb, &now);
+
+		node->deficit += AFQ_SCHED_QUANTUM;
+		if (node->deficit > AFQ_SCHED_QUANTUM + AFQ_SCHED_MAX_FRAME)
+			node->deficit = AFQ_SCHED_QUANTUM + AFQ_SCHED_MAX_FRAME;
+
+		sent = 0;
+		while ((tx = dl_list_first(&node->txq, struct afq_tx, list))) {
+			if ((int) tx->len > node->deficit ||
+			    !afq_bucket_ok(&node->tb, 1) ||
+			    !afq_bucket_ok(&s->fps, 1) ||
+			    !afq_bucket_ok(&s->bps, tx->len))
+				break;
+
+			dl_list_del(&tx->list);
+			node->txq_len--;
+			s->depth--;
+			node->deficit -= tx->len;
+			afq_bucket_take(&node->tb, 1);
+			afq_bucket_take(&s->fps, 1);
+			afq_bucket_take(&s->bps, tx->len);
+			afq_tx_send(hapd, node, tx);
+			sent++;
+		}
+
+		dl_list_del(&node->sched_list);
+		if (node->txq_len == 0) {
+			node->deficit = 0;
+			s->num_active--;
+		} else {
+			dl_list_add_tail(&s->active, &node->sched_list);
+		}
+
+		/* Every station with a backlog is rate limited for now */
+		if (sent)
+			stalled = 0;
+		else if (++stalled > 2 * s->num_active)
+			break;
+	}
+
+	afq_sched_window(s, &now);
+
+	if (!dl_list_empty(&s->active) && !s->tick_registered) {
+		s->tick_registered = 1;
+		eloop_register_timeout(0, AFQ_SCHED_TICK_MS * 1000,
+				       afq_sched_tick, hapd, NULL);
+	}
+}
+
+
+static void afq_sched_tick(void *eloop_ctx, void *timeout_ctx)
+{
+	struct hostapd_data *hapd = eloop_ctx;
+
+	hapd->sched->tick_registered = 0;
+	afq_sched_run(hapd);
+}
+
+
+static int afq_sched_add(struct hostapd_data *hapd, struct afq *node,
+			 struct afq_tx *tx)
+{
+	struct afq_sched *s = hapd->sched;
+	struct afq_tx *pos, *last;
+
+	last = dl_list_last(&node->txq, struct afq_tx, list);
+	if (s && node->txq_len >= AFQ_SCHED_STA_QLEN &&
+	    tx->prio == AFQ_PRIO_URGENT && last->prio != AFQ_PRIO_URGENT) {
+		/* Make room by dropping the newest less urgent frame */
+		dl_list_del(&last->list);
+		afq_tx_free(last);
+		node->txq_len--;
+		s->depth--;
+		s->dropped++;
+	}
+
+	if (s == NULL || node->txq_len >= AFQ_SCHED_STA_QLEN) {
+		wpa_printf(MSG_DEBUG, "TX queue for " MACSTR " is full",
+			   MAC2STR(node->addr));
+		if (s)
+			s->dropped++;
+		afq_tx_free(tx);
+		return -1;
+	}
+
+	if (tx->prio == AFQ_PRIO_URGENT) {
+		/* Behind the urgent frames already queued, ahead of the rest */
+		dl_list_for_each(pos, &node->txq, struct afq_tx, list) {
+			if (pos->prio != AFQ_PRIO_URGENT)
+				break;
+		}
+		dl_list_add_tail(&pos->list, &tx->list);
+	} else {
+		dl_list_add_tail(&node->txq, &tx->list);
+	}
+
+	if (node->txq_len++ == 0) {
+		if (tx->prio == AFQ_PRIO_URGENT)
+			dl_list_add(&s->active, &node->sched_list);
+		else
+			dl_list_add_tail(&s->active, &node->sched_list);
+		s->num_active++;
+	} else if (tx->prio == AFQ_PRIO_URGENT) {
+		dl_list_del(&node->sched_list);
+		dl_list_add(&s->active, &node->sched_list);
+	}
+
+	os_get_reltime(&tx->queued);
+	s->enqueued++;
+	if (++s->depth > s->max_depth)
+		s->max_depth = s->depth;
+
+	/* Send right away unless a backlog is already being paced */
+	if (!s->tick_registered)
+		afq_sched_run(hapd);
+
+	return 0;
+}
+
+
+/**
+ * afq_sched_frame - Queue a shared frame for a station
+ * @hapd: BSS data
+ * @node: Destination station
+ * @frame: Encoded frame, a reference is taken for the queue
+ * @num: Value for the trailing num field of this transmission
+ * @prio: Priority class of the frame (enum afq_prio)
+ * Returns: 0 on success, -1 if the frame was dropped
+ */
+int afq_sched_frame(struct hostapd_data *hapd, struct afq *node,
+		    struct afq_frame *frame, u16 num, u8 prio)
+{
+	struct afq_tx *tx;
+
+	tx = os_zalloc(sizeof(*tx));
+	if (tx == NULL)
+		return -1;
+
+	tx->frame = afq_frame_get(frame);
+	tx->num = num;
+	tx->prio = prio;
+	tx->len = wpabuf_len(frame->buf);
+
+	return afq_sched_add(hapd, node, tx);
+}
+
+
+/**
+ * afq_sched_buf - Queue a frame built for a single station
+ * @hapd: BSS data
+ * @node: Destination station
+ * @buf: Frame, freed by the scheduler in all cases
+ * @prio: Priority class of the frame (enum afq_prio)
+ * Returns: 0 on success, -1 if the frame was dropped
+ */
+int afq_sched_buf(struct hostapd_data *hapd, struct afq *node,
+		  struct wpabuf *buf, u8 prio)
+{
+	struct afq_tx *tx;
+
+	tx = os_zalloc(sizeof(*tx));
+	if (tx == NULL) {
+		wpabuf_free(buf);
+		return -1;
+	}
+
+	tx->buf = buf;
+	tx->prio = prio;
+	tx->len = wpabuf_len(buf);
+
+	return afq_sched_add(hapd, node, tx);
+}
+
+
+void afq_sched_node_init(struct hostapd_data *hapd, struct afq *node)
+{
+	dl_list_init(&node->txq);
+	dl_list_init(&node->sched_list);
+	node->txq_len = 0;
+	node->deficit = 0;
+	afq_bucket_init(&node->tb, hapd->sched ? hapd->sched->sta_fps : 0,
+			AFQ_SCHED_STA_BURST);
+}
+
+
+/* Drop the backlog of a station that is going away */
+void afq_sched_node_flush(struct hostapd_data *hapd, struct afq *node)
+{
+	struct afq_sched *s = hapd->sched;
+	struct afq_tx *tx, *n;
+
+	if (node->txq_len == 0)
+		return;
+
+	dl_list_for_each_safe(tx, n, &node->txq, struct afq_tx, list) {
+		dl_list_del(&tx->list);
+		afq_tx_free(tx);
+	}
+
+	dl_list_del(&node->sched_list);
+	if (s) {
+		s->depth -= node->txq_len;
+		s->dropped += node->txq_len;
+		s->num_active--;
+	}
+	node->txq_len = 0;
+	node->deficit = 0;
+}
+
+
+/* SETTXRATE <frames/s> <bytes/s> [<frames/s per station>], 0 = unlimited */
+int afq_sched_set_rate(struct hostapd_data *hapd, const char *buf)
+{
+	struct afq_sched *s = hapd->sched;
+	const char *pos;
+	int fps, bps, sta_fps;
+
+	if (s == NULL)
+		return -1;
+
+	fps = atoi(buf);
+	pos = os_strchr(buf, ' ');
+	if (pos == NULL)
+		return -1;
+	bps = atoi(pos + 1);
+	pos = os_strchr(pos + 1, ' ');
+	sta_fps = pos ? atoi(pos + 1) : (int) s->sta_fps;
+
+	if (fps < 0 || bps < 0 || sta_fps < 0)
+		return -1;
+
+	afq_bucket_init(&s->fps, fps, afq_sched_fps_burst(fps));
+	afq_bucket_init(&s->bps, bps, afq_sched_bps_burst(bps));
+	s->sta_fps = sta_fps;
+
+	wpa_printf(MSG_DEBUG, "Hyperlocal TX budget: %d frames/s, %d bytes/s, "
+		   "%d frames/s per station", fps, bps, sta_fps);
+
+	return 0;
+}
+
+
+int afq_sched_stats(struct hostapd_data *hapd, char *buf, size_t buflen)
+{
+	struct afq_sched *s = hapd->sched;
+	struct os_reltime now;
+	int ret;
+
+	if (s == NULL)
+		return -1;
+
+	os_get_reltime(&now);
+	afq_sched_window(s, &now);
+
+	ret = os_snprintf(buf, buflen,
+			  "depth=%u\nmax_depth=%u\nactive=%u\n"
+			  "enqueued=%llu\nsent=%llu\nsent_bytes=%llu\n"
+			  "dropped=%llu\ntx_errors=%llu\n"
+			  "fps=%u\nbps=%u\n"
+			  "limit_fps=%u\nlimit_bps=%u\nlimit_sta_fps=%u\n",
+			  s->depth, s->max_depth, s->num_active,
+			  (unsigned long long) s->enqueued,
+			  (unsigned long long) s->sent,
+			  (unsigned long long) s->sent_bytes,
+			  (unsigned long long) s->dropped,
+			  (unsigned long long) s->tx_errors,
+			  s->cur_fps, s->cur_bps,
+			  s->fps.rate, s->bps.rate, s->sta_fps);
+	if (os_snprintf_error(buflen, ret))
+		return -1;
+
+	return ret;
+}
+
+
+int afq_sched_init(struct hostapd_data *hapd)
+{
+	struct afq_sched *s;
+
+	s = os_zalloc(sizeof(*s));
+	if (s == NULL)
+		return -1;
+
+	dl_list_init(&s->active);
+	afq_bucket_init(&s->fps, AFQ_SCHED_DEFAULT_FPS,
+			afq_sched_fps_burst(AFQ_SCHED_DEFAULT_FPS));
+	afq_bucket_init(&s->bps, AFQ_SCHED_DEFAULT_BPS,
+			afq_sched_bps_burst(AFQ_SCHED_DEFAULT_BPS));
+	s->sta_fps = AFQ_SCHED_DEFAULT_STA_FPS;
+	os_get_reltime(&s->win_start);
+
+	hapd->sched = s;
+
+	return 0;
+}
+
+
+/* All stations must have been flushed with afq_sched_node_flush() */
+void afq_sched_deinit(struct hostapd_data *hapd)
+{
+	if (hapd->sched == NULL)
+		return;
+
+	eloop_cancel_timeout(afq_sched_tick, hapd, NULL);
+	os_free(hapd->sched);
+	hapd->sched = NULL;
+}
+
+#endif /* CONFIG_ACTION_NOTIFICATION */
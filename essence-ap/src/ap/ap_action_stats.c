@@ -0,0 +1,240 @@
+/*
+ * hostapd / Hyperlocal pipeline statistics
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * Per-BSS event counters and latency histograms of the push pipeline,
+ * reported by HYPERLOCAL_STATS. A histogram has fixed power of two buckets
+ * in milliseconds, so recording a sample is a shift loop and the output of
+ * two BSSes or two readings can be compared bucket by bucket. The stages
+ * are measured separately so a slow delivery can be attributed to waiting
+ * for the station, to the TX budget, to the air or to the handling unit.
+ */
+
+#include "utils/includes.h"
+
+#ifdef CONFIG_ACTION_NOTIFICATION
+
+#include "utils/common.h"
+#include "hostapd.h"
+#include "ap_action.h"
+#include "ap_action_i.h"
+
+/* Bucket i counts samples below 2^i ms, the last one everything above */
+#define AFQ_HIST_BUCKETS 18
+
+struct afq_hist {
+	u32 bucket[AFQ_HIST_BUCKETS];
+	u64 count;
+	u64 sum_ms;
+	u32 max_ms;
+};
+
+struct afq_stats {
+	u64 cnt[AFQ_CNT_NUM];
+	struct afq_hist lat[AFQ_LAT_NUM];
+	struct os_reltime since;
+};
+
+static const char * const afq_cnt_names[AFQ_CNT_NUM] = {
+	"pushed", "push_rejected", "bulk_dropped", "expired", "delivered",
+	"failed", "retries", "fetches", "queries", "qcache_hits",
+	"qcache_misses", "qcache_coalesced", "nodes_evicted",
+};
+
+static const char * const afq_lat_names[AFQ_LAT_NUM] = {
+	/* Directed push queued until it is handed to the TX scheduler */
+	"push",
+	/* Frame queued in the TX scheduler until it is given to the driver */
+	"sched",
+	/* Directed message scheduled until its TX status reports an ACK */
+	"ack",
+	/* Fetch request after a probe until the station comes for it */
+	"fetch",
+	/* Query sent upstream until the handling unit answers it */
+	"query",
+};
+
+
+void afq_stats_inc(struct hostapd_data *hapd, enum afq_cnt cnt)
+{
+	if (hapd->stats)
+		hapd->stats->cnt[cnt]++;
+}
+
+
+/* Record the time from start until now in histogram lat */
+void afq_stats_lat(struct hostapd_data *hapd, enum afq_lat lat,
+		   struct os_reltime *start)
+{
+	struct afq_hist *h;
+	struct os_reltime now, age;
+	u32 ms, i;
+
+	if (hapd->stats == NULL)
+		return;
+
+	os_get_reltime(&now);
+	os_reltime_sub(&now, start, &age);
+	if (age.sec < 0)
+		ms = 0;
+	else if (age.sec > 0xffffffff / 1000 - 1)
+		ms = 0xffffffff;
+	else
+		ms = age.sec * 1000 + age.usec / 1000;
+
+	for (i = 0; i < AFQ_HIST_BUCKETS - 1 && ms >= (1U << i); i++)
+		;
+
+	h = &hapd->stats->lat[lat];
+	h->bucket[i]++;
+	h->count++;
+	h->sum_ms += ms;
+	if (ms > h->max_ms)
+		h->max_ms = ms;
+}
+
+
+static int afq_stats_hist(const char *name, const struct afq_hist *h,
+			  char *buf, size_t buflen)
+{
+	char *pos = buf, *end = buf + buflen;
+	int ret, i;
+
+	ret = os_snprintf(pos, end - pos,
+			  "lat_%s_count=%llu\nlat_%s_avg_ms=%llu\n"
+			  "lat_%s_max_ms=%u\nlat_%s_hist=",
+			  name, (unsigned long long) h->count,
+			  name, h->count ? (unsigned long long)
+			  (h->sum_ms / h->count) : 0ULL,
+			  name, h->max_ms, name);
+	if (os_snprintf_error(end - pos, ret))
+		return -1;
+	pos += ret;
+
+	for (i = 0; i < AFQ_HIST_BUCKETS; i++){
+		ret = os_snprintf(pos, end - pos, "%s%u", i ? "," : "",
+				  h->bucket[i]);
+		if (os_snprintf_error(end - pos, ret))
+			return -1;
+		pos += ret;
+	}
+
+	ret = os_snprintf(pos, end - pos, "\n");
+	if (os_snprintf_error(end - pos, ret))
+		return -1;
+	pos += ret;
+
+	return pos - buf;
+}
+
+
+/*
+ * HYPERLOCAL_STATS: counters, the directed messages pending per class, one
+ * histogram per stage and the TX scheduler counters (TXSTATS)
+ */
+int hostapd_not_stats(struct hostapd_data *hapd, char *buf, size_t buflen)
+{
+	struct afq_stats *s = hapd->stats;
+	char *pos = buf, *end = buf + buflen;
+	unsigned int qlen[AFQ_PRIO_NUM] = { 0 };
+	struct os_reltime now, age;
+	struct afq *node;
+	size_t iter = 0;
+	int ret, i;
+
+	if (s == NULL)
+		return -1;
+
+	while ((node = afq_node_next(hapd, &iter))){
+		for (i = 0; i < AFQ_PRIO_NUM; i++)
+			qlen[i] += node->qlen[i];
+	}
+
+	os_get_reltime(&now);
+	os_reltime_sub(&now, &s->since, &age);
+	ret = os_snprintf(pos, end - pos, "uptime=%ld\n", (long) age.sec);
+	if (os_snprintf_error(end - pos, ret))
+		return -1;
+	pos += ret;
+
+	for (i = 0; i < AFQ_CNT_NUM; i++){
+		ret = os_snprintf(pos, end - pos, "%s=%llu\n", afq_cnt_names[i],
+				  (unsigned long long) s->cnt[i]);
+		if (os_snprintf_error(end - pos, ret))
+			return -1;
+		pos += ret;
+	}
+
+	for (i = 0; i < AFQ_PRIO_NUM; i++){
+		ret = os_snprintf(pos, end - pos, "pending_%s=%u\n",
+				  afq_prio_name(i), qlen[i]);
+		if (os_snprintf_error(end - pos, ret))
+			return -1;
+		pos += ret;
+	}
+
+	ret = os_snprintf(pos, end - pos, "lat_hist_bounds_ms=");
+	if (os_snprintf_error(end - pos, ret))
+		return -1;
+	pos += ret;
+	for (i = 0; i < AFQ_HIST_BUCKETS - 1; i++){
+		ret = os_snprintf(pos, end - pos, "%u,", 1U << i);
+		if (os_snprintf_error(end - pos, ret))
+			return -1;
+		pos += ret;
+	}
+	ret = os_snprintf(pos, end - pos, "inf\n");
+	if (os_snprintf_error(end - pos, ret))
+		return -1;
+	pos += ret;
+
+	for (i = 0; i < AFQ_LAT_NUM; i++){
+		ret = afq_stats_hist(afq_lat_names[i], &s->lat[i], pos,
+				     end - pos);
+		if (ret < 0)
+			return -1;
+		pos += ret;
+	}
+
+	ret = afq_sched_stats(hapd, pos, end - pos);
+	if (ret < 0)
+		return -1;
+	pos += ret;
+
+	return pos - buf;
+}
+
+
+/* HYPERLOCAL_STATS_RESET, the TX scheduler keeps its counters */
+void hostapd_not_stats_reset(struct hostapd_data *hapd)
+{
+	struct afq_stats *s = hapd->stats;
+
+	if (s == NULL)
+		return;
+
+	os_memset(s, 0, sizeof(*s));
+	os_get_reltime(&s->since);
+}
+
+
+int afq_stats_init(struct hostapd_data *hapd)
+{
+	hapd->stats = os_zalloc(sizeof(struct afq_stats));
+	if (hapd->stats == NULL)
+		return -1;
+
+	os_get_reltime(&hapd->stats->since);
+	return 0;
+}
+
+
+void afq_stats_deinit(struct hostapd_data *hapd)
+{
+	os_free(hapd->stats);
+	hapd->stats = NULL;
+}
+
+#endif /* CONFIG_ACTION_NOTIFICATION */
@@ -0,0 +1,297 @@
+/*
+ * hostapd / Hyperlocal topic subscriptions
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * Stations join and leave numbered topics with WLAN_PA_HYPERLOCAL_SUBSCRIBE
+ * and the handling unit pushes to a topic with "PUSH topic:<id> ...". The
+ * message is encoded once and queued for every member like a directed one,
+ * so it is aggregated, scheduled and acknowledged per station. Membership
+ * belongs to the node and ends when the node is deleted.
+ */
+
+#include "utils/includes.h"
+
+#ifdef CONFIG_ACTION_NOTIFICATION
+
+#include "utils/common.h"
+#include "hostapd.h"
+#include "ap_action_i.h"
+
+#define AFQ_TOPIC_MAX 256
+#define AFQ_TOPIC_MAX_MEMBERS 4096
+
+struct afq_topic {
+	struct dl_list list;
+	u16 id;
+	struct afq **members;
+	unsigned int num_members;
+};
+
+struct afq_topics {
+	struct dl_list list; /* struct afq_topic */
+	unsigned int count;
+};
+
+
+static struct afq_topic * afq_topic_find(struct afq_topics *tbl, u16 id)
+{
+	struct afq_topic *t;
+
+	dl_list_for_each(t, &tbl->list, struct afq_topic, list){
+		if (t->id == id)
+			return t;
+	}
+
+	return NULL;
+}
+
+
+static void afq_topic_free(struct afq_topics *tbl, struct afq_topic *t)
+{
+	dl_list_del(&t->list);
+	tbl->count--;
+	os_free(t->members);
+	os_free(t);
+}
+
+
+int afq_topic_join(struct hostapd_data *hapd, struct afq *node, u16 id)
+{
+	struct afq_topics *tbl = hapd->topics;
+	struct afq_topic *t;
+	struct afq **n;
+	unsigned int i;
+
+	if (tbl == NULL)
+		return -1;
+
+	for (i = 0; i < node->num_topics; i++){
+		if (node->topics[i] == id)
+			return 0;
+	}
+	if (node->num_topics >= AFQ_TOPIC_NODE_MAX)
+		return -1;
+
+	t = afq_topic_find(tbl, id);
+	if (t == NULL){
+		if (tbl->count >= AFQ_TOPIC_MAX)
+			return -1;
+		t = os_zalloc(sizeof(*t));
+		if (t == NULL)
+			return -1;
+		t->id = id;
+		dl_list_add_tail(&tbl->list, &t->list);
+		tbl->count++;
+	}
+
+	if (t->num_members >= AFQ_TOPIC_MAX_MEMBERS)
+		goto fail;
+	n = os_realloc_array(t->members, t->num_members + 1, sizeof(*n));
+	if (n == NULL)
+		goto fail;
+	t->members = n;
+	t->members[t->num_members++] = node;
+	node->topics[node->num_topics++] = id;
+
+	wpa_printf(MSG_DEBUG, MACSTR " joined topic %u, %u members",
+		   MAC2STR(node->addr), id, t->num_members);
+	return 0;
+
+fail:
+	if (t->num_members == 0)
+		afq_topic_free(tbl, t);
+	return -1;
+}
+
+
+int afq_topic_leave(struct hostapd_data *hapd, struct afq *node, u16 id)
+{
+	struct afq_topics *tbl = hapd->topics;
+	struct afq_topic *t;
+	unsigned int i;
+
+	if (tbl == NULL)
+		return -1;
+
+	for (i = 0; i < node->num_topics; i++){
+		if (node->topics[i] == id)
+			break;
+	}
+	if (i == node->num_topics)
+		return -1;
+	node->topics[i] = node->topics[--node->num_topics];
+
+	t = afq_topic_find(tbl, id);
+	if (t == NULL)
+		return 0;
+
+	for (i = 0; i < t->num_members; i++){
+		if (t->members[i] == node){
+			t->members[i] = t->members[--t->num_members];
+			break;
+		}
+	}
+	if (t->num_members == 0)
+		afq_topic_free(tbl, t);
+
+	wpa_printf(MSG_DEBUG, MACSTR " left topic %u", MAC2STR(node->addr), id);
+	return 0;
+}
+
+
+/* Leave every topic of a node that is going away */
+void afq_topic_node_flush(struct hostapd_data *hapd, struct afq *node)
+{
+	while (node->num_topics)
+		afq_topic_leave(hapd, node, node->topics[0]);
+}
+
+
+/* Drop every topic, the nodes are dropped at the same time */
+void afq_topic_clear(struct hostapd_data *hapd)
+{
+	struct afq_topics *tbl = hapd->topics;
+
+	if (tbl == NULL)
+		return;
+
+	while (!dl_list_empty(&tbl->list))
+		afq_topic_free(tbl, dl_list_first(&tbl->list,
+						  struct afq_topic, list));
+}
+
+
+/* Queue frame for every member of topic id, returns how many got it */
+static unsigned int afq_topic_push_frame(struct hostapd_data *hapd, u16 id,
+					 struct afq_frame *frame, u8 type,
+					 u8 prio, u32 mid, size_t len, u32 ttl,
+					 int defer)
+{
+	struct afq_topic *t;
+	struct afq_mes *mes;
+	unsigned int i, queued = 0;
+
+	t = hapd->topics ? afq_topic_find(hapd->topics, id) : NULL;
+	if (t == NULL)
+		return 0;
+
+	/* Sending can not change the membership, the array stays valid */
+	for (i = 0; i < t->num_members; i++){
+		mes = afq_mes_alloc(hapd, frame, type, prio, mid, len, ttl);
+		if (mes == NULL)
+			break;
+		if (afq_mes_queue(hapd, t->members[i], mes, defer)){
+			afq_mes_free(hapd, mes);
+			continue;
+		}
+		queued++;
+	}
+
+	wpa_printf(MSG_DEBUG, "Message %u queued for %u members of topic %u on %s",
+		   mid, queued, id, hapd->conf->iface);
+
+	return queued;
+}
+
+
+/*
+ * Queue a message for every member of topic id, see afq_push(). All members
+ * share the encoded frame and the message id. Returns the message id or 0 if
+ * the topic has no members or the message could not be queued.
+ */
+u32 afq_topic_push(struct hostapd_data *hapd, u16 id, u8 type, u8 prio,
+		   const u8 *payload, size_t len, u32 ttl, int defer)
+{
+	struct afq_frame *frame;
+	unsigned int queued;
+	u32 mid;
+
+	if (hapd->topics == NULL || len == 0 ||
+	    len > HYPERLOCAL_MAX_PAYLOAD)
+		return 0;
+
+	if (afq_topic_find(hapd->topics, id) == NULL){
+		wpa_printf(MSG_DEBUG, "Topic %u has no members", id);
+		return 0;
+	}
+
+	mid = afq_mid_next(hapd);
+	frame = afq_frame_build(type, mid, (const char *) payload, len);
+	if (frame == NULL)
+		return 0;
+
+	queued = afq_topic_push_frame(hapd, id, frame, type, prio, mid, len,
+				      ttl, defer);
+	afq_frame_put(frame);
+
+	return queued ? mid : 0;
+}
+
+
+/* afq_topic_push() for the members of topic id on every BSS */
+u32 afq_topic_push_any(struct afq_global *g, u16 id, u8 type, u8 prio,
+		       const u8 *payload, size_t len, u32 ttl, int defer)
+{
+	struct hostapd_data *hapd;
+	struct afq_frame *frame;
+	unsigned int queued = 0;
+	u32 mid;
+
+	if (dl_list_empty(&g->bss) || len == 0 ||
+	    len > HYPERLOCAL_MAX_PAYLOAD)
+		return 0;
+
+	hapd = dl_list_first(&g->bss, struct hostapd_data, not_list);
+	mid = afq_mid_next(hapd);
+	frame = afq_frame_build(type, mid, (const char *) payload, len);
+	if (frame == NULL)
+		return 0;
+
+	dl_list_for_each(hapd, &g->bss, struct hostapd_data, not_list)
+		queued += afq_topic_push_frame(hapd, id, frame, type, prio,
+					       mid, len, ttl, defer);
+	afq_frame_put(frame);
+
+	return queued ? mid : 0;
+}
+
+
+/* Send the messages deferred by afq_topic_push() for topic id */
+void afq_topic_flush(struct hostapd_data *hapd, u16 id)
+{
+	struct afq_topic *t;
+	unsigned int i;
+
+	if (hapd->topics == NULL)
+		return;
+
+	t = afq_topic_find(hapd->topics, id);
+	for (i = 0; t && i < t->num_members; i++)
+		afq_push_flush(hapd, t->members[i]->addr);
+}
+
+
+int afq_topic_init(struct hostapd_data *hapd)
+{
+	struct afq_topics *tbl;
+
+	tbl = os_zalloc(sizeof(*tbl));
+	if (tbl == NULL)
+		return -1;
+	dl_list_init(&tbl->list);
+
+	hapd->topics = tbl;
+	return 0;
+}
+
+
+void afq_topic_deinit(struct hostapd_data *hapd)
+{
+	afq_topic_clear(hapd);
+	os_free(hapd->topics);
+	hapd->topics = NULL;
+}
+
+#endif /* CONFIG_ACTION_NOTIFICATION */
@@ -0,0 +1,117 @@
+/*
+ * hostapd / Hyperlocal binary trace
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * Writer side of the trace ring described in ap_action_trace.h. The ring is
+ * shared by every BSS, like the notification socket it is created with.
+ */
+
+#include "utils/includes.h"
+
+#if defined(CONFIG_ACTION_NOTIFICATION) && defined(CONFIG_HYPERLOCAL_TRACE)
+
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include "utils/common.h"
+#include "ap_action_trace.h"
+
+/* 1.5 MiB, about a minute of a busy probe load */
+#define AFQ_TRACE_RECORDS 65536
+
+static struct afq_trace_hdr *afq_trace_hdr;
+static struct afq_trace_rec *afq_trace_ring;
+static size_t afq_trace_len;
+
+
+void afq_trace(u16 event, const u8 *addr, u32 a, u32 b)
+{
+	struct afq_trace_hdr *hdr = afq_trace_hdr;
+	struct afq_trace_rec *rec;
+	struct os_reltime now;
+	u64 head;
+
+	if (hdr == NULL)
+		return;
+
+	head = hdr->head;
+	if (head - __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE) >= hdr->num){
+		__atomic_store_n(&hdr->dropped, hdr->dropped + 1,
+				 __ATOMIC_RELAXED);
+		return;
+	}
+
+	os_get_reltime(&now);
+	rec = &afq_trace_ring[head & (hdr->num - 1)];
+	rec->usec = (u64) now.sec * 1000000 + now.usec;
+	rec->event = event;
+	if (addr)
+		os_memcpy(rec->addr, addr, ETH_ALEN);
+	else
+		os_memset(rec->addr, 0, ETH_ALEN);
+	rec->a = a;
+	rec->b = b;
+
+	/* The record is visible to the reader once head has moved past it */
+	__atomic_store_n(&hdr->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+int afq_trace_open(const char *path)
+{
+	struct afq_trace_hdr *hdr;
+	size_t len;
+	int fd;
+
+	if (afq_trace_hdr)
+		return 0;
+
+	len = sizeof(*hdr) + AFQ_TRACE_RECORDS * sizeof(struct afq_trace_rec);
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP);
+	if (fd < 0){
+		wpa_printf(MSG_ERROR, "trace: open(%s) failed: %s", path,
+			   strerror(errno));
+		return -1;
+	}
+	if (ftruncate(fd, len) < 0){
+		wpa_printf(MSG_ERROR, "trace: ftruncate(%s) failed: %s", path,
+			   strerror(errno));
+		close(fd);
+		return -1;
+	}
+	hdr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED){
+		wpa_printf(MSG_ERROR, "trace: mmap(%s) failed: %s", path,
+			   strerror(errno));
+		return -1;
+	}
+
+	hdr->version = AFQ_TRACE_VERSION;
+	hdr->rec_size = sizeof(struct afq_trace_rec);
+	hdr->num = AFQ_TRACE_RECORDS;
+	/* A reader checks the magic last */
+	__atomic_store_n(&hdr->magic, AFQ_TRACE_MAGIC, __ATOMIC_RELEASE);
+
+	afq_trace_hdr = hdr;
+	afq_trace_ring = (struct afq_trace_rec *) (hdr + 1);
+	afq_trace_len = len;
+
+	wpa_printf(MSG_INFO, "Hyperlocal trace in %s", path);
+	return 0;
+}
+
+
+void afq_trace_close(void)
+{
+	if (afq_trace_hdr == NULL)
+		return;
+
+	munmap(afq_trace_hdr, afq_trace_len);
+	afq_trace_hdr = NULL;
+	afq_trace_ring = NULL;
+}
+
+#endif /* CONFIG_ACTION_NOTIFICATION && CONFIG_HYPERLOCAL_TRACE */
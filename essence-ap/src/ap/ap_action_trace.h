@@ -0,0 +1,87 @@
+/*
+ * hostapd / Hyperlocal binary trace
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * With CONFIG_HYPERLOCAL_TRACE the hot path of the notification engine
+ * records fixed size binary events in a ring that is memory mapped from
+ * <ctrl_interface>/notification.trace. Nothing is formatted while tracing,
+ * the hyperlocal_trace tool drains the ring and prints the events.
+ * hostapd is the only writer and the reader the only consumer, so the ring
+ * needs no lock: the writer publishes a record by advancing head and the
+ * reader frees it by advancing tail. A full ring drops new events. Without
+ * CONFIG_HYPERLOCAL_TRACE the trace points compile to nothing.
+ */
+
+#ifndef AP_ACTION_TRACE_H
+#define AP_ACTION_TRACE_H
+
+#define AFQ_TRACE_MAGIC 0x544c4801
+#define AFQ_TRACE_VERSION 1
+
+enum afq_trace_event {
+	AFQ_TR_PROBE = 1, /* a: num from the notification indicator */
+	AFQ_TR_RX, /* a: hyperlocal action, b: length */
+	AFQ_TR_NODE_ADD,
+	AFQ_TR_NODE_DEL,
+	AFQ_TR_PUSH, /* a: mid, b: prio << 16 | length */
+	AFQ_TR_QUEUE, /* a: mid, b: 1 if sent right away */
+	AFQ_TR_SEND_BCAST, /* a: mid */
+	AFQ_TR_SEND_DIRECT, /* a: mid */
+	AFQ_TR_AGG, /* a: messages, b: length */
+	AFQ_TR_FRAG, /* a: mid, b: fragment id | AFQ_FRAG_MORE */
+	AFQ_TR_FETCH_REQ, /* a: timeout */
+	AFQ_TR_FETCH, /* station came for its directed messages */
+	AFQ_TR_QUERY, /* a: query mid, b: length */
+	AFQ_TR_EVENT, /* a: HAPD_NOT_EV_*, b: subscribers */
+	AFQ_TR_TX, /* a: length, b: prio */
+	AFQ_TR_TX_STATUS, /* a: hyperlocal action, b: ACK */
+	AFQ_TR_NUM
+};
+
+/* Ring file layout, every field is in host byte order */
+struct afq_trace_hdr {
+	u32 magic;
+	u16 version;
+	u16 rec_size;
+	u32 num; /* records, power of two */
+	u32 reserved;
+	u64 head; /* next record to write, advanced by hostapd */
+	u64 tail; /* next record to read, advanced by the reader */
+	u64 dropped;
+	u8 pad[24];
+};
+
+struct afq_trace_rec {
+	u64 usec; /* monotonic */
+	u16 event; /* enum afq_trace_event */
+	u8 addr[ETH_ALEN];
+	u32 a;
+	u32 b;
+};
+
+#ifdef CONFIG_HYPERLOCAL_TRACE
+
+void afq_trace(u16 event, const u8 *addr, u32 a, u32 b);
+int afq_trace_open(const char *path);
+void afq_trace_close(void);
+
+#define AFQ_TRACE(event, addr, a, b) afq_trace((event), (addr), (a), (b))
+
+#else /* CONFIG_HYPERLOCAL_TRACE */
+
+#define AFQ_TRACE(event, addr, a, b) do { } while (0)
+
+static inline int afq_trace_open(const char *path)
+{
+	return 0;
+}
+
+static inline void afq_trace_close(void)
+{
+}
+
+#endif /* CONFIG_HYPERLOCAL_TRACE */
+
+#endif /* AP_ACTION_TRACE_H */
@@ -0,0 +1,277 @@
+/*
+ * hostapd / Hyperlocal timer wheel
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * Message lifetimes, passer-by node expiry, fragmented transfers and ACK
+ * retries can run into tens of thousands of timers. Registering each of them
+ * with eloop costs a sorted list insert and a full list scan on every cancel,
+ * so they are kept in a hierarchical timing wheel instead: adding, moving and
+ * deleting a timer is O(1) and eloop only sees a single periodic tick, which
+ * is registered while at least one timer is armed.
+ */
+
+#include "utils/includes.h"
+
+#ifdef CONFIG_ACTION_NOTIFICATION
+
+#include "utils/common.h"
+#include "utils/eloop.h"
+#include "hostapd.h"
+#include "ap_action_i.h"
+
+#define AFQ_WHEEL_TICK_MS 100
+#define AFQ_WHEEL_ROOT_BITS 8
+#define AFQ_WHEEL_LVL_BITS 6
+#define AFQ_WHEEL_ROOT_SIZE (1 << AFQ_WHEEL_ROOT_BITS)
+#define AFQ_WHEEL_LVL_SIZE (1 << AFQ_WHEEL_LVL_BITS)
+#define AFQ_WHEEL_ROOT_MASK (AFQ_WHEEL_ROOT_SIZE - 1)
+#define AFQ_WHEEL_LVL_MASK (AFQ_WHEEL_LVL_SIZE - 1)
+#define AFQ_WHEEL_LEVELS 3
+/* Longest delay the wheel can hold, about 77 days with 100 ms ticks */
+#define AFQ_WHEEL_MAX_TICKS \
+	((1U << (AFQ_WHEEL_ROOT_BITS + AFQ_WHEEL_LEVELS * AFQ_WHEEL_LVL_BITS)) - 1)
+
+struct afq_wheel {
+	struct dl_list root[AFQ_WHEEL_ROOT_SIZE];
+	struct dl_list lvl[AFQ_WHEEL_LEVELS][AFQ_WHEEL_LVL_SIZE];
+	u32 now; /* next tick to be run */
+	struct os_reltime start;
+	unsigned int armed;
+	int tick_registered;
+};
+
+static void afq_wheel_tick(void *eloop_ctx, void *timeout_ctx);
+
+
+/* Current time in wheel ticks */
+static u32 afq_wheel_clock(struct afq_wheel *wheel)
+{
+	struct os_reltime now, age;
+
+	os_get_reltime(&now);
+	os_reltime_sub(&now, &wheel->start, &age);
+
+	return (u32) (((u64) age.sec * 1000 + age.usec / 1000) /
+		      AFQ_WHEEL_TICK_MS);
+}
+
+
+static void afq_wheel_insert(struct afq_wheel *wheel, struct afq_timer *t)
+{
+	u32 delta = t->expires - wheel->now;
+	struct dl_list *slot;
+	int lvl;
+
+	if ((s32) delta < 0){
+		/* Already due, run with the next tick */
+		slot = &wheel->root[wheel->now & AFQ_WHEEL_ROOT_MASK];
+	}else if (delta < AFQ_WHEEL_ROOT_SIZE){
+		slot = &wheel->root[t->expires & AFQ_WHEEL_ROOT_MASK];
+	}else{
+		for (lvl = 0; lvl < AFQ_WHEEL_LEVELS - 1; lvl++){
+			if (delta < 1U << (AFQ_WHEEL_ROOT_BITS +
+					   (lvl + 1) * AFQ_WHEEL_LVL_BITS))
+				break;
+		}
+		slot = &wheel->lvl[lvl][(t->expires >>
+					 (AFQ_WHEEL_ROOT_BITS +
+					  lvl * AFQ_WHEEL_LVL_BITS)) &
+					AFQ_WHEEL_LVL_MASK];
+	}
+
+	dl_list_add_tail(slot, &t->list);
+}
+
+
+/* Move the timers of one upper level slot down to where they belong now */
+static int afq_wheel_cascade(struct afq_wheel *wheel, int lvl)
+{
+	int idx = (wheel->now >> (AFQ_WHEEL_ROOT_BITS +
+				  lvl * AFQ_WHEEL_LVL_BITS)) &
+		AFQ_WHEEL_LVL_MASK;
+	struct dl_list *slot = &wheel->lvl[lvl][idx];
+	struct afq_timer *t;
+
+	while (!dl_list_empty(slot)){
+		t = dl_list_first(slot, struct afq_timer, list);
+		dl_list_del(&t->list);
+		afq_wheel_insert(wheel, t);
+	}
+
+	return idx;
+}
+
+
+static void afq_wheel_run(struct hostapd_data *hapd, struct afq_wheel *wheel,
+			  u32 until)
+{
+	struct dl_list work, *slot;
+	struct afq_timer *t;
+	int lvl;
+
+	dl_list_init(&work);
+
+	while ((s32) (until - wheel->now) >= 0 && wheel->armed){
+		if ((wheel->now & AFQ_WHEEL_ROOT_MASK) == 0){
+			for (lvl = 0; lvl < AFQ_WHEEL_LEVELS; lvl++){
+				if (afq_wheel_cascade(wheel, lvl) != 0)
+					break;
+			}
+		}
+
+		slot = &wheel->root[wheel->now & AFQ_WHEEL_ROOT_MASK];
+		while (!dl_list_empty(slot)){
+			t = dl_list_first(slot, struct afq_timer, list);
+			dl_list_del(&t->list);
+			dl_list_add_tail(&work, &t->list);
+		}
+		wheel->now++;
+
+		/* Handlers may re-arm or delete any timer, including queued ones */
+		while (!dl_list_empty(&work)){
+			t = dl_list_first(&work, struct afq_timer, list);
+			dl_list_del(&t->list);
+			wheel->armed--;
+			t->handler(hapd, t->ctx);
+		}
+	}
+
+	if (wheel->armed == 0)
+		wheel->now = until + 1;
+}
+
+
+static void afq_wheel_tick(void *eloop_ctx, void *timeout_ctx)
+{
+	struct hostapd_data *hapd = eloop_ctx;
+	struct afq_wheel *wheel = hapd->wheel;
+
+	wheel->tick_registered = 0;
+	afq_wheel_run(hapd, wheel, afq_wheel_clock(wheel));
+
+	if (wheel->armed && !wheel->tick_registered){
+		eloop_register_timeout(0, AFQ_WHEEL_TICK_MS * 1000,
+				       afq_wheel_tick, hapd, NULL);
+		wheel->tick_registered = 1;
+	}
+}
+
+
+void afq_timer_init(struct afq_timer *t,
+		    void (*handler)(struct hostapd_data *hapd, void *ctx),
+		    void *ctx)
+{
+	t->list.next = NULL;
+	t->list.prev = NULL;
+	t->wheel = NULL;
+	t->expires = 0;
+	t->handler = handler;
+	t->ctx = ctx;
+}
+
+
+int afq_timer_pending(const struct afq_timer *t)
+{
+	return t->list.next != NULL;
+}
+
+
+void afq_timer_del(struct afq_timer *t)
+{
+	if (!afq_timer_pending(t))
+		return;
+
+	dl_list_del(&t->list);
+	t->wheel->armed--;
+}
+
+
+/* Arm (or re-arm) t to fire after sec seconds and msec milliseconds */
+void afq_timer_mod(struct hostapd_data *hapd, struct afq_timer *t,
+		   unsigned int sec, unsigned int msec)
+{
+	struct afq_wheel *wheel = hapd->wheel;
+	u64 ticks;
+
+	if (wheel == NULL)
+		return;
+
+	afq_timer_del(t);
+
+	if (wheel->armed == 0)
+		wheel->now = afq_wheel_clock(wheel);
+
+	ticks = ((u64) sec * 1000 + msec + AFQ_WHEEL_TICK_MS - 1) /
+		AFQ_WHEEL_TICK_MS;
+	if (ticks == 0)
+		ticks = 1;
+	if (ticks > AFQ_WHEEL_MAX_TICKS)
+		ticks = AFQ_WHEEL_MAX_TICKS;
+
+	t->wheel = wheel;
+	t->expires = wheel->now + (u32) ticks;
+	afq_wheel_insert(wheel, t);
+	wheel->armed++;
+
+	if (!wheel->tick_registered){
+		eloop_register_timeout(0, AFQ_WHEEL_TICK_MS * 1000,
+				       afq_wheel_tick, hapd, NULL);
+		wheel->tick_registered = 1;
+	}
+}
+
+
+int afq_wheel_init(struct hostapd_data *hapd)
+{
+	struct afq_wheel *wheel;
+	int i, lvl;
+
+	wheel = os_zalloc(sizeof(*wheel));
+	if (wheel == NULL)
+		return -1;
+
+	for (i = 0; i < AFQ_WHEEL_ROOT_SIZE; i++)
+		dl_list_init(&wheel->root[i]);
+	for (lvl = 0; lvl < AFQ_WHEEL_LEVELS; lvl++){
+		for (i = 0; i < AFQ_WHEEL_LVL_SIZE; i++)
+			dl_list_init(&wheel->lvl[lvl][i]);
+	}
+	os_get_reltime(&wheel->start);
+
+	hapd->wheel = wheel;
+	return 0;
+}
+
+
+/* Timers still armed are dropped without running their handlers */
+void afq_wheel_deinit(struct hostapd_data *hapd)
+{
+	struct afq_wheel *wheel = hapd->wheel;
+	struct afq_timer *t, *tmp;
+	int i, lvl;
+
+	if (wheel == NULL)
+		return;
+
+	eloop_cancel_timeout(afq_wheel_tick, hapd, NULL);
+
+	for (i = 0; i < AFQ_WHEEL_ROOT_SIZE; i++){
+		dl_list_for_each_safe(t, tmp, &wheel->root[i],
+				      struct afq_timer, list)
+			dl_list_del(&t->list);
+	}
+	for (lvl = 0; lvl < AFQ_WHEEL_LEVELS; lvl++){
+		for (i = 0; i < AFQ_WHEEL_LVL_SIZE; i++){
+			dl_list_for_each_safe(t, tmp, &wheel->lvl[lvl][i],
+					      struct afq_timer, list)
+				dl_list_del(&t->list);
+		}
+	}
+
+	os_free(wheel);
+	hapd->wheel = NULL;
+}
+
+#endif /* CONFIG_ACTION_NOTIFICATION */
@@ -725,6 +725,9 @@ void hostapd_config_free_bss(struct hostapd_bss_config *conf)
 	os_free(conf->wowlan_triggers);
 
 	os_free(conf->server_id);
+#ifdef CONFIG_ACTION_NOTIFICATION
+	os_free(conf->notification_journal);
+#endif /* CONFIG_ACTION_NOTIFICATION */
 
 #ifdef CONFIG_TESTING_OPTIONS
 	wpabuf_free(conf->own_ie_override);
@@ -704,6 +704,11 @@ struct hostapd_bss_config {
 
 	int coloc_intf_reporting;
 
+#ifdef CONFIG_ACTION_NOTIFICATION
+	char *notification_journal;
+	unsigned int notification_journal_size;
+#endif /* CONFIG_ACTION_NOTIFICATION */
+
 	u8 send_probe_response;
 
 #define BACKHAUL_BSS 1
@@ -34,6 +34,7 @@
 #include "ieee802_11_auth.h"
 #ifdef CONFIG_ACTION_NOTIFICATION
 #include "ap_action.h"
+#include "ap_action_trace.h"
 #endif /*CONFIG_ACTION_NOTIFICATION*/
 
 #ifdef NEED_AP_MLME
@@ -406,6 +407,9 @@ static u8 * hostapd_gen_probe_resp(struct hostapd_data *hapd,
 
 	buflen += hostapd_mbo_ie_len(hapd);
 	buflen += hostapd_eid_owe_trans_len(hapd);
+#ifdef CONFIG_ACTION_NOTIFICATION
+	buflen += hostapd_eid_afn_indication_len(hapd);
+#endif /* CONFIG_ACTION_NOTIFICATION */
 
 	resp = os_zalloc(buflen);
 	if (resp == NULL)
@@ -916,10 +920,10 @@ void handle_probe_req(struct hostapd_data *hapd,
 #endif /* CONFIG_INTERWORKING */
 #ifdef CONFIG_ACTION_NOTIFICATION
 
-        if (elems.afn && elems.afn_len)
+        if (elems.afn && elems.afn_len >= 2)
         {
                 u16 num = WPA_GET_LE16(elems.afn);
-                wpa_printf(MSG_DEBUG, MACSTR " is capable of notifications, sending messages now", MAC2STR(mgmt->sa));
+                AFQ_TRACE(AFQ_TR_PROBE, mgmt->sa, num, 0);
                 send_buffered_push_messages(hapd, mgmt->sa, num);
         }
 #endif /* CONFIG_ACTION_NOTIFICATION */
@@ -2184,7 +2184,7 @@ hostapd_alloc_bss_data(struct hostapd_iface *hapd_iface,
 	dl_list_init(&hapd->sae_commit_queue);
 #endif /* CONFIG_SAE */
 #ifdef CONFIG_ACTION_NOTIFICATION
-        hapd->not_sock = -1;
+        dl_list_init(&hapd->xfer_list);
 #endif /* CONFIG_ACTION_NOTIFICATION */
 
 	return hapd;
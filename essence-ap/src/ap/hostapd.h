@@ -35,7 +35,17 @@ struct mesh_conf;
 #endif /* CONFIG_MESH */
 #ifdef CONFIG_ACTION_NOTIFICATION
 struct afq;
+struct afq_nodes;
 struct not_ctrl_dst;
+struct afq_sched;
+struct afq_wheel;
+struct afq_qcache;
+struct afq_bcast;
+struct afq_ind;
+struct afq_topics;
+struct afq_journal;
+struct afq_stats;
+struct afq_global;
 #endif /* CONFIG_ACTION_NOTIFICATION */
 
 struct hostapd_iface;
@@ -59,6 +69,9 @@ struct hapd_interfaces {
 	gid_t ctrl_iface_group;
 #endif /* CONFIG_NATIVE_WINDOWS */
 	struct hostapd_iface **iface;
+#ifdef CONFIG_ACTION_NOTIFICATION
+	struct afq_global *afq; /* hyperlocal state shared by all BSSes */
+#endif /* CONFIG_ACTION_NOTIFICATION */
 
 	size_t terminate_on_error;
 #ifndef CONFIG_NO_VLAN
@@ -159,13 +172,25 @@ struct hostapd_data {
 	struct sta_info *sta_hash[STA_HASH_SIZE];
 
 #ifdef CONFIG_ACTION_NOTIFICATION
-        struct afq *pend_list[STA_HASH_SIZE + 1];
-        u32 msg_id;
-        int not_sock;
-        struct not_ctrl_dst *not_dst;
+        struct dl_list not_list; /* afq_global::bss */
+        struct afq_nodes *nodes;
         int fastnot;
         u16 mtout;
         u32 ntout;
+        u16 agg_len;
+        struct afq_sched *sched;
+        struct afq_wheel *wheel;
+        struct afq_qcache *qcache;
+        struct afq_bcast *bcast;
+        struct afq_ind *ind;
+        struct afq_topics *topics;
+        struct afq_journal *journal;
+        struct afq_stats *stats;
+        u16 frag_len;
+        u32 xfer_tout;
+        struct dl_list xfer_list; /* struct afq_xfer */
+        unsigned int num_xfer;
+        unsigned int ack_attempts; /* directed message sends, 0 = no ACK tracking */
 #endif /* CONFIG_ACTION_NOTIFICATION */
 
 	/*
@@ -52,6 +52,9 @@
 #include "fils_hlp.h"
 #include "dpp_hostapd.h"
 #include "gas_query_ap.h"
+#ifdef CONFIG_ACTION_NOTIFICATION
+#include "ap_action.h"
+#endif /* CONFIG_ACTION_NOTIFICATION */
 
 
 #ifdef CONFIG_FILS
@@ -4861,6 +4864,15 @@ static void handle_action_cb(struct hostapd_data *hapd,
 		return;
 	}
 #endif /* CONFIG_DPP */
+#ifdef CONFIG_ACTION_NOTIFICATION
+	if (len >= IEEE80211_HDRLEN + 4 &&
+	    mgmt->u.action.category == WLAN_ACTION_PUBLIC &&
+	    mgmt->u.action.u.public_action.action ==
+	    WLAN_PA_GAS_INITIAL_RESP) {
+		hostapd_not_tx_status(hapd, mgmt->da, &mgmt->u.action.category,
+				      len - IEEE80211_HDRLEN, ok);
+	}
+#endif /* CONFIG_ACTION_NOTIFICATION */
 	sta = ap_get_sta(hapd, mgmt->da);
 	if (!sta) {
 		wpa_printf(MSG_DEBUG, "handle_action_cb: STA " MACSTR
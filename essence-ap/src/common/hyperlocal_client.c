@@ -0,0 +1,926 @@
+/*
+ * libhyperlocal - client of the hyperlocal notification sockets
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * Built on its own as libhyperlocal.so, so only the header-only parts of
+ * utils are used and nothing that needs os_*.c or wpa_debug.c.
+ */
+
+#include "utils/includes.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/un.h>
+
+#include "utils/common.h"
+#include "utils/list.h"
+#include "hyperlocal_ctrl.h"
+#include "hyperlocal_event.h"
+#include "hyperlocal_client.h"
+
+/* Largest request hostapd takes, HAPD_NOT_RXBUF_LEN less the NUL it adds */
+#define HL_CLIENT_REQ_MAX (65535 + 255)
+/* Largest datagram the daemons send, a full reply to a batch */
+#define HL_CLIENT_RX_MAX (65535 + 256)
+/* Requests without a reply yet, more are refused until some come back */
+#define HL_CLIENT_MAX_REQS 4096
+/* Bytes of requests waiting for room in the daemon's socket queue */
+#define HL_CLIENT_MAX_BACKLOG (8 * 1024 * 1024)
+/* Largest text payload, the daemons cut a text command at the first NUL */
+#define HL_CLIENT_TEXT_MAX 1400
+
+/* The hostapd events, see hapd_not_iface_send() */
+static const char *hl_ap_events[] = {
+	"NEWNODE", "OLDNODE", "NOT_RESP", "SENDMSG", "DELIVERED", "FAILED",
+	"NOT_QRY", "SUBSCRIBE", NULL
+};
+
+/*
+ * The text events of wpa_supplicant. A handle attaches with "ATTACH BIN" and
+ * does not get them, but the answers to a query go to the address that asked
+ * in text when it is not attached.
+ */
+static const char *hl_sta_text_events[] = {
+	"NOT:", "QFAIL:", "QDONE:", "ANNOUNCE ", NULL
+};
+
+/* A hl_push_batch() sent in several requests */
+struct hl_batch {
+	hl_batch_cb cb;
+	void *ctx;
+	u32 *mids;
+	size_t count;
+	unsigned int parts; /* requests still waiting, atomic */
+	int status; /* atomic */
+};
+
+enum hl_reply {
+	HL_REPLY_OK, /* "OK" */
+	HL_REPLY_MID, /* "MID: <mid>" */
+	HL_REPLY_QID, /* "QID <qid>[ <num>]" */
+	HL_REPLY_BIN, /* binary reply with the same seq */
+};
+
+struct hl_req {
+	struct dl_list list;
+	enum hl_reply reply;
+	u32 seq;
+	hl_done_cb cb;
+	void *ctx;
+	struct hl_batch *batch; /* or a single push */
+	size_t first; /* of batch->mids */
+	size_t count;
+	u8 *buf; /* request not sent yet */
+	size_t len;
+};
+
+struct hl_client {
+	enum hl_client_type type;
+	int sock;
+	char *ifname;
+	hl_event_cb event_cb;
+	void *event_ctx;
+
+	pthread_mutex_t lock; /* txbuf, reqs, backlog, seq */
+	struct dl_list reqs; /* struct hl_req sent, oldest first */
+	struct dl_list backlog; /* struct hl_req to send, oldest first */
+	unsigned int num_reqs; /* in both lists */
+	size_t backlog_len;
+	u32 seq;
+	u8 *txbuf;
+
+	pthread_mutex_t rx_lock; /* hl_client_process() */
+	u8 *rxbuf;
+};
+
+
+static void * hl_zalloc(size_t len)
+{
+	void *p = os_malloc(len);
+
+	if (p)
+		os_memset(p, 0, len);
+	return p;
+}
+
+
+static int hl_would_block(void)
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+
+/*
+ * Send buf and remember what waits for the reply, with c->lock held. The
+ * daemon's socket queue is only a few datagrams long, so a request that does
+ * not fit while others are in flight is kept in the backlog and sent from
+ * hl_client_process() once their replies show the daemon made room.
+ */
+static int hl_send_locked(struct hl_client *c, const u8 *buf, size_t len,
+			  enum hl_reply reply, u32 seq, hl_done_cb cb,
+			  void *ctx, struct hl_batch *batch, size_t first,
+			  size_t count)
+{
+	struct hl_req *req;
+
+	if (c->num_reqs >= HL_CLIENT_MAX_REQS ||
+	    c->backlog_len + len > HL_CLIENT_MAX_BACKLOG){
+		errno = EAGAIN;
+		return -1;
+	}
+
+	req = hl_zalloc(sizeof(*req));
+	if (req == NULL)
+		return -1;
+	req->reply = reply;
+	req->seq = seq;
+	req->cb = cb;
+	req->ctx = ctx;
+	req->batch = batch;
+	req->first = first;
+	req->count = count;
+
+	if (dl_list_empty(&c->backlog)){
+		if (send(c->sock, buf, len, MSG_DONTWAIT) >= 0){
+			dl_list_add_tail(&c->reqs, &req->list);
+			c->num_reqs++;
+			return 0;
+		}
+		if (!hl_would_block() || dl_list_empty(&c->reqs)){
+			os_free(req);
+			return -1;
+		}
+	}
+
+	req->buf = os_malloc(len);
+	if (req->buf == NULL){
+		os_free(req);
+		return -1;
+	}
+	os_memcpy(req->buf, buf, len);
+	req->len = len;
+	dl_list_add_tail(&c->backlog, &req->list);
+	c->num_reqs++;
+	c->backlog_len += len;
+	return 0;
+}
+
+
+/*
+ * Send what the backlog holds while the daemon takes it. If it takes nothing
+ * and no reply is on its way, which would wake us up, the backlog is failed
+ * into done for the caller to finish without c->lock.
+ */
+static void hl_backlog_flush(struct hl_client *c, struct dl_list *done)
+{
+	struct hl_req *req;
+
+	pthread_mutex_lock(&c->lock);
+	while ((req = dl_list_first(&c->backlog, struct hl_req, list))){
+		if (send(c->sock, req->buf, req->len, MSG_DONTWAIT) < 0){
+			if (hl_would_block() && !dl_list_empty(&c->reqs))
+				break;
+			dl_list_del(&req->list);
+			dl_list_add_tail(done, &req->list);
+			c->num_reqs--;
+		}else{
+			dl_list_del(&req->list);
+			dl_list_add_tail(&c->reqs, &req->list);
+		}
+		c->backlog_len -= req->len;
+		os_free(req->buf);
+		req->buf = NULL;
+	}
+	pthread_mutex_unlock(&c->lock);
+}
+
+
+/*
+ * Send a text command, "IFNAME=<ifname> " first for a per BSS one when the
+ * handle has a BSS, then cmd and the payload, which must be text
+ */
+static int hl_text(struct hl_client *c, int bss, enum hl_reply reply,
+		   const char *cmd, const u8 *payload, size_t plen,
+		   const char *tail, hl_done_cb cb, void *ctx)
+{
+	size_t len = 0;
+	int res;
+
+	if (plen > HL_CLIENT_TEXT_MAX || (payload && memchr(payload, 0, plen))){
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&c->lock);
+
+	if (bss && c->ifname){
+		res = os_snprintf((char *) c->txbuf, HL_CLIENT_REQ_MAX,
+				  "IFNAME=%s ", c->ifname);
+		if (os_snprintf_error(HL_CLIENT_REQ_MAX, res))
+			goto fail;
+		len = res;
+	}
+	res = os_snprintf((char *) c->txbuf + len, HL_CLIENT_REQ_MAX - len, "%s",
+			  cmd);
+	if (os_snprintf_error(HL_CLIENT_REQ_MAX - len, res))
+		goto fail;
+	len += res;
+	if (plen){
+		os_memcpy(c->txbuf + len, payload, plen);
+		len += plen;
+	}
+	if (tail){
+		res = os_snprintf((char *) c->txbuf + len,
+				  HL_CLIENT_REQ_MAX - len, "%s", tail);
+		if (os_snprintf_error(HL_CLIENT_REQ_MAX - len, res))
+			goto fail;
+		len += res;
+	}
+
+	res = hl_send_locked(c, c->txbuf, len, reply, 0, cb, ctx, NULL, 0, 0);
+	pthread_mutex_unlock(&c->lock);
+	return res;
+
+fail:
+	pthread_mutex_unlock(&c->lock);
+	errno = EINVAL;
+	return -1;
+}
+
+
+/* The request matching a reply: by seq for a binary one, else the oldest */
+static struct hl_req * hl_req_take(struct hl_client *c, int binary, u32 seq)
+{
+	struct hl_req *req, *found = NULL;
+
+	pthread_mutex_lock(&c->lock);
+	dl_list_for_each(req, &c->reqs, struct hl_req, list){
+		if (binary ? (req->reply == HL_REPLY_BIN && req->seq == seq) :
+		    req->reply != HL_REPLY_BIN){
+			found = req;
+			break;
+		}
+	}
+	if (found){
+		dl_list_del(&found->list);
+		c->num_reqs--;
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	return found;
+}
+
+
+/*
+ * One part of a batch is done, the callback runs after the last one. The
+ * parts may finish in hl_client_process() and in hl_push_batch() in
+ * different threads.
+ */
+static void hl_batch_done(struct hl_batch *batch, int status)
+{
+	if (status)
+		__atomic_store_n(&batch->status, -1, __ATOMIC_RELAXED);
+	if (__atomic_sub_fetch(&batch->parts, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	if (batch->cb)
+		batch->cb(batch->ctx, batch->status, batch->mids, batch->count);
+	os_free(batch->mids);
+	os_free(batch);
+}
+
+
+/* mids is NULL when the request failed */
+static void hl_req_done(struct hl_req *req, int status, const u8 *mids,
+			size_t num, u32 id)
+{
+	size_t i;
+
+	if (req->batch){
+		for (i = 0; i < req->count; i++)
+			req->batch->mids[req->first + i] =
+				mids && i < num ? WPA_GET_LE32(mids + 4 * i) : 0;
+		hl_batch_done(req->batch, status);
+	}else if (req->reply == HL_REPLY_BIN){
+		id = mids && num ? WPA_GET_LE32(mids) : 0;
+		if (req->cb)
+			req->cb(req->ctx, id ? status : -1, id);
+	}else if (req->cb){
+		req->cb(req->ctx, status, id);
+	}
+
+	os_free(req->buf);
+	os_free(req);
+}
+
+
+static void hl_binary_reply(struct hl_client *c, const u8 *buf, size_t len)
+{
+	struct hl_req *req;
+	u8 status;
+	u16 num;
+
+	if (len < HL_CTRL_HDR_LEN || buf[1] != HL_CTRL_VERSION)
+		return;
+
+	req = hl_req_take(c, 1, WPA_GET_LE32(buf + HL_CTRL_HDR_SEQ));
+	if (req == NULL)
+		return;
+
+	status = buf[HL_CTRL_HDR_STATUS];
+	num = WPA_GET_LE16(buf + HL_CTRL_HDR_COUNT);
+	if (len < HL_CTRL_HDR_LEN + (size_t) num * HL_CTRL_PUSH_MID_LEN)
+		num = 0;
+
+	if (status != HL_CTRL_STATUS_OK && status != HL_CTRL_STATUS_PARTIAL)
+		hl_req_done(req, -1, NULL, 0, 0);
+	else
+		hl_req_done(req, status == HL_CTRL_STATUS_OK ? 0 : -1,
+			    buf + HL_CTRL_HDR_LEN, num, 0);
+}
+
+
+static void hl_text_reply(struct hl_client *c, const char *buf)
+{
+	struct hl_req *req;
+	int status = 0;
+	u32 id = 0;
+
+	req = hl_req_take(c, 0, 0);
+	if (req == NULL)
+		return;
+
+	if (os_strncmp(buf, "FAIL", 4) == 0)
+		status = -1;
+	else if (req->reply == HL_REPLY_MID && os_strncmp(buf, "MID: ", 5) == 0)
+		id = strtoul(buf + 5, NULL, 10);
+	else if (req->reply == HL_REPLY_QID && os_strncmp(buf, "QID ", 4) == 0)
+		id = strtoul(buf + 4, NULL, 10);
+	else if (req->reply != HL_REPLY_OK)
+		status = -1;
+
+	hl_req_done(req, status, NULL, 0, id);
+}
+
+
+/* "IFNAME=<ifname> <event><text>" from hapd_not_iface_send() */
+static void hl_ap_event(struct hl_client *c, char *buf, size_t len)
+{
+	struct hl_event ev;
+	char *pos;
+	size_t i, nlen;
+
+	pos = os_strchr(buf + 7, ' ');
+	if (pos == NULL)
+		return;
+	*pos++ = '\0';
+	if (c->ifname && os_strcmp(buf + 7, c->ifname) != 0)
+		return;
+
+	os_memset(&ev, 0, sizeof(ev));
+	ev.type = HL_EVENT_AP;
+	ev.ifname = buf + 7;
+	ev.name = "";
+	for (i = 0; hl_ap_events[i]; i++){
+		nlen = os_strlen(hl_ap_events[i]);
+		if (os_strncmp(pos, hl_ap_events[i], nlen) == 0){
+			ev.name = hl_ap_events[i];
+			pos += nlen;
+			if (*pos == ' ')
+				pos++;
+			break;
+		}
+	}
+	ev.data = (const u8 *) pos;
+	ev.len = buf + len - pos;
+
+	c->event_cb(c->event_ctx, &ev);
+}
+
+
+/* A datagram of hyperlocal_event.h records */
+static void hl_sta_events(struct hl_client *c, const u8 *buf, size_t len)
+{
+	struct hl_event ev;
+	const u8 *pos = buf + HL_EV_HDR_LEN, *end = buf + len, *body;
+	u16 count, blen;
+
+	if (len < HL_EV_HDR_LEN || buf[1] != HL_EV_VERSION)
+		return;
+	count = WPA_GET_LE16(buf + HL_EV_HDR_COUNT);
+
+	while (count-- && end - pos >= HL_EV_REC_LEN){
+		blen = WPA_GET_LE16(pos + 2);
+		body = pos + HL_EV_REC_LEN;
+		if (end - body < blen)
+			break;
+
+		os_memset(&ev, 0, sizeof(ev));
+		ev.type = pos[0];
+		switch (pos[0]){
+		case HL_EV_MSG:
+			if (blen < HL_EV_MSG_LEN)
+				goto next;
+			os_memcpy(ev.addr, body, ETH_ALEN);
+			ev.msg_type = body[6];
+			ev.mid = WPA_GET_LE32(body + 7);
+			ev.qid = WPA_GET_LE32(body + 11);
+			ev.check = WPA_GET_LE16(body + 15);
+			ev.data = body + HL_EV_MSG_LEN;
+			ev.len = blen - HL_EV_MSG_LEN;
+			break;
+		case HL_EV_ANNOUNCE:
+			if (blen < HL_EV_ANNOUNCE_LEN)
+				goto next;
+			ev.kind = body[0];
+			ev.check = WPA_GET_LE16(body + 1);
+			break;
+		case HL_EV_QFAIL:
+			if (blen < HL_EV_QFAIL_LEN)
+				goto next;
+			ev.qid = WPA_GET_LE32(body);
+			break;
+		case HL_EV_QDONE:
+			if (blen < HL_EV_QDONE_LEN)
+				goto next;
+			ev.qid = WPA_GET_LE32(body);
+			ev.answered = WPA_GET_LE16(body + 4);
+			ev.failed = WPA_GET_LE16(body + 6);
+			break;
+		default:
+			/* Newer record types are skipped */
+			goto next;
+		}
+		c->event_cb(c->event_ctx, &ev);
+	next:
+		pos = body + blen;
+	}
+}
+
+
+static void hl_dispatch(struct hl_client *c, u8 *buf, size_t len)
+{
+	int i;
+
+	if (len == 0)
+		return;
+
+	if (buf[0] == 0){
+		/* HL_CTRL_MAGIC for hostapd, HL_EV_MAGIC for wpa_supplicant */
+		if (c->type == HL_CLIENT_AP)
+			hl_binary_reply(c, buf, len);
+		else if (c->event_cb)
+			hl_sta_events(c, buf, len);
+		return;
+	}
+
+	buf[len] = '\0';
+	if (c->type == HL_CLIENT_AP && os_strncmp((char *) buf, "IFNAME=", 7) == 0){
+		if (c->event_cb)
+			hl_ap_event(c, (char *) buf, len);
+		return;
+	}
+	if (c->type == HL_CLIENT_STA){
+		for (i = 0; hl_sta_text_events[i]; i++){
+			if (os_strncmp((char *) buf, hl_sta_text_events[i],
+				       os_strlen(hl_sta_text_events[i])) == 0)
+				return;
+		}
+	}
+
+	hl_text_reply(c, (char *) buf);
+}
+
+
+int hl_client_process(struct hl_client *c)
+{
+	struct hl_req *req, *tmp;
+	struct dl_list done;
+	ssize_t res;
+	int num = 0;
+
+	pthread_mutex_lock(&c->rx_lock);
+	for (;;){
+		res = recv(c->sock, c->rxbuf, HL_CLIENT_RX_MAX, MSG_DONTWAIT);
+		if (res < 0){
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				num = -1;
+			break;
+		}
+		hl_dispatch(c, c->rxbuf, res);
+		num++;
+	}
+
+	dl_list_init(&done);
+	hl_backlog_flush(c, &done);
+	dl_list_for_each_safe(req, tmp, &done, struct hl_req, list){
+		dl_list_del(&req->list);
+		hl_req_done(req, -1, NULL, 0, 0);
+	}
+	pthread_mutex_unlock(&c->rx_lock);
+
+	return num;
+}
+
+
+int hl_client_fd(struct hl_client *c)
+{
+	return c->sock;
+}
+
+
+static int hl_attach(struct hl_client *c, const char *events, hl_done_cb cb,
+		     void *ctx)
+{
+	char cmd[256];
+	int res;
+
+	res = os_snprintf(cmd, sizeof(cmd), "ATTACH%s%s%s",
+			  c->type == HL_CLIENT_STA ? " BIN" : "",
+			  events && *events ? " " : "", events ? events : "");
+	if (os_snprintf_error(sizeof(cmd), res)){
+		errno = EINVAL;
+		return -1;
+	}
+
+	return hl_text(c, 0, HL_REPLY_OK, cmd, NULL, 0, NULL, cb, ctx);
+}
+
+
+int hl_subscribe(struct hl_client *c, const char *events, hl_done_cb cb,
+		 void *ctx)
+{
+	if (c->event_cb == NULL){
+		errno = EINVAL;
+		return -1;
+	}
+
+	return hl_attach(c, events, cb, ctx);
+}
+
+
+struct hl_client * hl_client_open(enum hl_client_type type, const char *path,
+				  const char *ifname, const char *events,
+				  hl_event_cb event_cb, void *ctx)
+{
+	struct hl_client *c;
+	struct sockaddr_un addr;
+	sa_family_t family = AF_UNIX;
+	int flags;
+
+	if (os_strlen(path) >= sizeof(addr.sun_path)){
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	c = hl_zalloc(sizeof(*c));
+	if (c == NULL)
+		return NULL;
+	c->type = type;
+	c->sock = -1;
+	c->event_cb = event_cb;
+	c->event_ctx = ctx;
+	dl_list_init(&c->reqs);
+	dl_list_init(&c->backlog);
+	pthread_mutex_init(&c->lock, NULL);
+	pthread_mutex_init(&c->rx_lock, NULL);
+
+	c->txbuf = os_malloc(HL_CLIENT_REQ_MAX);
+	c->rxbuf = os_malloc(HL_CLIENT_RX_MAX + 1);
+	if (c->txbuf == NULL || c->rxbuf == NULL)
+		goto fail;
+	if (ifname){
+		/* The length is a u8 in HL_CTRL_OP_PUSH_BSS */
+		if (*ifname == '\0' || os_strlen(ifname) > 255){
+			errno = EINVAL;
+			goto fail;
+		}
+		c->ifname = os_strdup(ifname);
+		if (c->ifname == NULL)
+			goto fail;
+	}
+
+	c->sock = socket(PF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (c->sock < 0)
+		goto fail;
+
+	/* An abstract address of the kernel's choosing, nothing to unlink */
+	if (bind(c->sock, (struct sockaddr *) &family, sizeof(family)) < 0)
+		goto fail;
+
+	os_memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	os_memcpy(addr.sun_path, path, os_strlen(path));
+	if (connect(c->sock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		goto fail;
+
+	flags = fcntl(c->sock, F_GETFL);
+	if (flags < 0 || fcntl(c->sock, F_SETFL, flags | O_NONBLOCK) < 0)
+		goto fail;
+
+	if (event_cb && hl_attach(c, events, NULL, NULL) < 0)
+		goto fail;
+
+	return c;
+
+fail:
+	hl_client_close(c);
+	return NULL;
+}
+
+
+void hl_client_close(struct hl_client *c)
+{
+	struct hl_req *req, *tmp;
+
+	if (c == NULL)
+		return;
+
+	if (c->sock >= 0){
+		if (c->event_cb)
+			send(c->sock, "DETACH", 6, MSG_DONTWAIT);
+		close(c->sock);
+	}
+
+	dl_list_for_each_safe(req, tmp, &c->reqs, struct hl_req, list){
+		dl_list_del(&req->list);
+		hl_req_done(req, -1, NULL, 0, 0);
+	}
+	dl_list_for_each_safe(req, tmp, &c->backlog, struct hl_req, list){
+		dl_list_del(&req->list);
+		hl_req_done(req, -1, NULL, 0, 0);
+	}
+
+	pthread_mutex_destroy(&c->lock);
+	pthread_mutex_destroy(&c->rx_lock);
+	os_free(c->txbuf);
+	os_free(c->rxbuf);
+	os_free(c->ifname);
+	os_free(c);
+}
+
+
+static size_t hl_push_len(const struct hl_push *push)
+{
+	return HL_CTRL_PUSH_HDR_LEN + push->len;
+}
+
+
+/* The request header, with the BSS of a handle bound to one */
+static size_t hl_push_hdr_len(struct hl_client *c)
+{
+	return HL_CTRL_HDR_LEN + (c->ifname ? 1 + os_strlen(c->ifname) : 0);
+}
+
+
+static int hl_push_valid(struct hl_client *c, const struct hl_push *push)
+{
+	return push->payload && push->len > 0 && push->len <= 0xffff &&
+		push->type <= 1 && push->prio <= HL_PRIO_BULK &&
+		push->topic <= 0xffff &&
+		hl_push_hdr_len(c) + hl_push_len(push) <= HL_CLIENT_REQ_MAX;
+}
+
+
+static u8 * hl_push_put(u8 *pos, const struct hl_push *push)
+{
+	if (push->topic >= 0){
+		os_memset(pos, 0, ETH_ALEN);
+		WPA_PUT_LE16(pos, push->topic);
+		pos[7] = HL_CTRL_PUSH_TOPIC;
+	}else{
+		os_memcpy(pos, push->dst, ETH_ALEN);
+		pos[7] = 0;
+	}
+	pos[6] = push->type;
+	pos[7] |= push->prio << HL_CTRL_PUSH_PRIO_SHIFT;
+	WPA_PUT_LE32(pos + 8, push->ttl);
+	WPA_PUT_LE16(pos + 12, push->len);
+	os_memcpy(pos + HL_CTRL_PUSH_HDR_LEN, push->payload, push->len);
+
+	return pos + hl_push_len(push);
+}
+
+
+/*
+ * Send pushes[0..count - 1] as one request, with c->lock held. A handle
+ * bound to a BSS names it with HL_CTRL_OP_PUSH_BSS.
+ */
+static int hl_push_send_locked(struct hl_client *c,
+			       const struct hl_push *pushes, size_t count,
+			       hl_done_cb cb, void *ctx, struct hl_batch *batch,
+			       size_t first)
+{
+	u8 *pos = c->txbuf;
+	u32 seq = c->seq++;
+	size_t i;
+
+	pos[0] = HL_CTRL_MAGIC;
+	pos[1] = HL_CTRL_VERSION;
+	pos[HL_CTRL_HDR_OP] = c->ifname ? HL_CTRL_OP_PUSH_BSS :
+		HL_CTRL_OP_PUSH_BATCH;
+	pos[HL_CTRL_HDR_STATUS] = 0;
+	WPA_PUT_LE32(pos + HL_CTRL_HDR_SEQ, seq);
+	WPA_PUT_LE16(pos + HL_CTRL_HDR_COUNT, count);
+	pos += HL_CTRL_HDR_LEN;
+	if (c->ifname){
+		*pos = os_strlen(c->ifname);
+		os_memcpy(pos + 1, c->ifname, *pos);
+		pos += 1 + *pos;
+	}
+	for (i = 0; i < count; i++)
+		pos = hl_push_put(pos, &pushes[i]);
+
+	return hl_send_locked(c, c->txbuf, pos - c->txbuf, HL_REPLY_BIN, seq,
+			      cb, ctx, batch, first, count);
+}
+
+
+int hl_push(struct hl_client *c, const struct hl_push *push, hl_done_cb cb,
+	    void *ctx)
+{
+	int res;
+
+	if (c->type != HL_CLIENT_AP || !hl_push_valid(c, push)){
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&c->lock);
+	res = hl_push_send_locked(c, push, 1, cb, ctx, NULL, 0);
+	pthread_mutex_unlock(&c->lock);
+
+	return res;
+}
+
+
+/*
+ * Queue count messages in as few requests as they fit in. cb runs once, when
+ * every request is answered. If a request after the first cannot be sent,
+ * the rest get mid 0 and the status is -1, but the call still returns 0
+ * since cb will run.
+ */
+int hl_push_batch(struct hl_client *c, const struct hl_push *pushes,
+		  size_t count, hl_batch_cb cb, void *ctx)
+{
+	struct hl_batch *batch;
+	size_t i, first, len;
+	int res = 0;
+
+	if (c->type != HL_CLIENT_AP || count == 0){
+		errno = EINVAL;
+		return -1;
+	}
+	for (i = 0; i < count; i++){
+		if (!hl_push_valid(c, &pushes[i])){
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	batch = hl_zalloc(sizeof(*batch));
+	if (batch == NULL)
+		return -1;
+	batch->mids = hl_zalloc(count * sizeof(u32));
+	if (batch->mids == NULL){
+		os_free(batch);
+		return -1;
+	}
+	batch->cb = cb;
+	batch->ctx = ctx;
+	batch->count = count;
+	/* Held until every request is out, so no reply finishes the batch */
+	batch->parts = 1;
+
+	pthread_mutex_lock(&c->lock);
+	for (first = 0; first < count; first = i){
+		len = hl_push_hdr_len(c);
+		for (i = first; i < count && i - first < HL_CTRL_MAX_RECORDS;
+		     i++){
+			if (len + hl_push_len(&pushes[i]) > HL_CLIENT_REQ_MAX)
+				break;
+			len += hl_push_len(&pushes[i]);
+		}
+
+		__atomic_add_fetch(&batch->parts, 1, __ATOMIC_RELAXED);
+		res = hl_push_send_locked(c, pushes + first, i - first, NULL,
+					  NULL, batch, first);
+		if (res < 0){
+			__atomic_sub_fetch(&batch->parts, 1, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	if (res < 0 && first == 0){
+		os_free(batch->mids);
+		os_free(batch);
+		return -1;
+	}
+
+	/* Unsent records keep mid 0 */
+	hl_batch_done(batch, res);
+
+	return 0;
+}
+
+
+/* hostapd takes ":ENDNOT:" in a text push as the start of the ttl */
+static int hl_has_endnot(const u8 *payload, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= len; i++){
+		if (os_memcmp(payload + i, ":ENDNOT:", 8) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+
+int hl_answer(struct hl_client *c, const uint8_t *addr, uint32_t qid,
+	      uint32_t ttl, const uint8_t *payload, size_t len, hl_done_cb cb,
+	      void *ctx)
+{
+	char cmd[64], tail[32] = "";
+	int res;
+
+	if (c->type != HL_CLIENT_AP || payload == NULL || len == 0){
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (addr){
+		res = os_snprintf(cmd, sizeof(cmd), "PUSH " MACSTR " 2:%u ",
+				  MAC2STR(addr), qid);
+		if (ttl)
+			os_snprintf(tail, sizeof(tail), " :ENDNOT:%u", ttl);
+		if (os_snprintf_error(sizeof(cmd), res) ||
+		    hl_has_endnot(payload, len)){
+			errno = EINVAL;
+			return -1;
+		}
+		return hl_text(c, 1, HL_REPLY_MID, cmd, payload, len, tail,
+			       cb, ctx);
+	}
+
+	res = os_snprintf(cmd, sizeof(cmd), "QRESP %u %u ", qid, ttl);
+	if (os_snprintf_error(sizeof(cmd), res)){
+		errno = EINVAL;
+		return -1;
+	}
+	return hl_text(c, 1, HL_REPLY_OK, cmd, payload, len, NULL, cb, ctx);
+}
+
+
+int hl_query(struct hl_client *c, const uint8_t *bssid,
+	     const uint8_t *payload, size_t len, hl_done_cb cb, void *ctx)
+{
+	char cmd[64];
+	int res;
+
+	/* The answers come as events, a handle without event_cb loses them */
+	if (c->type != HL_CLIENT_STA || c->event_cb == NULL || payload == NULL ||
+	    len == 0){
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (bssid)
+		res = os_snprintf(cmd, sizeof(cmd), "QUERY " MACSTR " ",
+				  MAC2STR(bssid));
+	else
+		res = os_snprintf(cmd, sizeof(cmd), "QUERY * ");
+	if (os_snprintf_error(sizeof(cmd), res)){
+		errno = EINVAL;
+		return -1;
+	}
+
+	return hl_text(c, 0, HL_REPLY_QID, cmd, payload, len, NULL, cb, ctx);
+}
+
+
+int hl_topic(struct hl_client *c, const uint8_t *bssid, unsigned int topic,
+	     int join, hl_done_cb cb, void *ctx)
+{
+	char cmd[64];
+	int res;
+
+	if (c->type != HL_CLIENT_STA || topic > 0xffff){
+		errno = EINVAL;
+		return -1;
+	}
+
+	res = os_snprintf(cmd, sizeof(cmd), "%sSUBSCRIBE " MACSTR " %u",
+			  join ? "" : "UN", MAC2STR(bssid), topic);
+	if (os_snprintf_error(sizeof(cmd), res)){
+		errno = EINVAL;
+		return -1;
+	}
+
+	return hl_text(c, 0, HL_REPLY_OK, cmd, NULL, 0, NULL, cb, ctx);
+}
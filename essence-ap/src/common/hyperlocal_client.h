@@ -0,0 +1,154 @@
+/*
+ * libhyperlocal - client of the hyperlocal notification sockets
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * An application embeds this library to drive the hostapd notification
+ * socket (<ctrl_interface>/notification) or the wpa_supplicant one
+ * (wpa_wipush) without a helper process. Every call takes an opaque handle
+ * and there is no global state, so one process may open as many handles, on
+ * as many BSSes, as it likes.
+ *
+ * Nothing blocks. A request is sent when it is made and its callback runs
+ * from hl_client_process() when the reply comes back, like the events. The
+ * application polls hl_client_fd() for POLLIN and calls hl_client_process(),
+ * or adds the fd to its own loop:
+ *
+ *	c = hl_client_open(HL_CLIENT_AP, "/var/run/hostapd/notification",
+ *			   NULL, "NOT_RESP", event_cb, app);
+ *	poll() hl_client_fd(c) for POLLIN
+ *	hl_client_process(c);
+ *
+ * Requests may be made from any thread. hl_client_process() runs in one
+ * thread at a time and calls the callbacks without holding the lock that
+ * requests take, so a callback may make requests but must not call
+ * hl_client_process() or hl_client_close().
+ *
+ * Pushes use the binary requests of hyperlocal_ctrl.h and are matched to
+ * their reply by sequence number, the other commands are text and the
+ * daemon answers them in order.
+ *
+ * A handle opened with an ifname works on that BSS only, so one process
+ * drives several BSSes with a handle each: pushes, topic and broadcast ones
+ * too, are queued on it (HL_CTRL_OP_PUSH_BSS), answers and the other text
+ * commands get "IFNAME=<ifname>" and events of other BSSes are dropped.
+ * Without an ifname, hostapd queues a push on the BSS that serves the
+ * station and topic and broadcast pushes on every BSS.
+ */
+
+#ifndef HYPERLOCAL_CLIENT_H
+#define HYPERLOCAL_CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct hl_client;
+
+enum hl_client_type {
+	HL_CLIENT_AP = 0, /* hostapd notification socket */
+	HL_CLIENT_STA = 1, /* wpa_supplicant wpa_wipush socket */
+};
+
+enum hl_event_type {
+	HL_EVENT_AP = 0, /* text event of hostapd, see name */
+	HL_EVENT_MSG = 1, /* message from an AP */
+	HL_EVENT_ANNOUNCE = 2, /* the station announced itself */
+	HL_EVENT_QFAIL = 3, /* query to one AP given up */
+	HL_EVENT_QDONE = 4, /* query to every AP done */
+};
+
+/*
+ * An event, valid during the callback only. HL_EVENT_AP has the BSS, the
+ * event name (NEWNODE, NOT_RESP, ...) and its text in data. The others come
+ * from a station and use the fields of hyperlocal_event.h.
+ */
+struct hl_event {
+	int type; /* enum hl_event_type */
+	const char *ifname;
+	const char *name;
+	uint8_t addr[6];
+	uint8_t msg_type;
+	uint8_t kind;
+	uint16_t check;
+	uint32_t mid;
+	uint32_t qid;
+	uint16_t answered;
+	uint16_t failed;
+	const uint8_t *data;
+	size_t len;
+};
+
+/* Priority classes of a push, HL_CTRL_PUSH_PRIO_* */
+#define HL_PRIO_NORMAL 0
+#define HL_PRIO_URGENT 1
+#define HL_PRIO_BULK 2
+
+/* A message to queue at an AP, for dst or, if topic >= 0, for a topic */
+struct hl_push {
+	uint8_t dst[6];
+	int topic;
+	uint8_t type; /* 0 = no response expected, 1 = wait for response */
+	uint8_t prio;
+	uint32_t ttl; /* seconds, 0 = until deleted */
+	const uint8_t *payload;
+	size_t len;
+};
+
+typedef void (*hl_event_cb)(void *ctx, const struct hl_event *ev);
+/* status is 0 or -1, id is the message or query id if there is one */
+typedef void (*hl_done_cb)(void *ctx, int status, uint32_t id);
+/* mids[i] is the id of pushes[i], 0 if it was rejected */
+typedef void (*hl_batch_cb)(void *ctx, int status, const uint32_t *mids,
+			    size_t count);
+
+/*
+ * Connect to the socket at path, for the BSS ifname or, with NULL, for every
+ * BSS. With event_cb the handle attaches for events, the comma separated
+ * list or all of them if events is NULL.
+ */
+struct hl_client * hl_client_open(enum hl_client_type type, const char *path,
+				  const char *ifname, const char *events,
+				  hl_event_cb event_cb, void *ctx);
+/* Requests still waiting get status -1 */
+void hl_client_close(struct hl_client *c);
+int hl_client_fd(struct hl_client *c);
+/* Handle what arrived, the number of datagrams or -1 if the socket failed */
+int hl_client_process(struct hl_client *c);
+
+/* Change the events of the handle */
+int hl_subscribe(struct hl_client *c, const char *events, hl_done_cb cb,
+		 void *ctx);
+
+/* AP: queue messages, see hyperlocal_ctrl.h */
+int hl_push(struct hl_client *c, const struct hl_push *push, hl_done_cb cb,
+	    void *ctx);
+int hl_push_batch(struct hl_client *c, const struct hl_push *pushes,
+		  size_t count, hl_batch_cb cb, void *ctx);
+/*
+ * AP: answer the query qid of the station addr, or with addr NULL the query
+ * qid of a NOT_QRY event, which the query cache keeps for ttl seconds
+ */
+int hl_answer(struct hl_client *c, const uint8_t *addr, uint32_t qid,
+	      uint32_t ttl, const uint8_t *payload, size_t len, hl_done_cb cb,
+	      void *ctx);
+
+/*
+ * STA: ask bssid, or every AP around if NULL, the id is the query id. The
+ * answers are HL_EVENT_MSG events, so the handle needs an event_cb.
+ */
+int hl_query(struct hl_client *c, const uint8_t *bssid,
+	     const uint8_t *payload, size_t len, hl_done_cb cb, void *ctx);
+/* STA: join or leave a topic at bssid */
+int hl_topic(struct hl_client *c, const uint8_t *bssid, unsigned int topic,
+	     int join, hl_done_cb cb, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HYPERLOCAL_CLIENT_H */
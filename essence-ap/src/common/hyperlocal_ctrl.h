@@ -0,0 +1,83 @@
+/*
+ * Hyperlocal notification socket - binary control protocol
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * Besides the text commands, the hostapd notification socket accepts binary
+ * requests. A binary request starts with a NUL byte, which no text command
+ * can, so both can be mixed on the same socket. All integers are little
+ * endian.
+ *
+ * Request and reply header (HL_CTRL_HDR_LEN bytes):
+ *	u8 magic	HL_CTRL_MAGIC
+ *	u8 version	HL_CTRL_VERSION
+ *	u8 op		enum hl_ctrl_op
+ *	u8 status	0 in requests, enum hl_ctrl_status in replies
+ *	le32 seq	chosen by the client and echoed in the reply
+ *	le16 count	number of records that follow
+ *
+ * HL_CTRL_OP_PUSH_BATCH request records (HL_CTRL_PUSH_HDR_LEN + len bytes):
+ *	u8 dst[6]	station address, ff:ff:ff:ff:ff:ff for a broadcast,
+ *			le16 topic id and 4 zero bytes with HL_CTRL_PUSH_TOPIC
+ *	u8 type		0 = no response expected, 1 = wait for response
+ *	u8 flags	HL_CTRL_PUSH_* flags and the HL_CTRL_PUSH_PRIO_*
+ *			class in HL_CTRL_PUSH_PRIO_MASK, other bits must be 0
+ *	le32 ttl	message lifetime in seconds, 0 = until deleted
+ *	le16 len	payload length
+ *	u8 payload[len]
+ *
+ * HL_CTRL_OP_PUSH_BATCH reply records, one per request record in order:
+ *	le32 mid	assigned message id, 0 if the record was rejected
+ *
+ * PUSH_BATCH records are routed like text commands without "IFNAME=": a
+ * station's message goes to the BSS that serves it, topic and broadcast
+ * messages to every BSS. HL_CTRL_OP_PUSH_BSS queues them on one BSS only,
+ * like "IFNAME=<ifname> PUSH". The header is followed by the BSS and then
+ * by the PUSH_BATCH records, the reply is the same:
+ *	u8 ifname_len
+ *	char ifname[ifname_len]	not NUL terminated
+ */
+
+#ifndef HYPERLOCAL_CTRL_H
+#define HYPERLOCAL_CTRL_H
+
+#define HL_CTRL_MAGIC 0x00
+#define HL_CTRL_VERSION 1
+
+#define HL_CTRL_HDR_LEN 10
+#define HL_CTRL_HDR_OP 2
+#define HL_CTRL_HDR_STATUS 3
+#define HL_CTRL_HDR_SEQ 4
+#define HL_CTRL_HDR_COUNT 8
+
+#define HL_CTRL_PUSH_HDR_LEN 14
+#define HL_CTRL_PUSH_MID_LEN 4
+/* The record is for the members of a topic instead of one station */
+#define HL_CTRL_PUSH_TOPIC 0x01
+/* Delivery class of the record, normal unless set */
+#define HL_CTRL_PUSH_PRIO_MASK 0x06
+#define HL_CTRL_PUSH_PRIO_SHIFT 1
+#define HL_CTRL_PUSH_PRIO_NORMAL 0
+#define HL_CTRL_PUSH_PRIO_URGENT 1
+#define HL_CTRL_PUSH_PRIO_BULK 2
+/* Upper bound of records in one request, keeps the reply in one datagram */
+#define HL_CTRL_MAX_RECORDS 4096
+
+enum hl_ctrl_op {
+	HL_CTRL_OP_PUSH_BATCH = 1,
+	HL_CTRL_OP_PUSH_BSS = 2,
+};
+
+enum hl_ctrl_status {
+	HL_CTRL_STATUS_OK = 0,
+	HL_CTRL_STATUS_BAD_VERSION = 1,
+	HL_CTRL_STATUS_BAD_OP = 2,
+	HL_CTRL_STATUS_MALFORMED = 3,
+	/* Some records were rejected, their mid is 0 */
+	HL_CTRL_STATUS_PARTIAL = 4,
+	/* HL_CTRL_OP_PUSH_BSS names no hyperlocal BSS */
+	HL_CTRL_STATUS_NO_BSS = 5,
+};
+
+#endif /* HYPERLOCAL_CTRL_H */
@@ -0,0 +1,73 @@
+/*
+ * Hyperlocal notification socket - binary event format
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * A handling unit that attaches to the wpa_supplicant notification socket
+ * with "ATTACH BIN" gets its events in binary datagrams instead of one text
+ * datagram per event. Events that come close together, e.g. the messages of
+ * an aggregated frame, share a datagram. A datagram starts with a NUL byte,
+ * which the text replies ("OK", "FAIL", ...) on the same socket never do.
+ * All integers are little endian.
+ *
+ * Datagram header (HL_EV_HDR_LEN bytes):
+ *	u8 magic	HL_EV_MAGIC
+ *	u8 version	HL_EV_VERSION
+ *	le16 count	number of records that follow
+ *	le32 seq	per subscriber datagram counter, a gap means datagrams
+ *			were lost
+ *
+ * Record (HL_EV_REC_LEN + len bytes):
+ *	u8 type		enum hl_ev_type
+ *	u8 flags	0, reserved
+ *	le16 len	length of the body
+ *	u8 body[len]
+ *
+ * HL_EV_MSG body (HL_EV_MSG_LEN + payload length bytes):
+ *	u8 addr[6]	the AP
+ *	u8 msg_type	0 = no response expected, 1 = wait for response,
+ *			2 = answer to a query
+ *	le32 mid	message id given by the AP
+ *	le32 qid	query the message answers, 0 if it is not an answer
+ *	le16 check	AP side check id
+ *	u8 payload[]
+ *
+ * HL_EV_ANNOUNCE body (HL_EV_ANNOUNCE_LEN bytes):
+ *	u8 kind		0 = probe request, 1 = fetch
+ *	le16 check	announcement counter
+ *
+ * HL_EV_QFAIL body (HL_EV_QFAIL_LEN bytes):
+ *	le32 qid	query sent to one AP that was given up
+ *
+ * HL_EV_QDONE body (HL_EV_QDONE_LEN bytes):
+ *	le32 qid	query sent to every AP that every AP is done with
+ *	le16 answered
+ *	le16 failed
+ */
+
+#ifndef HYPERLOCAL_EVENT_H
+#define HYPERLOCAL_EVENT_H
+
+#define HL_EV_MAGIC 0x00
+#define HL_EV_VERSION 1
+
+#define HL_EV_HDR_LEN 8
+#define HL_EV_HDR_COUNT 2
+#define HL_EV_HDR_SEQ 4
+
+#define HL_EV_REC_LEN 4
+
+#define HL_EV_MSG_LEN 17
+#define HL_EV_ANNOUNCE_LEN 3
+#define HL_EV_QFAIL_LEN 4
+#define HL_EV_QDONE_LEN 8
+
+enum hl_ev_type {
+	HL_EV_MSG = 1,
+	HL_EV_ANNOUNCE = 2,
+	HL_EV_QFAIL = 3,
+	HL_EV_QDONE = 4,
+};
+
+#endif /* HYPERLOCAL_EVENT_H */
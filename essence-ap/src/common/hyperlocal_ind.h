@@ -0,0 +1,55 @@
+/*
+ * Hyperlocal notification indicator element
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * WLAN_EID_NOT_INDICATOR in beacons and probe responses tells a station how
+ * long to wait before fetching notifications and, since the element was
+ * extended, whether there is anything new to fetch. All integers are little
+ * endian.
+ *
+ *	le16 tout	ms to wait before the fetch
+ *	le32 bcast_mid	newest broadcast notification, 0 if there is none
+ *	le64 dst_filter	Bloom filter of the stations that have directed
+ *			notifications waiting, see hl_ind_filter_match()
+ *
+ * Older APs send only tout (HL_IND_BASE_LEN), stations then always fetch.
+ */
+
+#ifndef HYPERLOCAL_IND_H
+#define HYPERLOCAL_IND_H
+
+#define HL_IND_BASE_LEN 2
+#define HL_IND_LEN 14
+#define HL_IND_BCAST_MID 2
+#define HL_IND_DST_FILTER 6
+#define HL_IND_FILTER_BITS 64
+
+/* The two filter bits of a station address */
+static inline void hl_ind_filter_bits(const u8 *addr, unsigned int *b1,
+				      unsigned int *b2)
+{
+	u32 h = 2166136261U;
+	int i;
+
+	for (i = 0; i < ETH_ALEN; i++){
+		h ^= addr[i];
+		h *= 16777619U;
+	}
+
+	*b1 = h % HL_IND_FILTER_BITS;
+	*b2 = (h >> 16) % HL_IND_FILTER_BITS;
+}
+
+
+static inline int hl_ind_filter_match(u64 filter, const u8 *addr)
+{
+	unsigned int b1, b2;
+
+	hl_ind_filter_bits(addr, &b1, &b2);
+
+	return (filter & (1ULL << b1)) && (filter & (1ULL << b2));
+}
+
+#endif /* HYPERLOCAL_IND_H */
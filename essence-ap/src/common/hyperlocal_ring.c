@@ -0,0 +1,251 @@
+/*
+ * Hyperlocal event ring
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+#include "utils/includes.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+
+#include "utils/common.h"
+#include "hyperlocal_ring.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif /* MFD_CLOEXEC */
+
+struct hl_ring {
+	struct hl_ring_hdr *hdr;
+	u8 *data;
+	size_t len; /* of the mapping */
+	int memfd;
+	int evfd;
+	u64 next; /* consumer: tail after the record peeked at */
+};
+
+
+static struct hl_ring * hl_ring_map(int memfd, int evfd, size_t len)
+{
+	struct hl_ring *ring;
+	void *map;
+
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+	if (map == MAP_FAILED){
+		wpa_printf(MSG_ERROR, "hl_ring: mmap failed: %s",
+			   strerror(errno));
+		return NULL;
+	}
+
+	ring = os_zalloc(sizeof(*ring));
+	if (ring == NULL){
+		munmap(map, len);
+		return NULL;
+	}
+	ring->hdr = map;
+	ring->data = (u8 *) (ring->hdr + 1);
+	ring->len = len;
+	ring->memfd = memfd;
+	ring->evfd = evfd;
+	return ring;
+}
+
+
+/* A ring with size bytes of record space, rounded up to a power of two */
+struct hl_ring * hl_ring_create(size_t size)
+{
+	struct hl_ring *ring;
+	size_t space = 4096;
+	int memfd, evfd;
+
+	while (space < size)
+		space <<= 1;
+
+	memfd = syscall(SYS_memfd_create, "hyperlocal", MFD_CLOEXEC);
+	if (memfd < 0){
+		wpa_printf(MSG_ERROR, "hl_ring: memfd_create failed: %s",
+			   strerror(errno));
+		return NULL;
+	}
+	if (ftruncate(memfd, sizeof(struct hl_ring_hdr) + space) < 0){
+		wpa_printf(MSG_ERROR, "hl_ring: ftruncate failed: %s",
+			   strerror(errno));
+		close(memfd);
+		return NULL;
+	}
+	evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (evfd < 0){
+		wpa_printf(MSG_ERROR, "hl_ring: eventfd failed: %s",
+			   strerror(errno));
+		close(memfd);
+		return NULL;
+	}
+
+	ring = hl_ring_map(memfd, evfd, sizeof(struct hl_ring_hdr) + space);
+	if (ring == NULL){
+		close(evfd);
+		close(memfd);
+		return NULL;
+	}
+
+	ring->hdr->version = HL_RING_VERSION;
+	ring->hdr->size = space;
+	/* A consumer that attaches checks the magic last */
+	__atomic_store_n(&ring->hdr->magic, HL_RING_MAGIC, __ATOMIC_RELEASE);
+
+	return ring;
+}
+
+
+/* Map a ring created in another process, the ring owns the descriptors */
+struct hl_ring * hl_ring_attach(int memfd, int evfd)
+{
+	struct hl_ring_hdr hdr;
+	struct hl_ring *ring;
+	struct stat st;
+
+	if (fstat(memfd, &st) < 0 || (size_t) st.st_size < sizeof(hdr) ||
+	    pread(memfd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		return NULL;
+
+	if (hdr.magic != HL_RING_MAGIC || hdr.version != HL_RING_VERSION ||
+	    hdr.size == 0 || (hdr.size & (hdr.size - 1)) ||
+	    (size_t) st.st_size < sizeof(hdr) + hdr.size){
+		wpa_printf(MSG_ERROR, "hl_ring: not a version %d ring",
+			   HL_RING_VERSION);
+		return NULL;
+	}
+
+	ring = hl_ring_map(memfd, evfd, sizeof(hdr) + hdr.size);
+	if (ring)
+		ring->next = ring->hdr->tail;
+	return ring;
+}
+
+
+void hl_ring_free(struct hl_ring *ring)
+{
+	if (ring == NULL)
+		return;
+
+	munmap(ring->hdr, ring->len);
+	close(ring->evfd);
+	close(ring->memfd);
+	os_free(ring);
+}
+
+
+int hl_ring_memfd(struct hl_ring *ring)
+{
+	return ring->memfd;
+}
+
+
+int hl_ring_eventfd(struct hl_ring *ring)
+{
+	return ring->evfd;
+}
+
+
+/* Copy a record of len bytes in, -1 if it does not fit now or ever */
+int hl_ring_write(struct hl_ring *ring, const void *data, size_t len)
+{
+	struct hl_ring_hdr *hdr = ring->hdr;
+	u64 start, head, tail;
+	size_t need, off, pad = 0;
+	u64 one = 1;
+
+	need = (sizeof(u32) + len + HL_RING_ALIGN - 1) & ~(HL_RING_ALIGN - 1);
+	if (need > hdr->size / 2)
+		return -1;
+
+	start = head = hdr->head;
+	tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+	off = head & (hdr->size - 1);
+	if (hdr->size - off < need)
+		pad = hdr->size - off;
+
+	if (head + pad + need - tail > hdr->size){
+		__atomic_store_n(&hdr->dropped, hdr->dropped + 1,
+				 __ATOMIC_RELAXED);
+		return -1;
+	}
+
+	if (pad){
+		*(u32 *) (ring->data + off) = HL_RING_WRAP;
+		head += pad;
+		off = 0;
+	}
+	*(u32 *) (ring->data + off) = len;
+	os_memcpy(ring->data + off + sizeof(u32), data, len);
+
+	/*
+	 * Publish, then look at tail. The consumer stores tail before it looks
+	 * at head, so either it sees the new record or we see that it read
+	 * everything before it and has to be woken up.
+	 */
+	__atomic_store_n(&hdr->head, head + need, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&hdr->tail, __ATOMIC_SEQ_CST) == start &&
+	    write(ring->evfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		return -1;
+
+	return 0;
+}
+
+
+/* The next record in place, NULL when the ring is empty */
+const u8 * hl_ring_peek(struct hl_ring *ring, size_t *len)
+{
+	struct hl_ring_hdr *hdr = ring->hdr;
+	u64 tail, head;
+	size_t off;
+	u32 rlen;
+
+	tail = hdr->tail;
+	head = __atomic_load_n(&hdr->head, __ATOMIC_SEQ_CST);
+
+	while (tail != head){
+		off = tail & (hdr->size - 1);
+		rlen = *(u32 *) (ring->data + off);
+		if (rlen == HL_RING_WRAP){
+			tail += hdr->size - off;
+			continue;
+		}
+		if (rlen > hdr->size / 2)
+			break;
+
+		*len = rlen;
+		ring->next = tail + ((sizeof(u32) + rlen + HL_RING_ALIGN - 1) &
+				     ~(HL_RING_ALIGN - 1));
+		return ring->data + off + sizeof(u32);
+	}
+
+	return NULL;
+}
+
+
+/* Done with the record from hl_ring_peek(), the producer may reuse it */
+void hl_ring_release(struct hl_ring *ring)
+{
+	__atomic_store_n(&ring->hdr->tail, ring->next, __ATOMIC_SEQ_CST);
+}
+
+
+/* Reset the eventfd before draining the ring */
+void hl_ring_ack(struct hl_ring *ring)
+{
+	u64 cnt;
+
+	if (read(ring->evfd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+		wpa_printf(MSG_DEBUG, "hl_ring: eventfd read failed: %s",
+			   strerror(errno));
+}
+
+
+u64 hl_ring_dropped(struct hl_ring *ring)
+{
+	return __atomic_load_n(&ring->hdr->dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,74 @@
+/*
+ * Hyperlocal event ring
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ *
+ * Single producer, single consumer ring of length prefixed records in a
+ * memfd, with an eventfd to wake the consumer. The notifier helpers write
+ * the events they receive from the daemon and the application reads them in
+ * place: hl_ring_peek() returns a pointer into the shared memory that stays
+ * valid until hl_ring_release(). The consumer may live in another process,
+ * it maps the ring with hl_ring_attach() from the two descriptors.
+ *
+ * The producer publishes records by advancing head and the consumer frees
+ * them by advancing tail, so no lock is needed. The producer signals the
+ * eventfd only when the consumer had read everything before the new record,
+ * a consumer drains the ring after each wakeup:
+ *
+ *	poll() the hl_ring_eventfd() for POLLIN
+ *	hl_ring_ack()
+ *	while ((rec = hl_ring_peek(ring, &len))) {
+ *		handle rec[0..len - 1]
+ *		hl_ring_release(ring);
+ *	}
+ *
+ * A full ring drops new records and counts them, the producer never blocks.
+ */
+
+#ifndef HYPERLOCAL_RING_H
+#define HYPERLOCAL_RING_H
+
+#define HL_RING_MAGIC 0x474e5248
+#define HL_RING_VERSION 1
+
+/* Shared memory layout, every field is in host byte order */
+struct hl_ring_hdr {
+	u32 magic;
+	u32 version;
+	u32 size; /* bytes of record space after the header, power of two */
+	u32 reserved;
+	u64 dropped;
+	u8 pad1[40];
+	u64 head; /* written by the producer */
+	u8 pad2[56];
+	u64 tail; /* written by the consumer */
+	u8 pad3[56];
+};
+
+/*
+ * A record is a u32 length followed by the data, padded to HL_RING_ALIGN.
+ * A length of HL_RING_WRAP means the rest of the space up to the end is
+ * unused and the next record starts at the beginning.
+ */
+#define HL_RING_ALIGN 8
+#define HL_RING_WRAP 0xffffffff
+
+struct hl_ring;
+
+struct hl_ring * hl_ring_create(size_t size);
+struct hl_ring * hl_ring_attach(int memfd, int evfd);
+void hl_ring_free(struct hl_ring *ring);
+int hl_ring_memfd(struct hl_ring *ring);
+int hl_ring_eventfd(struct hl_ring *ring);
+
+/* Producer */
+int hl_ring_write(struct hl_ring *ring, const void *data, size_t len);
+
+/* Consumer */
+const u8 * hl_ring_peek(struct hl_ring *ring, size_t *len);
+void hl_ring_release(struct hl_ring *ring);
+void hl_ring_ack(struct hl_ring *ring);
+u64 hl_ring_dropped(struct hl_ring *ring);
+
+#endif /* HYPERLOCAL_RING_H */
@@ -317,11 +317,19 @@
 #define WLAN_PA_HYPERLOCAL_TTF_REQ 0x85
 #define WLAN_PA_HYPERLOCAL_TTF_RESP 0x86
 #define WLAN_PA_HYPERLOCAL_RESP 0x87
+#define WLAN_PA_HYPERLOCAL_AGG_RESP 0x88
+#define WLAN_PA_HYPERLOCAL_FRAG_RESP 0x89
+#define WLAN_PA_HYPERLOCAL_COMEBACK_REQ 0x8a
+#define WLAN_PA_HYPERLOCAL_SUBSCRIBE 0x8b
+/* Flags (le16) that end a WLAN_PA_HYPERLOCAL_QUERY */
+#define WLAN_PA_HYPERLOCAL_QUERY_F_ANSWER 0x0001 /* to WAIT_RESP, id = mid */
 
 
 /*Wi-Push Message Types*/
 #define WLAN_PA_NO_RESP 0xc8
 #define WLAN_PA_WAIT_RESP 0xc9
+/* Answer to a hyperlocal query, the payload starts with the le32 query id */
+#define WLAN_PA_QUERY_RESP 0xca
 
 /* Protected Dual of Public Action frames */
 #define WLAN_PROT_DSE_ENABLEMENT 1
@@ -23,6 +23,8 @@
 #include "utils/common.h"
 #include "utils/eloop.h"
 #include "common/ieee802_11_defs.h"
+#include "common/hyperlocal_ind.h"
+#include "common/hyperlocal_event.h"
 #include "wpa_supplicant_i.h"
 #include "offchannel.h"
 #include "driver_i.h"
@@ -33,50 +35,408 @@
 static const char AFN_SOCKNAME[] = "wpa_wipush";
 static u16 check;
 
+/* Events a handling unit can attach to */
+#define ACTION_EV_MSG 0x01
+#define ACTION_EV_ANNOUNCE 0x02
+#define ACTION_EV_ALL (ACTION_EV_MSG | ACTION_EV_ANNOUNCE)
+
+/*
+ * An attached handling unit. Query answers and results go to the app that
+ * sent the query whatever it attached to.
+ */
 struct action_ctrl_dst{
+	struct dl_list list; /* action_handle::dst */
 	struct sockaddr_un addr;
 	socklen_t addrlen;
+	u32 events; /* ACTION_EV_* */
+	int binary; /* hyperlocal_event.h datagrams instead of text */
+	struct wpabuf *batch; /* binary events not sent yet */
+	u16 count;
+	u32 seq;
 	int errors;
 };
 
+#define ACTION_MAX_DST 16
+/* Binary events wait this long for others to share their datagram */
+#define ACTION_EVENT_BATCH_MS 10
+/* A batch this long is sent without waiting for the window to close */
+#define ACTION_EVENT_BATCH_MAX 16384
+
+/*
+ * Fetch state of an AP. Indicators from scans and time to fetch requests
+ * only set when the next fetch from the AP is due, so triggers that come
+ * before the fetch merge into it. A single timer serves every AP and sends
+ * all the fetches that fall due close together in one go. The fetches a
+ * scan triggers are due together, when the last of them is, so the radio
+ * wakes once after a scan whatever the timeouts of the APs.
+ */
+struct action_ind {
+	u8 bssid[ETH_ALEN];
+	u32 bcast_mid; /* newest broadcast fetched, the AP acked the fetch */
+	u32 bcast_want; /* newest broadcast the AP advertises */
+	u32 bcast_sent; /* bcast_want when the last fetch went out */
+	int freq;
+	int fetch; /* due is set */
+	int announce; /* tell the app we are about to fetch */
+	int scan; /* due set from the scan results being processed */
+	struct os_reltime due;
+	struct os_reltime last;
+	int have_last;
+};
+
+#define ACTION_IND_MAX 32
+/* Least time between two fetches from an AP */
+#define ACTION_FETCH_MIN_INTERVAL_MS 500
+/* Other fetches due within this long after the first one are sent with it */
+#define ACTION_FETCH_SLACK_MS 100
+
+#define ACTION_SEEN_BUCKETS 64
+#define ACTION_SEEN_MAX 512
+#define ACTION_SEEN_TTL 300 /* seconds */
+
 struct action_handle {
 	struct wpa_supplicant *wpa_s;
-	struct dl_list pending;
-	struct action_ctrl_dst *dst;
+	struct dl_list seen[ACTION_SEEN_BUCKETS]; /* struct action_seen */
+	struct dl_list seen_lru; /* struct action_seen, least recent first */
+	struct dl_list seen_age; /* struct action_seen, oldest first */
+	unsigned int num_seen;
+	struct dl_list reasm; /* struct action_reasm */
+	unsigned int num_reasm;
+	struct action_ind ind[ACTION_IND_MAX];
+	unsigned int num_ind;
+	unsigned int next_ind;
+	struct dl_list queries; /* struct action_query */
+	unsigned int num_queries;
+	u32 next_qid;
+	struct dl_list qgroups; /* struct action_qgroup */
+	struct dl_list tx_queue; /* struct action_tx */
+	unsigned int tx_len;
+	struct action_tx *tx_cur; /* waiting for its TX status */
+	int dwell_freq;
+	struct os_reltime dwell_start;
+	struct dl_list dst; /* struct action_ctrl_dst */
+	unsigned int num_dst;
 	int fd;
 	int sock;
- 
+	char *sock_path; /* NULL for the Android control socket */
+	int primary; /* owns AFN_SOCKNAME */
 };
 
-struct action_pending {
+/*
+ * A message received from an AP, by (AP address, MID). The entry suppresses
+ * duplicates of the message, e.g. a retransmission whose ACK we missed or a
+ * broadcast fetched again, until it expires or is evicted as the least
+ * recently used one. A WAIT_RESP message also stays pending here until the
+ * handling unit answers it. The AP does not reuse a MID after a restart,
+ * its counter starts at a random value unless the journal restores it.
+ */
+struct action_seen {
+	struct dl_list list; /* hash bucket */
+	struct dl_list lru;
+	struct dl_list age; /* creation order, which is expiry order */
+	u8 addr[ETH_ALEN];
+	u32 mid;
+	int freq;
+	int pending;
+	struct os_reltime expire;
+};
+
+/* Reassembly of a message the AP sends in WLAN_PA_HYPERLOCAL_FRAG_RESP */
+struct action_reasm {
 	struct dl_list list;
+	struct action_handle *act;
 	u8 addr[ETH_ALEN];
 	u32 mid;
+	u8 type;
+	u16 total;
+	u16 received;
+	u8 next_frag;
+	u8 retries;
+	u16 num;
+	int freq;
+	u8 *buf;
+};
+
+/*
+ * A query an app sent to an AP. The AP takes it by telling when to come for
+ * the answer (WLAN_PA_HYPERLOCAL_TTF_REQ with the query id), and the answer
+ * comes back as a WLAN_PA_QUERY_RESP with the query id, which routes it to
+ * the app.
+ */
+struct action_query {
+	struct dl_list list;
+	struct action_handle *act;
+	struct action_qgroup *group;
+	u8 addr[ETH_ALEN];
+	u32 qid;
 	int freq;
+	u8 retries;
+	int taken; /* the AP sent its time to fetch */
+	struct sockaddr_un from; /* the app */
+	socklen_t fromlen;
+	u8 *payload;
+	size_t len;
 };
 
+/*
+ * A query sent to every AP that advertises the notification indicator. All
+ * of them carry the same query id, the app gets each answer as it comes and
+ * "QDONE:QID:<qid>-Answered:<n>-Failed:<n>" once every AP is done.
+ */
+struct action_qgroup {
+	struct dl_list list;
+	u32 qid;
+	unsigned int pending;
+	unsigned int answered;
+	unsigned int failed;
+	struct sockaddr_un from;
+	socklen_t fromlen;
+};
+
+/*
+ * Hyperlocal frames to send. The off-channel code holds only one frame at a
+ * time and drops it for the next one, so frames go out one by one from TX
+ * status to TX status. Frames for the channel we are dwelling on go first,
+ * which sends the queries to all the APs on a channel in one dwell, until
+ * the dwell budget is spent and the other channels get their turn.
+ */
+struct action_tx {
+	struct dl_list list;
+	u8 dst[ETH_ALEN];
+	int freq;
+	struct wpabuf *buf;
+};
+
+#define ACTION_TX_QUEUE_MAX 64
+/* Time to stay on the channel after a frame for the AP to answer */
+#define ACTION_DWELL_MS 30
+#define ACTION_DWELL_BUDGET_MS 200
+/* Give up on a TX status after this long, someone else took the channel */
+#define ACTION_TX_TIMEOUT_MS 1000
+
+#define ACTION_QUERY_MAX 32
+#define ACTION_QUERY_PER_AP 8
+/* Resend a query the AP has not taken after this long */
+#define ACTION_QUERY_TIMEOUT_MS 1000
+#define ACTION_QUERY_RETRIES 2
+/* Give up on the answer of a taken query after this many seconds */
+#define ACTION_QUERY_ANSWER_TIMEOUT 30
+
+#define ACTION_FRAG_MORE 0x80
+#define ACTION_REASM_MAX 8
+#define ACTION_REASM_TIMEOUT_MS 500
+#define ACTION_REASM_RETRIES 3
+
 
 static void action_notification_req_dispatcher(struct wpa_supplicant *wpa_s, const u8 *addr, int freq);
+static void action_reasm_timeout(void *eloop_ctx, void *timeout_ctx);
+static void action_query_timeout(void *eloop_ctx, void *timeout_ctx);
+static void action_tx_next(void *eloop_ctx, void *timeout_ctx);
+static void action_fetch_timeout(void *eloop_ctx, void *timeout_ctx);
+static void action_tx_timeout(void *eloop_ctx, void *timeout_ctx);
+static void action_ind_fetched(struct action_handle *act, const u8 *bssid);
+
+static struct action_ctrl_dst *action_dst_find(struct action_handle *act,
+					       const struct sockaddr_un *from,
+					       socklen_t fromlen)
+{
+	struct action_ctrl_dst *dst;
+
+	dl_list_for_each(dst, &act->dst, struct action_ctrl_dst, list){
+		if (fromlen == dst->addrlen &&
+		    os_memcmp(from->sun_path, dst->addr.sun_path,
+			      fromlen - offsetof(struct sockaddr_un, sun_path))
+		    == 0)
+			return dst;
+	}
 
+	return NULL;
+}
+
+static void action_dst_free(struct action_handle *act,
+			    struct action_ctrl_dst *dst)
+{
+	dl_list_del(&dst->list);
+	act->num_dst--;
+	wpabuf_free(dst->batch);
+	os_free(dst);
+}
+
+/* A send to dst failed with err, the unit is detached if it keeps failing */
+static void action_dst_failed(struct action_handle *act,
+			      struct action_ctrl_dst *dst, int err)
+{
+	wpa_printf(MSG_ERROR, "NOTIFICATION IFACE error: %d - %s", err,
+		   strerror(err));
+	dst->errors++;
+	if (dst->errors > 10 || err == ENOENT){
+		wpa_printf(MSG_DEBUG, "Detaching the notification unit");
+		action_dst_free(act, dst);
+	}
+}
+
+/* Send the binary events waiting for dst in one datagram, 0 or errno */
+static int action_event_send(struct action_handle *act,
+			     struct action_ctrl_dst *dst)
+{
+	struct wpabuf *batch = dst->batch;
+	u8 *hdr;
+	int err = 0;
+
+	if (batch == NULL)
+		return 0;
+
+	hdr = wpabuf_mhead_u8(batch);
+	WPA_PUT_LE16(hdr + HL_EV_HDR_COUNT, dst->count);
+	WPA_PUT_LE32(hdr + HL_EV_HDR_SEQ, dst->seq++);
+	if (sendto(act->sock, hdr, wpabuf_len(batch), 0,
+		   (struct sockaddr *) &dst->addr, dst->addrlen) < 0)
+		err = errno;
+	else
+		dst->errors = 0;
+
+	dst->batch = NULL;
+	dst->count = 0;
+	wpabuf_free(batch);
+	return err;
+}
+
+static void action_event_flush(void *eloop_ctx, void *timeout_ctx)
+{
+	struct action_handle *act = eloop_ctx;
+	struct action_ctrl_dst *dst, *tmp;
+	int err;
+
+	dl_list_for_each_safe(dst, tmp, &act->dst, struct action_ctrl_dst, list){
+		err = action_event_send(act, dst);
+		if (err)
+			action_dst_failed(act, dst, err);
+	}
+}
+
+/*
+ * Room for a binary event of len bytes in the batch of dst, the caller fills
+ * it in. The batch goes out when the window closes, or right after the
+ * current frame is handled once it is full.
+ */
+static u8 *action_event_put(struct action_handle *act,
+			    struct action_ctrl_dst *dst, u8 type, size_t len)
+{
+	if (len > 0xffff || dst->count == 0xffff)
+		return NULL;
+
+	if (dst->batch == NULL){
+		dst->batch = wpabuf_alloc(ACTION_EVENT_BATCH_MAX);
+		if (dst->batch == NULL)
+			return NULL;
+		wpabuf_put_u8(dst->batch, HL_EV_MAGIC);
+		wpabuf_put_u8(dst->batch, HL_EV_VERSION);
+		/* count and seq are set when the batch is sent */
+		wpabuf_put(dst->batch, HL_EV_HDR_LEN - 2);
+	}
+	if (wpabuf_resize(&dst->batch, HL_EV_REC_LEN + len) < 0)
+		return NULL;
+
+	wpabuf_put_u8(dst->batch, type);
+	wpabuf_put_u8(dst->batch, 0);
+	wpabuf_put_le16(dst->batch, len);
+	dst->count++;
+
+	if (!eloop_is_timeout_registered(action_event_flush, act, NULL))
+		eloop_register_timeout(0, ACTION_EVENT_BATCH_MS * 1000,
+				       action_event_flush, act, NULL);
+	if (wpabuf_len(dst->batch) >= ACTION_EVENT_BATCH_MAX)
+		eloop_deplete_timeout(0, 0, action_event_flush, act, NULL);
+
+	return wpabuf_put(dst->batch, len);
+}
+
+/* Send a text event to dst, one datagram per event */
+static int action_text_send(struct action_handle *act,
+			    struct action_ctrl_dst *dst, struct iovec *io,
+			    size_t iovlen)
+{
+	struct msghdr msg;
+
+	os_memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = io;
+	msg.msg_iovlen = iovlen;
+	msg.msg_name = &dst->addr;
+	msg.msg_namelen = dst->addrlen;
+
+	if (sendmsg(act->sock, &msg, 0) < 0){
+		action_dst_failed(act, dst, errno);
+		return -1;
+	}
+
+	dst->errors = 0;
+	return 0;
+}
+
+/*
+ * "ATTACH [BIN] [<event>,...]" with MSG and ANNOUNCE events, both when the
+ * list is left out. Attaching again from the same address changes the format
+ * and the events.
+ */
 static int start_not_connection(struct action_handle *act, struct sockaddr_un *from,
-								socklen_t fromlen)
+								socklen_t fromlen, const char *args)
 {
 	struct action_ctrl_dst *dst;
+	const char *pos = args, *end;
+	u32 events = 0;
+	int binary = 0;
+	size_t len;
+
 	wpa_printf(MSG_DEBUG, "Connection request arrived");
 
-	if (act->dst){
-		wpa_printf(MSG_DEBUG, "Action interface already initialized");
-		return 1;
+	if (os_strncmp(pos, "BIN", 3) == 0 && (pos[3] == '\0' || pos[3] == ' ')){
+		binary = 1;
+		pos += 3;
+		while (*pos == ' ')
+			pos++;
 	}
 
-	dst = os_zalloc(sizeof(*dst));
-	if (dst==NULL)
-		return -1;
+	while (*pos){
+		end = os_strchr(pos, ',');
+		len = end ? (size_t) (end - pos) : os_strlen(pos);
+		if (len == 3 && os_strncmp(pos, "MSG", 3) == 0){
+			events |= ACTION_EV_MSG;
+		}else if (len == 8 && os_strncmp(pos, "ANNOUNCE", 8) == 0){
+			events |= ACTION_EV_ANNOUNCE;
+		}else{
+			wpa_printf(MSG_DEBUG, "Unknown notification event '%.*s'",
+				   (int) len, pos);
+			return -1;
+		}
+		pos += len;
+		if (*pos == ',')
+			pos++;
+	}
+	if (events == 0)
+		events = ACTION_EV_ALL;
+
+	dst = action_dst_find(act, from, fromlen);
+	if (dst == NULL){
+		if (act->num_dst >= ACTION_MAX_DST){
+			wpa_printf(MSG_DEBUG, "Too many notification units");
+			return -1;
+		}
+		dst = os_zalloc(sizeof(*dst));
+		if (dst==NULL)
+			return -1;
+		os_memcpy(&dst->addr, from, sizeof(struct sockaddr_un));
+		dst->addrlen = fromlen;
+		dl_list_add_tail(&act->dst, &dst->list);
+		act->num_dst++;
+	}else if (dst->binary && !binary){
+		/* The unit is alive, it just asked, so a failure is not counted */
+		action_event_send(act, dst);
+	}
 
-	os_memcpy(&dst->addr, from, sizeof(struct sockaddr_un));
-	dst->addrlen = fromlen;
-	act->dst = dst;
-	wpa_printf(MSG_DEBUG, "Connection request accepted");
+	dst->events = events;
+	dst->binary = binary;
+	wpa_printf(MSG_DEBUG, "Connection request accepted (%s events 0x%x)",
+		   binary ? "binary" : "text", events);
 
 	return 0;
 }
@@ -86,51 +446,257 @@ static int stop_not_connection(struct action_handle *act, struct sockaddr_un *fr
 {
 	struct action_ctrl_dst *dst;
 
-	dst = act->dst;
+	dst = action_dst_find(act, from, fromlen);
+	if (dst == NULL)
+		return -1;
 
-	if (fromlen == dst->addrlen &&
-		os_memcmp(from->sun_path, dst->addr.sun_path,
-				fromlen - offsetof(struct sockaddr_un, sun_path))
-		== 0){
-		act->dst = NULL;
-		os_free(dst);
-		return 0;
+	action_event_send(act, dst);
+	action_dst_free(act, dst);
+	return 0;
+}
+
+static unsigned int action_seen_hash(const u8 *addr, u32 mid)
+{
+	u32 h = WPA_GET_BE32(addr + 2) ^ (mid * 2654435761U);
+
+	h ^= h >> 16;
+	return h % ACTION_SEEN_BUCKETS;
+}
+
+static void action_seen_free(struct action_handle *act, struct action_seen *s)
+{
+	dl_list_del(&s->list);
+	dl_list_del(&s->lru);
+	dl_list_del(&s->age);
+	act->num_seen--;
+	os_free(s);
+}
+
+/* Drop the expired entries, the oldest ones as they all live as long */
+static void action_seen_expire(struct action_handle *act)
+{
+	struct action_seen *s, *tmp;
+	struct os_reltime now;
+
+	os_get_reltime(&now);
+	dl_list_for_each_safe(s, tmp, &act->seen_age, struct action_seen, age) {
+		if (!os_reltime_before(&s->expire, &now))
+			break;
+		wpa_printf(MSG_DEBUG, "Message %u from " MACSTR " expired%s",
+			   s->mid, MAC2STR(s->addr),
+			   s->pending ? " without an answer" : "");
+		action_seen_free(act, s);
 	}
-	return -1;
 }
 
-static struct action_pending *getPending(struct action_handle *act, const u8 *addr,  u32 mid){
-	struct action_pending *q;
-	wpa_printf(MSG_DEBUG, "Looking for the notification whose answer is pending");
-	dl_list_for_each(q, &act->pending, struct action_pending, list) {
-		wpa_printf(MSG_DEBUG, "This entry is from " MACSTR " with id %u", MAC2STR(q->addr), q->mid);
-		if (os_memcmp(q->addr, addr, ETH_ALEN) == 0 &&
-			q->mid == mid){
-			wpa_printf(MSG_DEBUG, "Notification found");
-			return q;
+static struct action_seen *action_seen_get(struct action_handle *act,
+					   const u8 *addr, u32 mid)
+{
+	struct action_seen *s;
+	struct os_reltime now;
+
+	dl_list_for_each(s, &act->seen[action_seen_hash(addr, mid)],
+			 struct action_seen, list) {
+		if (s->mid != mid || os_memcmp(s->addr, addr, ETH_ALEN) != 0)
+			continue;
+
+		os_get_reltime(&now);
+		if (os_reltime_before(&s->expire, &now)){
+			action_seen_free(act, s);
+			return NULL;
 		}
+		dl_list_del(&s->lru);
+		dl_list_add_tail(&act->seen_lru, &s->lru);
+		return s;
 	}
 	return NULL;
 }
 
-static void delete_pending_action(struct action_pending *not){
-	dl_list_del(&not->list);
-	os_free(not);
+static struct action_seen *action_seen_add(struct action_handle *act,
+					   const u8 *addr, u32 mid, int freq,
+					   int pending)
+{
+	struct action_seen *s;
+
+	action_seen_expire(act);
+	if (act->num_seen >= ACTION_SEEN_MAX)
+		action_seen_free(act, dl_list_first(&act->seen_lru,
+						    struct action_seen, lru));
+
+	s = os_zalloc(sizeof(*s));
+	if (s == NULL)
+		return NULL;
+
+	os_memcpy(s->addr, addr, ETH_ALEN);
+	s->mid = mid;
+	s->freq = freq;
+	s->pending = pending;
+	os_get_reltime(&s->expire);
+	s->expire.sec += ACTION_SEEN_TTL;
+
+	dl_list_add(&act->seen[action_seen_hash(addr, mid)], &s->list);
+	dl_list_add_tail(&act->seen_lru, &s->lru);
+	dl_list_add_tail(&act->seen_age, &s->age);
+	act->num_seen++;
+
+	return s;
 }
 
-static int action_hyperlocal_query_dispatcher(struct wpa_supplicant *wpa_s, struct action_pending *not, const char *payload, size_t paylen)
+static void action_tx_free(struct action_tx *t)
 {
-	int res;
+	wpabuf_free(t->buf);
+	os_free(t);
+}
 
-	wpa_printf(MSG_DEBUG, "Preparing the answer to the notification");
+/* The frame on air is done with, go on with the next one */
+static void action_tx_done(struct action_handle *act)
+{
+	eloop_cancel_timeout(action_tx_timeout, act, NULL);
+	if (act->tx_cur){
+		action_tx_free(act->tx_cur);
+		act->tx_cur = NULL;
+	}
 
-	const u8 *dst = not->addr;
-	const u8 *src = wpa_s->own_addr;
-	const u8 *bssid = not->addr;
+	if (dl_list_empty(&act->tx_queue))
+		act->dwell_freq = 0;
+	else
+		eloop_register_timeout(0, 0, action_tx_next, act, NULL);
+}
 
+static void action_tx_status(struct wpa_supplicant *wpa_s, unsigned int freq,
+			     const u8 *dst, const u8 *src, const u8 *bssid,
+			     const u8 *data, size_t data_len,
+			     enum offchannel_send_action_result result)
+{
+	struct action_handle *act = wpa_s->act;
+
+	if (act == NULL || act->tx_cur == NULL)
+		return;
+
+	wpa_printf(MSG_DEBUG, "Hyperlocal frame to " MACSTR " at %u MHz: %s",
+		   MAC2STR(dst), freq,
+		   result == OFFCHANNEL_SEND_ACTION_SUCCESS ? "ACK" : "no ACK");
+	if (result == OFFCHANNEL_SEND_ACTION_SUCCESS && data_len >= 4 &&
+	    data[3] == WLAN_PA_HYPERLOCAL_TTF_RESP)
+		action_ind_fetched(act, dst);
+	action_tx_done(act);
+}
+
+static void action_tx_timeout(void *eloop_ctx, void *timeout_ctx)
+{
+	struct action_handle *act = eloop_ctx;
+
+	wpa_printf(MSG_DEBUG, "No TX status for the hyperlocal frame to " MACSTR,
+		   MAC2STR(act->tx_cur->dst));
+	action_tx_done(act);
+}
+
+/* The next frame: one for the dwell channel while the budget lasts */
+static struct action_tx *action_tx_pick(struct action_handle *act)
+{
+	struct action_tx *t;
+	struct os_reltime now, age;
+
+	if (act->dwell_freq){
+		os_get_reltime(&now);
+		os_reltime_sub(&now, &act->dwell_start, &age);
+		if (age.sec * 1000 + age.usec / 1000 < ACTION_DWELL_BUDGET_MS){
+			dl_list_for_each(t, &act->tx_queue, struct action_tx,
+					 list){
+				if (t->freq == act->dwell_freq)
+					return t;
+			}
+		}
+	}
+
+	return dl_list_first(&act->tx_queue, struct action_tx, list);
+}
+
+static void action_tx_next(void *eloop_ctx, void *timeout_ctx)
+{
+	struct action_handle *act = eloop_ctx;
+	struct wpa_supplicant *wpa_s = act->wpa_s;
+	struct action_tx *t;
+
+	while (act->tx_cur == NULL && !dl_list_empty(&act->tx_queue)){
+		t = action_tx_pick(act);
+		dl_list_del(&t->list);
+		act->tx_len--;
+
+		if (t->freq != act->dwell_freq){
+			act->dwell_freq = t->freq;
+			os_get_reltime(&act->dwell_start);
+		}
+
+		act->tx_cur = t;
+		if (offchannel_send_action(wpa_s, t->freq, t->dst,
+					   wpa_s->own_addr, t->dst,
+					   wpabuf_head(t->buf),
+					   wpabuf_len(t->buf), ACTION_DWELL_MS,
+					   action_tx_status, 0) < 0){
+			wpa_printf(MSG_DEBUG, "Could not send a hyperlocal frame to " MACSTR,
+				   MAC2STR(t->dst));
+			act->tx_cur = NULL;
+			action_tx_free(t);
+			continue;
+		}
+		/* The TX status may already have come */
+		if (act->tx_cur)
+			eloop_register_timeout(0, ACTION_TX_TIMEOUT_MS * 1000,
+					       action_tx_timeout, act, NULL);
+	}
+
+	if (act->tx_cur == NULL)
+		act->dwell_freq = 0;
+}
+
+/* Queue the public action frame buf for dst at freq, buf is taken over */
+static int action_tx(struct wpa_supplicant *wpa_s, int freq, const u8 *dst,
+		     struct wpabuf *buf)
+{
+	struct action_handle *act = wpa_s->act;
+	struct action_tx *t;
+
+	if (act == NULL || act->tx_len >= ACTION_TX_QUEUE_MAX){
+		wpabuf_free(buf);
+		return -1;
+	}
+
+	t = os_zalloc(sizeof(*t));
+	if (t == NULL){
+		wpabuf_free(buf);
+		return -1;
+	}
+	os_memcpy(t->dst, dst, ETH_ALEN);
+	t->freq = freq;
+	t->buf = buf;
+	dl_list_add_tail(&act->tx_queue, &t->list);
+	act->tx_len++;
+
+	if (act->tx_cur == NULL){
+		eloop_cancel_timeout(action_tx_next, act, NULL);
+		eloop_register_timeout(0, 0, action_tx_next, act, NULL);
+	}
+
+	return 0;
+}
+
+/*
+ * Send the hyperlocal query or answer payload to addr, id is the query id or
+ * for an answer (flags WLAN_PA_HYPERLOCAL_QUERY_F_ANSWER) the message id
+ */
+static int action_query_send(struct wpa_supplicant *wpa_s, const u8 *addr,
+			     int freq, u32 id, const u8 *payload, size_t paylen,
+			     u16 flags)
+{
 	struct wpabuf *buf;
 
-	buf = wpabuf_alloc(AFN_BUF_MAX_LEN+5);
+	if (paylen > AFN_BUF_MAX_LEN){
+		wpa_printf(MSG_ERROR, "Hyperlocal query of %zu bytes is too long", paylen);
+		return -1;
+	}
+
+	buf = wpabuf_alloc(paylen + 12);
 	if (buf == NULL){
 		return -1;
 	}
@@ -141,35 +707,291 @@ static int action_hyperlocal_query_dispatcher(struct wpa_supplicant *wpa_s, stru
 	wpabuf_put_u8(buf, 255);
 /*NEWANDROID*/
 	wpabuf_put_u8(buf, WLAN_PA_HYPERLOCAL_QUERY);
-	//wpabuf_put_u8(buf, WLAN_PA_WAIT_RESP);
-	wpabuf_put_le32(buf, 3);
+	wpabuf_put_le32(buf, id);
 	wpabuf_put_le16(buf, paylen);
 	wpabuf_put_data(buf, payload, paylen);
-	wpabuf_put_le16(buf, 0);
+	wpabuf_put_le16(buf, flags);
 
-	printf("payload len: %d\n",paylen);
+	wpa_printf(MSG_DEBUG, "Sending query %u of %zu bytes to " MACSTR " at %d MHz",
+		   id, paylen, MAC2STR(addr), freq);
 
-	wpa_hexdump(MSG_DEBUG, "CPA: hexdump ", buf->buf, buf->used);
+	return action_tx(wpa_s, freq, addr, buf);
+}
+
+static void action_query_free(struct action_query *q)
+{
+	eloop_cancel_timeout(action_query_timeout, q->act, q);
+	dl_list_del(&q->list);
+	q->act->num_queries--;
+	os_free(q->payload);
+	os_free(q);
+}
 
-	res =  offchannel_send_action(wpa_s, not->freq, dst, src, bssid, wpabuf_head(buf),  wpabuf_len(buf), 0, NULL, 0);
-	wpa_printf(MSG_DEBUG, "  offchannel_send_action res = %d", res);
-	//offchannel_send_action_done(wpa_s); //Mallesh: there is a bug here. This is being called before the send action. 
+/* Tell the app that its query qid failed, or that the query group g is done */
+static void action_query_report(struct action_handle *act,
+				struct sockaddr_un *to, socklen_t tolen,
+				struct action_qgroup *g, u32 qid)
+{
+	struct action_ctrl_dst *dst;
+	char buf[64];
+	int len;
+	u8 *ev;
 
-	os_free(buf);
-	delete_pending_action(not);
+	if (act->sock < 0)
+		return;
 
-	return 0;
+	dst = action_dst_find(act, to, tolen);
+	if (dst && dst->binary){
+		if (g){
+			ev = action_event_put(act, dst, HL_EV_QDONE,
+					      HL_EV_QDONE_LEN);
+			if (ev){
+				WPA_PUT_LE32(ev, g->qid);
+				WPA_PUT_LE16(ev + 4, g->answered);
+				WPA_PUT_LE16(ev + 6, g->failed);
+			}
+		}else{
+			ev = action_event_put(act, dst, HL_EV_QFAIL,
+					      HL_EV_QFAIL_LEN);
+			if (ev)
+				WPA_PUT_LE32(ev, qid);
+		}
+		return;
+	}
+
+	if (g)
+		len = os_snprintf(buf, sizeof(buf),
+				  "QDONE:QID:%u-Answered:%u-Failed:%u",
+				  g->qid, g->answered, g->failed);
+	else
+		len = os_snprintf(buf, sizeof(buf), "QFAIL:QID:%u", qid);
+
+	if (!os_snprintf_error(sizeof(buf), len))
+		sendto(act->sock, buf, len, 0, (struct sockaddr *) to, tolen);
+}
+
+/* q got its answer (answered) or was given up, tell the app when it waits */
+static void action_query_done(struct action_query *q, int answered)
+{
+	struct action_qgroup *g = q->group;
+
+	if (g){
+		if (answered)
+			g->answered++;
+		else
+			g->failed++;
+		if (--g->pending == 0){
+			action_query_report(q->act, &g->from, g->fromlen, g, 0);
+			dl_list_del(&g->list);
+			os_free(g);
+		}
+	}else if (!answered){
+		action_query_report(q->act, &q->from, q->fromlen, NULL, q->qid);
+	}
+
+	action_query_free(q);
+}
+
+static struct action_query *action_query_get(struct action_handle *act,
+					     const u8 *addr, u32 qid)
+{
+	struct action_query *q;
+
+	dl_list_for_each(q, &act->queries, struct action_query, list) {
+		if (q->qid == qid && os_memcmp(q->addr, addr, ETH_ALEN) == 0)
+			return q;
+	}
+	return NULL;
+}
+
+static void action_query_timeout(void *eloop_ctx, void *timeout_ctx)
+{
+	struct action_handle *act = eloop_ctx;
+	struct action_query *q = timeout_ctx;
+
+	if (!q->taken && q->retries++ < ACTION_QUERY_RETRIES){
+		wpa_printf(MSG_DEBUG, "Query %u not taken by " MACSTR ", resending",
+			   q->qid, MAC2STR(q->addr));
+		action_query_send(act->wpa_s, q->addr, q->freq, q->qid,
+				  q->payload, q->len, 0);
+		eloop_register_timeout(0, ACTION_QUERY_TIMEOUT_MS * 1000,
+				       action_query_timeout, act, q);
+		return;
+	}
+
+	wpa_printf(MSG_DEBUG, "Query %u to " MACSTR " not answered",
+		   q->qid, MAC2STR(q->addr));
+	action_query_done(q, 0);
+}
+
+static u32 action_qid_next(struct action_handle *act)
+{
+	if (++act->next_qid == 0)
+		act->next_qid++;
+	return act->next_qid;
+}
+
+/* Send the query qid for the app at from to the AP of bss */
+static struct action_query *action_query_add(struct wpa_supplicant *wpa_s,
+					     struct action_handle *act,
+					     struct wpa_bss *bss, u32 qid,
+					     const char *payload, size_t len,
+					     struct sockaddr_un *from,
+					     socklen_t fromlen)
+{
+	struct action_query *q;
+	const u8 *addr = bss->bssid;
+	unsigned int per_ap = 0;
+
+	dl_list_for_each(q, &act->queries, struct action_query, list) {
+		if (os_memcmp(q->addr, addr, ETH_ALEN) == 0)
+			per_ap++;
+	}
+	if (act->num_queries >= ACTION_QUERY_MAX ||
+	    per_ap >= ACTION_QUERY_PER_AP){
+		wpa_printf(MSG_DEBUG, "Too many queries in flight to " MACSTR,
+			   MAC2STR(addr));
+		return NULL;
+	}
+
+	q = os_zalloc(sizeof(*q));
+	if (q == NULL)
+		return NULL;
+	q->payload = os_malloc(len);
+	if (q->payload == NULL){
+		os_free(q);
+		return NULL;
+	}
+	os_memcpy(q->payload, payload, len);
+	q->len = len;
+	q->act = act;
+	os_memcpy(q->addr, addr, ETH_ALEN);
+	q->freq = bss->freq;
+	os_memcpy(&q->from, from, sizeof(*from));
+	q->fromlen = fromlen;
+	q->qid = qid;
+
+	if (action_query_send(wpa_s, addr, q->freq, q->qid, q->payload, len,
+			      0)){
+		os_free(q->payload);
+		os_free(q);
+		return NULL;
+	}
+
+	dl_list_add_tail(&act->queries, &q->list);
+	act->num_queries++;
+	eloop_register_timeout(0, ACTION_QUERY_TIMEOUT_MS * 1000,
+			       action_query_timeout, act, q);
+
+	return q;
 }
 
+/*
+ * Send a new query for the app at from to the AP addr. Returns the query id
+ * or 0 on failure.
+ */
+static u32 action_query_start(struct wpa_supplicant *wpa_s,
+			      struct action_handle *act, const u8 *addr,
+			      const char *payload, size_t len,
+			      struct sockaddr_un *from, socklen_t fromlen)
+{
+	struct wpa_bss *bss;
+	u32 qid;
+
+	bss = wpa_bss_get_bssid_latest(wpa_s, addr);
+	if (bss == NULL){
+		wpa_printf(MSG_DEBUG, "No BSS " MACSTR " to query", MAC2STR(addr));
+		return 0;
+	}
+
+	qid = action_qid_next(act);
+	if (action_query_add(wpa_s, act, bss, qid, payload, len, from,
+			     fromlen) == NULL)
+		return 0;
+
+	return qid;
+}
+
+/*
+ * Send the query to every AP that advertises the notification indicator.
+ * The queries are queued in one go, so action_tx_next() sends them channel
+ * by channel. Returns the query id or 0 if no AP could be asked.
+ */
+static u32 action_query_fanout(struct wpa_supplicant *wpa_s,
+			       struct action_handle *act,
+			       const char *payload, size_t len,
+			       struct sockaddr_un *from, socklen_t fromlen,
+			       unsigned int *num)
+{
+	struct action_qgroup *g;
+	struct action_query *q;
+	struct wpa_bss *bss;
+
+	g = os_zalloc(sizeof(*g));
+	if (g == NULL)
+		return 0;
+	g->qid = action_qid_next(act);
+	os_memcpy(&g->from, from, sizeof(*from));
+	g->fromlen = fromlen;
+
+	dl_list_for_each(bss, &wpa_s->bss, struct wpa_bss, list) {
+		if (wpa_bss_get_ie(bss, WLAN_EID_NOT_INDICATOR) == NULL)
+			continue;
+		q = action_query_add(wpa_s, act, bss, g->qid, payload, len,
+				     from, fromlen);
+		if (q == NULL)
+			continue;
+		q->group = g;
+		g->pending++;
+	}
+
+	*num = g->pending;
+	if (g->pending == 0){
+		wpa_printf(MSG_DEBUG, "No AP to send the query to");
+		os_free(g);
+		return 0;
+	}
+	dl_list_add(&act->qgroups, &g->list);
+
+	wpa_printf(MSG_DEBUG, "Query %u sent to %u APs", g->qid, g->pending);
+	return g->qid;
+}
+
+/*
+ * The AP tells when to fetch the answer of the query qid. A time to fetch
+ * request without a query id is about pushed messages and takes no query.
+ */
+static void action_query_taken(struct action_handle *act, const u8 *addr,
+			       u32 qid)
+{
+	struct action_query *q;
+
+	dl_list_for_each(q, &act->queries, struct action_query, list) {
+		if (q->taken || q->qid != qid ||
+		    os_memcmp(q->addr, addr, ETH_ALEN) != 0)
+			continue;
+		q->taken = 1;
+		eloop_cancel_timeout(action_query_timeout, act, q);
+		eloop_register_timeout(ACTION_QUERY_ANSWER_TIMEOUT, 0,
+				       action_query_timeout, act, q);
+		return;
+	}
+}
+
+/*
+ * ACTION <addr> <mid> <payload> answers the WAIT_RESP message mid from addr,
+ * or sends payload to addr as a new query if there is no such message
+ */
 static int wpa_s_not_iface_process(struct wpa_supplicant *wpa_s, struct action_handle *act,
-							const char *buf) 
+							const char *buf, struct sockaddr_un *from,
+							socklen_t fromlen)
 {
 	u8 addr[ETH_ALEN];
 	int addr_len;
 	u32 mid;
 	const char *pos;
 
-	struct action_pending *pending;
+	struct action_seen *pending;
 
 	if(buf == NULL){
 		return -1;
@@ -203,21 +1025,106 @@ static int wpa_s_not_iface_process(struct wpa_supplicant *wpa_s, struct action_h
 		return -1;
 	}
 
-	pending = getPending(act, addr,  mid);
+	pending = action_seen_get(act, addr,  mid);
+
+	if(pending == NULL || !pending->pending){
+		wpa_printf(MSG_DEBUG, "No message %u from " MACSTR " to answer, sending a query",
+			   mid, MAC2STR(addr));
+		return action_query_start(wpa_s, act, addr, pos, os_strlen(pos),
+					  from, fromlen) ? 0 : -1;
+	}
+
+	if(action_query_send(wpa_s, addr, pending->freq, mid, (const u8 *) pos,
+			     os_strlen(pos), WLAN_PA_HYPERLOCAL_QUERY_F_ANSWER))
+		return -1;
+	pending->pending = 0;
+
+	return 0;
+}
+
+/*
+ * QUERY <bssid|*> <payload>, replies with the query id the answers will
+ * carry and, for *, the number of APs asked
+ */
+static int action_query_cmd(struct wpa_supplicant *wpa_s,
+			    struct action_handle *act, const char *buf,
+			    struct sockaddr_un *from, socklen_t fromlen,
+			    char *reply, size_t reply_size)
+{
+	u8 addr[ETH_ALEN];
+	int addr_len, res;
+	unsigned int num;
+	u32 qid;
+
+	if (buf[0] == '*' && buf[1] == ' ' && buf[2] != '\0'){
+		qid = action_query_fanout(wpa_s, act, buf + 2,
+					  os_strlen(buf + 2), from, fromlen,
+					  &num);
+		if (qid == 0)
+			return -1;
+		res = os_snprintf(reply, reply_size, "QID %u %u\n", qid, num);
+		if (os_snprintf_error(reply_size, res))
+			return -1;
+		return res;
+	}
+
+	addr_len = hwaddr_aton2(buf, addr);
+	if (addr_len < 0 || buf[addr_len] != ' ' || buf[addr_len + 1] == '\0')
+		return -1;
+	buf += addr_len + 1;
+
+	qid = action_query_start(wpa_s, act, addr, buf, os_strlen(buf), from,
+				 fromlen);
+	if (qid == 0)
+		return -1;
+
+	res = os_snprintf(reply, reply_size, "QID %u\n", qid);
+	if (os_snprintf_error(reply_size, res))
+		return -1;
+	return res;
+}
+
+/* SUBSCRIBE|UNSUBSCRIBE <bssid> <topic>, join or leave a topic at an AP */
+static int action_subscribe(struct wpa_supplicant *wpa_s, const char *buf,
+			    int join)
+{
+	u8 addr[ETH_ALEN];
+	struct wpa_bss *bss;
+	struct wpabuf *req;
+	int addr_len, topic;
+
+	addr_len = hwaddr_aton2(buf, addr);
+	if (addr_len < 0 || buf[addr_len] != ' ')
+		return -1;
+
+	topic = atoi(buf + addr_len + 1);
+	if (topic < 0 || topic > 0xffff)
+		return -1;
 
-	if(pending == NULL){
-		printf("no end not\n");
-		struct action_pending *not;
-		not = os_malloc(sizeof(struct action_pending));
-		os_memcpy(not->addr, addr, ETH_ALEN);
-		not->mid = mid;
-		not->freq = 2442;
-		dl_list_add(&act->pending, &not->list);
-		pending = not;
-		//return -1;
+	bss = wpa_bss_get_bssid(wpa_s, addr);
+	if (bss == NULL){
+		wpa_printf(MSG_DEBUG, "No BSS " MACSTR " to subscribe at", MAC2STR(addr));
+		return -1;
 	}
 
-	return action_hyperlocal_query_dispatcher(wpa_s, pending, pos, os_strlen(pos));
+	req = wpabuf_alloc(8);
+	if (req == NULL)
+		return -1;
+
+	wpabuf_put_u8(req, WLAN_ACTION_PUBLIC);
+/*NEWANDROID*/
+	wpabuf_put_u8(req, WLAN_PA_GAS_INITIAL_REQ);
+	wpabuf_put_u8(req, 255);
+/*NEWANDROID*/
+	wpabuf_put_u8(req, WLAN_PA_HYPERLOCAL_SUBSCRIBE);
+	wpabuf_put_u8(req, join);
+	wpabuf_put_u8(req, 1);
+	wpabuf_put_le16(req, topic);
+
+	wpa_printf(MSG_DEBUG, "%s topic %d at " MACSTR,
+		   join ? "Joining" : "Leaving", topic, MAC2STR(addr));
+
+	return action_tx(wpa_s, bss->freq, addr, req);
 }
 
 static void wpa_s_not_iface_recv(int sock, void *eloop_ctx, void *sock_ctx){
@@ -227,7 +1134,7 @@ static void wpa_s_not_iface_recv(int sock, void *eloop_ctx, void *sock_ctx){
 	int res;
 	struct sockaddr_un from;
 	socklen_t fromlen = sizeof(from);
-	char *reply = NULL;//, *reply_buf = NULL;
+	char reply[32];
 	int reply_len = 0;
 
 	wpa_printf(MSG_DEBUG, "Message received from the notification unit");
@@ -243,14 +1150,12 @@ static void wpa_s_not_iface_recv(int sock, void *eloop_ctx, void *sock_ctx){
 	}
 	buf[res] = '\0';
 
-	reply = os_malloc(5);
-
 	os_memcpy(reply, "OK\n", 3);
 	reply_len = 3;
 
-	if(os_strcmp(buf, "ATTACH") == 0){
+	if(os_strcmp(buf, "ATTACH") == 0 || os_strncmp(buf, "ATTACH ", 7) == 0){
 		wpa_printf(MSG_DEBUG, "Attach request received");
-		if(start_not_connection(act, &from, fromlen)){
+		if(start_not_connection(act, &from, fromlen, buf[6] ? buf + 7 : "")){
 			reply_len = -1;
 		}
 	}else if(os_strcmp(buf , "DETACH") == 0){
@@ -260,9 +1165,18 @@ static void wpa_s_not_iface_recv(int sock, void *eloop_ctx, void *sock_ctx){
 		}
 	} else if(os_strncmp(buf, "ACTION ", 7) == 0){
 		wpa_printf(MSG_DEBUG, "Action request received with %s", buf+7);
-		if(wpa_s_not_iface_process(wpa_s, act, buf+7)){
+		if(wpa_s_not_iface_process(wpa_s, act, buf+7, &from, fromlen)){
 			reply_len = -1;
 		}
+	}else if (os_strncmp(buf, "QUERY ", 6) == 0){
+		reply_len = action_query_cmd(wpa_s, act, buf + 6, &from,
+					     fromlen, reply, sizeof(reply));
+	}else if (os_strncmp(buf, "SUBSCRIBE ", 10) == 0){
+		if (action_subscribe(wpa_s, buf + 10, 1))
+			reply_len = -1;
+	}else if (os_strncmp(buf, "UNSUBSCRIBE ", 12) == 0){
+		if (action_subscribe(wpa_s, buf + 12, 0))
+			reply_len = -1;
 	}else if (os_strcmp(buf, "PING") == 0) {
 		os_memcpy(reply, "PONG\n", 5);
 		reply_len = 5;
@@ -277,11 +1191,27 @@ static void wpa_s_not_iface_recv(int sock, void *eloop_ctx, void *sock_ctx){
 	}
 
 	sendto(sock, reply, reply_len, 0, (struct sockaddr *) &from, fromlen);
-	os_free(reply);
 
 }
 
 
+/*
+ * The first interface keeps the well known socket name for existing handling
+ * units, the others use AFN_SOCKNAME-<ifname>
+ */
+static int wpas_not_primary_taken(struct wpa_supplicant *wpa_s)
+{
+	struct wpa_supplicant *iface;
+
+	for (iface = wpa_s->global->ifaces; iface; iface = iface->next){
+		if (iface != wpa_s && iface->act && iface->act->primary)
+			return 1;
+	}
+
+	return 0;
+}
+
+
 static int wpas_not_open_sock(struct wpa_supplicant *wpa_s, struct action_handle *act)
 {
 	struct sockaddr_un addr;
@@ -298,10 +1228,14 @@ static int wpas_not_open_sock(struct wpa_supplicant *wpa_s, struct action_handle
 		return 0;
 	}
 
+	act->primary = !wpas_not_primary_taken(wpa_s);
+
 #ifdef ANDROID
-	act->sock = android_get_control_socket(AFN_SOCKNAME);
-	if (act->sock >= 0)
-		goto havesock;
+	if (act->primary){
+		act->sock = android_get_control_socket(AFN_SOCKNAME);
+		if (act->sock >= 0)
+			goto havesock;
+	}
 #endif /*ANDROID*/
 
 	if (wpa_s->conf->ctrl_interface == NULL)
@@ -320,14 +1254,18 @@ static int wpas_not_open_sock(struct wpa_supplicant *wpa_s, struct action_handle
 	} else
 		dir = pbuf;
 
-	len = os_strlen(dir)+2+os_strlen(AFN_SOCKNAME);
+	len = os_strlen(dir)+3+os_strlen(AFN_SOCKNAME)+os_strlen(wpa_s->ifname);
 	buf = os_malloc(len);
 	if (buf == NULL) {
 		os_free(pbuf);
 		return -1;
 	}
 
-	res = os_snprintf(buf, len, "%s/%s", dir, AFN_SOCKNAME);
+	if (act->primary)
+		res = os_snprintf(buf, len, "%s/%s", dir, AFN_SOCKNAME);
+	else
+		res = os_snprintf(buf, len, "%s/%s-%s", dir, AFN_SOCKNAME,
+				  wpa_s->ifname);
 	if (res < 0 || (size_t) res >= len) {
 		os_free(pbuf);
 		os_free(buf);
@@ -379,7 +1317,7 @@ static int wpas_not_open_sock(struct wpa_supplicant *wpa_s, struct action_handle
 			goto fail;
 		}
 	}
-	os_free(buf);
+	act->sock_path = buf;
 	wpa_printf(MSG_DEBUG, "Socket binded");
 
 #ifdef ANDROID
@@ -396,142 +1334,437 @@ havesock:
 		}
 	}
 
-	eloop_register_read_sock(act->sock, wpa_s_not_iface_recv,
-				 wpa_s, act);
+	eloop_register_read_sock(act->sock, wpa_s_not_iface_recv,
+				 wpa_s, act);
+
+	return 0;
+
+fail:
+	if(act->sock >= 0){
+		close(act->sock);
+		act->sock = -1;
+	}
+
+	if(buf){
+		unlink(buf);
+		os_free(buf);
+	}
+	return -1;
+}
+
+int action_init(struct wpa_supplicant *wpa_s) {
+	struct action_handle *act;
+	int i;
+
+	wpa_printf(MSG_DEBUG, "initializing action listener for %s", wpa_s->ifname);
+#ifdef CONFIG_P2P
+	/* The P2P Device interface never associates */
+	if (wpa_s->p2p_mgmt) {
+		wpa_printf(MSG_DEBUG, "   -> P2P management interface, no action");
+		return 0;
+	}
+#endif /* CONFIG_P2P */
+
+	act = os_zalloc(sizeof(struct action_handle));
+
+	if (act == NULL)
+		return -1;
+
+	wpa_s->act = act;
+	act->wpa_s = wpa_s;
+	for (i = 0; i < ACTION_SEEN_BUCKETS; i++)
+		dl_list_init(&act->seen[i]);
+	dl_list_init(&act->seen_lru);
+	dl_list_init(&act->seen_age);
+	dl_list_init(&act->queries);
+	dl_list_init(&act->qgroups);
+	dl_list_init(&act->tx_queue);
+	dl_list_init(&act->reasm);
+	dl_list_init(&act->dst);
+	check = 0;
+
+	act->sock = -1;
+	wpa_printf(MSG_DEBUG, "initializing the socket");
+
+	/* E.g. no ctrl_interface, the interface works without the unit */
+	if (wpas_not_open_sock(wpa_s, act) < 0) {
+		wpa_printf(MSG_INFO, "%s: no notification socket, action notification disabled",
+			   wpa_s->ifname);
+		wpa_s->act = NULL;
+		os_free(act);
+		return 0;
+	}
+
+	return 0;
+}
+
+void action_notification_add_indication(struct wpabuf *buf, int pps_mo_id) {
+	/* This is called from scan.c while preparing probe requests. */
+
+	wpa_printf(MSG_DEBUG, "Adding notification indicator to the probe request");
+
+	wpabuf_put_u8(buf, WLAN_EID_NOT_INDICATOR);
+	//wpabuf_put_u8(buf, 0);
+	wpabuf_put_u8(buf, 2);
+	wpabuf_put_le16(buf, check);
+
+}
+
+static void action_reltime_add_ms(struct os_reltime *t, unsigned int ms)
+{
+	t->sec += ms / 1000;
+	t->usec += (ms % 1000) * 1000;
+	if (t->usec >= 1000000){
+		t->sec++;
+		t->usec -= 1000000;
+	}
+}
+
+/*
+ * The fetch state of bssid. A new AP takes a slot without a fetch due if it
+ * can, the oldest slots are reused first.
+ */
+static struct action_ind *action_ind_get(struct action_handle *act,
+					 const u8 *bssid)
+{
+	struct action_ind *ind;
+	unsigned int i;
+
+	for (i = 0; i < act->num_ind; i++){
+		if (os_memcmp(act->ind[i].bssid, bssid, ETH_ALEN) == 0)
+			return &act->ind[i];
+	}
+
+	if (act->num_ind < ACTION_IND_MAX){
+		ind = &act->ind[act->num_ind++];
+	}else{
+		for (i = 0; i < ACTION_IND_MAX - 1; i++){
+			if (!act->ind[act->next_ind].fetch)
+				break;
+			act->next_ind = (act->next_ind + 1) % ACTION_IND_MAX;
+		}
+		ind = &act->ind[act->next_ind];
+		act->next_ind = (act->next_ind + 1) % ACTION_IND_MAX;
+	}
+
+	os_memset(ind, 0, sizeof(*ind));
+	os_memcpy(ind->bssid, bssid, ETH_ALEN);
+	return ind;
+}
 
-	return 0;
+/* Program the timer for the next batch of fetches */
+static void action_fetch_arm(struct action_handle *act)
+{
+	struct os_reltime first, limit, fire, now, delay;
+	unsigned int i;
+	int found = 0;
+
+	os_memset(&first, 0, sizeof(first));
+	for (i = 0; i < act->num_ind; i++){
+		if (!act->ind[i].fetch)
+			continue;
+		if (!found || os_reltime_before(&act->ind[i].due, &first))
+			first = act->ind[i].due;
+		found = 1;
+	}
 
-fail:
-	if(act->sock >= 0){
-		close(act->sock);
-		act->sock = -1;
+	eloop_cancel_timeout(action_fetch_timeout, act, NULL);
+	if (!found)
+		return;
+
+	/* Wait for the last fetch due within the slack, none goes early */
+	limit = first;
+	action_reltime_add_ms(&limit, ACTION_FETCH_SLACK_MS);
+	fire = first;
+	for (i = 0; i < act->num_ind; i++){
+		if (act->ind[i].fetch &&
+		    !os_reltime_before(&limit, &act->ind[i].due) &&
+		    os_reltime_before(&fire, &act->ind[i].due))
+			fire = act->ind[i].due;
 	}
 
-	if(buf){
-		unlink(buf);
-		os_free(buf);
+	os_get_reltime(&now);
+	if (os_reltime_before(&fire, &now)){
+		delay.sec = 0;
+		delay.usec = 0;
+	}else{
+		os_reltime_sub(&fire, &now, &delay);
 	}
-	return -1;
+	eloop_register_timeout(delay.sec, delay.usec, action_fetch_timeout, act,
+			       NULL);
 }
 
-int action_init(struct wpa_supplicant *wpa_s) {
-	struct action_handle *act;
+static void action_fetch_timeout(void *eloop_ctx, void *timeout_ctx)
+{
+	struct action_handle *act = eloop_ctx;
+	struct action_ind *ind;
+	struct os_reltime now;
+	int announce = 0;
+	unsigned int i;
+
+	os_get_reltime(&now);
+	for (i = 0; i < act->num_ind; i++){
+		ind = &act->ind[i];
+		if (!ind->fetch || os_reltime_before(&now, &ind->due))
+			continue;
+
+		wpa_printf(MSG_DEBUG, "Fetching from " MACSTR " at %d MHz",
+			   MAC2STR(ind->bssid), ind->freq);
+		action_notification_req_dispatcher(act->wpa_s, ind->bssid,
+						   ind->freq);
+		ind->bcast_sent = ind->bcast_want;
+		announce |= ind->announce;
+		ind->fetch = 0;
+		ind->announce = 0;
+		ind->last = now;
+		ind->have_last = 1;
+	}
 
-	wpa_printf(MSG_DEBUG, "initializing action listener for %s", wpa_s->ifname);
-	/* This is a quick hack. We want to enable this only for the primary wlan interface.
-	 By default on an Android device with wpa_supplicant compiled with eg. P2P enabled
-	 a virtual p2p0 interface is generated. */
+	if (announce)
+		wpa_action_notify_presence(act->wpa_s, 1);
 
-	if (memcmp(wpa_s->ifname, "wlan1", 5)) {
-		wpa_printf(MSG_ERROR, "   -> not wlan1, no action");
-		return 0;
+	action_fetch_arm(act);
+}
+
+/*
+ * Fetch from bssid in tout ms, but not sooner than the minimum interval
+ * after the last fetch from it. A fetch already due earlier stays as it is
+ * and serves this trigger too. A trigger from a scan waits for
+ * action_scan_done() to join the batch of the scan.
+ */
+static void action_fetch_schedule(struct action_handle *act, const u8 *bssid,
+				  int freq, unsigned int tout, int announce,
+				  int scan)
+{
+	struct action_ind *ind;
+	struct os_reltime due, min;
+
+	ind = action_ind_get(act, bssid);
+	ind->freq = freq;
+	ind->announce |= announce;
+
+	os_get_reltime(&due);
+	action_reltime_add_ms(&due, tout);
+	if (ind->have_last){
+		min = ind->last;
+		action_reltime_add_ms(&min, ACTION_FETCH_MIN_INTERVAL_MS);
+		if (os_reltime_before(&due, &min))
+			due = min;
 	}
 
-	act = os_zalloc(sizeof(struct action_handle));
+	if (ind->fetch && !os_reltime_before(&due, &ind->due)){
+		wpa_printf(MSG_DEBUG, "Fetch from " MACSTR " already scheduled",
+			   MAC2STR(bssid));
+		return;
+	}
 
-	if (act == NULL)
-		return -1;
+	ind->due = due;
+	ind->fetch = 1;
+	ind->scan = scan;
+	if (!scan)
+		action_fetch_arm(act);
+}
 
-	wpa_s->act = act;
-	act->wpa_s = wpa_s;
-	dl_list_init(&act->pending);
-	check = 0;
+/*
+ * Notification indicator ie of bssid seen in a scan. The fetch is scheduled
+ * if the AP advertises anything we have not fetched yet; an AP that sends
+ * only the fetch timeout is fetched from when it is first seen.
+ */
+void action_ind_scan(struct wpa_supplicant *wpa_s, const u8 *bssid, int freq,
+		     const u8 *ie, int new_bss)
+{
+	struct action_handle *act = wpa_s->act;
+	struct action_ind *ind;
+	u32 bcast_mid;
+	int directed;
 
-	act->sock = -1;
-	wpa_printf(MSG_DEBUG, "initializing the socket");
+	if (act == NULL || ie[1] < HL_IND_BASE_LEN)
+		return;
 
-	if (wpas_not_open_sock(wpa_s, act) < 0) {
-		os_free(act);
-		return -1;
+	if (ie[1] < HL_IND_LEN){
+		if (new_bss)
+			action_fetch_schedule(act, bssid, freq,
+					      WPA_GET_LE16(ie + 2), 1, 1);
+		return;
 	}
 
-	return 0;
+	bcast_mid = WPA_GET_LE32(ie + 2 + HL_IND_BCAST_MID);
+	directed = hl_ind_filter_match(WPA_GET_LE64(ie + 2 + HL_IND_DST_FILTER),
+				       wpa_s->own_addr);
+
+	ind = action_ind_get(act, bssid);
+	/* Unless the AP acked the fetch, the next scan tries again */
+	ind->bcast_want = bcast_mid;
+	if (!directed && bcast_mid == ind->bcast_mid){
+		wpa_printf(MSG_DEBUG, "Nothing new from " MACSTR ", not fetching",
+			   MAC2STR(bssid));
+		return;
+	}
+
+	action_fetch_schedule(act, bssid, freq, WPA_GET_LE16(ie + 2), 1, 1);
 }
 
-void action_notification_add_indication(struct wpabuf *buf, int pps_mo_id) {
-	/* This is called from scan.c while preparing probe requests. */
+/* The AP bssid acked a fetch, it has sent what it advertised then */
+static void action_ind_fetched(struct action_handle *act, const u8 *bssid)
+{
+	unsigned int i;
 
-	wpa_printf(MSG_DEBUG, "Adding notification indicator to the probe request");
+	for (i = 0; i < act->num_ind; i++){
+		if (os_memcmp(act->ind[i].bssid, bssid, ETH_ALEN) == 0){
+			act->ind[i].bcast_mid = act->ind[i].bcast_sent;
+			return;
+		}
+	}
+}
 
-	wpabuf_put_u8(buf, WLAN_EID_NOT_INDICATOR);
-	//wpabuf_put_u8(buf, 0);
-	wpabuf_put_u8(buf, 2);
-	wpabuf_put_le16(buf, check);
+/*
+ * The scan results are processed. The fetches they triggered are due when
+ * the last of them is, none goes before the timeout of its AP.
+ */
+void action_scan_done(struct wpa_supplicant *wpa_s)
+{
+	struct action_handle *act = wpa_s->act;
+	struct os_reltime last;
+	unsigned int i, num = 0;
+
+	if (act == NULL)
+		return;
+
+	os_memset(&last, 0, sizeof(last));
+	for (i = 0; i < act->num_ind; i++){
+		if (!act->ind[i].scan)
+			continue;
+		if (num++ == 0 || os_reltime_before(&last, &act->ind[i].due))
+			last = act->ind[i].due;
+	}
+	if (num == 0)
+		return;
 
+	for (i = 0; i < act->num_ind; i++){
+		if (!act->ind[i].scan)
+			continue;
+		act->ind[i].due = last;
+		act->ind[i].scan = 0;
+	}
+	wpa_printf(MSG_DEBUG, "%u fetches after the scan", num);
+	action_fetch_arm(act);
 }
 
 void wpa_action_notify_presence(struct wpa_supplicant *wpa_s, int type){
 	struct action_handle *act = wpa_s->act;
-	struct action_ctrl_dst *dst;
-	struct msghdr msg;
+	struct action_ctrl_dst *dst, *tmp;
 	struct iovec io[2];
-
 	char buf[64];
-	int len;
-
 	char buf2[64];
-	int len2;
-
-	dst = act->dst;
+	int len = 0, len2;
+	u16 id;
+	u8 *ev;
 
-	if(act->sock < 0 || dst == NULL)
+	if(act->sock < 0 || dl_list_empty(&act->dst))
 		return;
 
-	len = os_snprintf(buf, 63, "ANNOUNCE %d", type);
-	io[0].iov_base = buf;
-	io[0].iov_len = len;
+	id = check++;
 
-	len2 = os_snprintf(buf2, 63, "id: %u", check++);
-	io[1].iov_base = buf2;
-	io[1].iov_len = len2;
+	dl_list_for_each_safe(dst, tmp, &act->dst, struct action_ctrl_dst, list){
+		if (!(dst->events & ACTION_EV_ANNOUNCE))
+			continue;
 
-	os_memset(&msg, 0, sizeof(msg));
-	//msg.msg_iov = &io;
-	msg.msg_iov = io;
-	msg.msg_iovlen = 2;
-	msg.msg_name = &dst->addr;
-	msg.msg_namelen = dst->addrlen;
+		if (dst->binary){
+			ev = action_event_put(act, dst, HL_EV_ANNOUNCE,
+					      HL_EV_ANNOUNCE_LEN);
+			if (ev){
+				ev[0] = type;
+				WPA_PUT_LE16(ev + 1, id);
+			}
+			continue;
+		}
 
-	if (sendmsg(act->sock, &msg, 0) < 0){
-		int _errno = errno;
-		wpa_printf(MSG_ERROR, "NOTIFICATION IFACE error: %d - %s", errno, strerror(errno));
-		dst->errors++;
-		if (dst->errors > 10 || _errno == ENOENT){
-			stop_not_connection(act, &dst->addr, dst->addrlen);
+		if (len == 0){
+			len = os_snprintf(buf, 63, "ANNOUNCE %d", type);
+			io[0].iov_base = buf;
+			io[0].iov_len = len;
+
+			len2 = os_snprintf(buf2, 63, "id: %u", id);
+			io[1].iov_base = buf2;
+			io[1].iov_len = len2;
 		}
-	}else{
-		wpa_printf(MSG_DEBUG, "Notification sent upstream");
-		dst->errors = 0;
+		action_text_send(act, dst, io, 2);
 	}
 }
 
-static int send_notification_upstream(struct action_handle *act, u8 type, 
-						const u8 *sa, u32 mid, const u8 *pos, size_t slen)
+/* Put a message in the batch of dst, see hyperlocal_event.h */
+static int action_msg_event(struct action_handle *act,
+			    struct action_ctrl_dst *dst, u8 type, const u8 *sa,
+			    u32 mid, const u8 *pos, size_t slen, u16 num,
+			    struct action_query *q)
+{
+	u8 *ev;
+
+	ev = action_event_put(act, dst, HL_EV_MSG, HL_EV_MSG_LEN + slen);
+	if (ev == NULL)
+		return -1;
+
+	os_memcpy(ev, sa, ETH_ALEN);
+	ev[6] = type - WLAN_PA_NO_RESP;
+	WPA_PUT_LE32(ev + 7, mid);
+	WPA_PUT_LE32(ev + 11, q ? q->qid : 0);
+	WPA_PUT_LE16(ev + 15, num);
+	os_memcpy(ev + HL_EV_MSG_LEN, pos, slen);
+
+	return 0;
+}
+
+/*
+ * Hand a message to the attached handling units, or to the app that asked if
+ * it answers the query q. Binary units get it in their next batch, the text
+ * is formatted only when a unit still reads text.
+ */
+static int send_notification_upstream(struct action_handle *act, u8 type,
+						const u8 *sa, u32 mid, const u8 *pos, size_t slen,
+						u16 num, struct action_query *q)
 {
 	struct iovec io[4];
-	//int idx = 0 ;
 	struct msghdr msg;
 	int len1, len2;
-	struct action_ctrl_dst *dst;
-	int ret;
-
-	wpa_printf(MSG_DEBUG, "Sending received notification for handling");
+	struct action_ctrl_dst *dst, *tmp;
+	int text = 0, sent = 0;
 
 	char buf1[128];
 	char buf2[128];
 
 	char buf3[128];
 	int len3;
-	u16 num;
 
-	len1 = os_snprintf(buf1, 128, "NOT:Type:%u-", type - WLAN_PA_NO_RESP);
-	len2 = os_snprintf(buf2, 128, "Addr:" MACSTR "-MID:%u-", MAC2STR(sa), mid);
+	if(act->sock < 0)
+		return -1;
 
-	wpa_printf(MSG_DEBUG, "The message is %s %s %s", buf1, buf2, (char *)pos);
+	wpa_printf(MSG_DEBUG, "Sending message %u from " MACSTR " (%zu bytes) for handling",
+		   mid, MAC2STR(sa), slen);
 
-	dst = act->dst;
-	if(act->sock < 0 || dst == NULL)
-		return -1;
+	if (q){
+		dst = action_dst_find(act, &q->from, q->fromlen);
+		if (dst && dst->binary)
+			return action_msg_event(act, dst, type, sa, mid, pos,
+						slen, num, q);
+	}else{
+		dl_list_for_each(dst, &act->dst, struct action_ctrl_dst, list){
+			if (!(dst->events & ACTION_EV_MSG))
+				continue;
+			if (!dst->binary)
+				text = 1;
+			else if (action_msg_event(act, dst, type, sa, mid, pos,
+						  slen, num, NULL) == 0)
+				sent++;
+		}
+		if (!text)
+			return sent ? 0 : -1;
+	}
+
+	len1 = os_snprintf(buf1, 128, "NOT:Type:%u-", type - WLAN_PA_NO_RESP);
+	if (q)
+		len2 = os_snprintf(buf2, 128, "Addr:" MACSTR "-QID:%u-MID:%u-", MAC2STR(sa), q->qid, mid);
+	else
+		len2 = os_snprintf(buf2, 128, "Addr:" MACSTR "-MID:%u-", MAC2STR(sa), mid);
 
 	io[0].iov_base = buf1;
 	io[0].iov_len = len1;
@@ -542,35 +1775,73 @@ static int send_notification_upstream(struct action_handle *act, u8 type,
 	io[2].iov_base = (char *) pos;
 	io[2].iov_len = slen;
 
-	num = WPA_GET_LE16(pos+slen);
 	len3 = os_snprintf(buf3, 128, "CheckId:%u",num);
 	io[3].iov_base = buf3;
 	io[3].iov_len = len3;
 
-	os_memset(&msg, 0, sizeof(msg));
-	msg.msg_iov = io;
-	msg.msg_iovlen = 4;
-	msg.msg_name = &dst->addr;
-	msg.msg_namelen = dst->addrlen;
-
-	if (sendmsg(act->sock, &msg, 0) < 0){
-		int _errno = errno;
-		wpa_printf(MSG_ERROR, "NOTIFICATION IFACE error: %d - %s", errno, strerror(errno));
-		dst->errors++;
-		if (dst->errors > 10 || _errno == ENOENT){
-			stop_not_connection(act, &dst->addr, dst->addrlen);
+	if (q){
+		os_memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = io;
+		msg.msg_iovlen = 4;
+		msg.msg_name = &q->from;
+		msg.msg_namelen = q->fromlen;
+		if (sendmsg(act->sock, &msg, 0) < 0){
+			wpa_printf(MSG_ERROR, "NOTIFICATION IFACE error: %d - %s", errno, strerror(errno));
+			return -1;
 		}
-		ret = -1;
-	}else{
-		wpa_printf(MSG_DEBUG, "Notification sent upstream, called from deliver notification");
-		dst->errors = 0;
-		ret = 0;
+		return 0;
 	}
 
-	return ret;
+	dl_list_for_each_safe(dst, tmp, &act->dst, struct action_ctrl_dst, list){
+		if (dst->binary || !(dst->events & ACTION_EV_MSG))
+			continue;
+		if (action_text_send(act, dst, io, 4) == 0)
+			sent++;
+	}
+
+	return sent ? 0 : -1;
+}
+
+static int deliver_message(struct action_handle *act, const u8 *sa, u8 type,
+						   u32 mid, const u8 *pos, u16 slen, u16 num, int freq)
+{
+	struct action_query *q = NULL;
+
+	if(slen < 1)
+		return -1;
+
+	/*NOTIFICATION ALREADY RECEIVED*/
+	if(action_seen_get(act, sa, mid) != NULL){
+		wpa_printf(MSG_DEBUG, "This message from " MACSTR " with id %u is already received", MAC2STR(sa), mid);
+		return 0;
+	}
+
+	if(type == WLAN_PA_QUERY_RESP){
+		if(slen < 4)
+			return -1;
+		q = action_query_get(act, sa, WPA_GET_LE32(pos));
+		pos += 4;
+		slen -= 4;
+		/* A late or unknown answer still goes to the handling unit */
+		if(q == NULL && dl_list_empty(&act->dst))
+			return -1;
+	}
+
+	if(send_notification_upstream(act, type, sa, mid, pos, slen, num, q))
+		return -1;
+	if(q)
+		action_query_done(q, 1);
+
+	/* Not remembered unless delivered, so that a later fetch retries it */
+	if(action_seen_add(act, sa, mid, freq, type == WLAN_PA_WAIT_RESP) == NULL)
+		wpa_printf(MSG_DEBUG, "No memory to remember message %u", mid);
+
+	return 0;
+
 }
 
-static int deliver_notification(struct wpa_supplicant *wpa_s, struct action_handle *act, const u8 *sa, const u8 *payload, int freq)
+/* A single message: type (1), mid (4), len (2), payload, num (2) */
+static int deliver_notification(struct wpa_supplicant *wpa_s, struct action_handle *act, const u8 *sa, const u8 *payload, size_t len, int freq)
 {
 	if(act == NULL)
 		return -1;
@@ -582,74 +1853,238 @@ static int deliver_notification(struct wpa_supplicant *wpa_s, struct action_hand
 
 	wpa_printf(MSG_DEBUG, "Processing the received notification in freq: %d",freq);
 
+	if(len < 9)
+		return -1;
+
 	type = *pos++;
 
 	mid = WPA_GET_LE32(pos);
 	pos += 4;
 
 	slen = WPA_GET_LE16(pos);
+	pos += 2;
 
-	if(slen < 1)
+	if(slen > len - 9)
+		return -1;
+
+	return deliver_message(act, sa, type, mid, pos, slen,
+						   WPA_GET_LE16(pos + slen), freq);
+}
+
+/*
+ * Several messages in one frame: count (1), count * (type (1), mid (4),
+ * len (2), payload), num (2)
+ */
+static int deliver_aggregate(struct wpa_supplicant *wpa_s, struct action_handle *act, const u8 *sa, const u8 *payload, size_t len, int freq)
+{
+	const u8 *pos = payload;
+	const u8 *end;
+	u8 count, type;
+	u32 mid;
+	u16 slen, num;
+	int ret = 0;
+
+	if(act == NULL || len < 3)
+		return -1;
+
+	count = *pos++;
+	end = payload + len - 2;
+	num = WPA_GET_LE16(end);
+
+	wpa_printf(MSG_DEBUG, "Processing %u aggregated notifications in freq: %d", count, freq);
+
+	while(count--){
+		if(end - pos < 7)
+			return -1;
+
+		type = *pos++;
+		mid = WPA_GET_LE32(pos);
+		pos += 4;
+		slen = WPA_GET_LE16(pos);
+		pos += 2;
+
+		if(slen > end - pos)
+			return -1;
+
+		if(deliver_message(act, sa, type, mid, pos, slen, num, freq))
+			ret = -1;
+		pos += slen;
+	}
+
+	return ret;
+}
+
+static void action_reasm_free(struct action_reasm *r)
+{
+	eloop_cancel_timeout(action_reasm_timeout, r->act->wpa_s, r);
+	dl_list_del(&r->list);
+	r->act->num_reasm--;
+	os_free(r->buf);
+	os_free(r);
+}
+
+static struct action_reasm *action_reasm_get(struct action_handle *act, const u8 *addr, u32 mid)
+{
+	struct action_reasm *r;
+
+	dl_list_for_each(r, &act->reasm, struct action_reasm, list) {
+		if (r->mid == mid && os_memcmp(r->addr, addr, ETH_ALEN) == 0)
+			return r;
+	}
+	return NULL;
+}
+
+/* Ask the AP for the next fragment, this also resumes a stalled transfer */
+static int action_comeback_req(struct wpa_supplicant *wpa_s, struct action_reasm *r)
+{
+	struct wpabuf *buf;
+	int res;
+
+	buf = wpabuf_alloc(9);
+	if (buf == NULL)
+		return -1;
+
+	wpabuf_put_u8(buf, WLAN_ACTION_PUBLIC);
+/*NEWANDROID*/
+	wpabuf_put_u8(buf, WLAN_PA_GAS_INITIAL_REQ);
+	wpabuf_put_u8(buf, 255);
+/*NEWANDROID*/
+	wpabuf_put_u8(buf, WLAN_PA_HYPERLOCAL_COMEBACK_REQ);
+	wpabuf_put_le32(buf, r->mid);
+	wpabuf_put_u8(buf, r->next_frag);
+
+	wpa_printf(MSG_DEBUG, "Requesting fragment %u of message %u from " MACSTR,
+			   r->next_frag, r->mid, MAC2STR(r->addr));
+
+	res = action_tx(wpa_s, r->freq, r->addr, buf);
+
+	eloop_cancel_timeout(action_reasm_timeout, wpa_s, r);
+	eloop_register_timeout(0, ACTION_REASM_TIMEOUT_MS * 1000, action_reasm_timeout,
+						   wpa_s, r);
+	return res;
+}
+
+static void action_reasm_timeout(void *eloop_ctx, void *timeout_ctx)
+{
+	struct wpa_supplicant *wpa_s = eloop_ctx;
+	struct action_reasm *r = timeout_ctx;
+
+	if (r->retries++ >= ACTION_REASM_RETRIES) {
+		wpa_printf(MSG_DEBUG, "Giving up on message %u from " MACSTR " after %u of %u bytes",
+				   r->mid, MAC2STR(r->addr), r->received, r->total);
+		action_reasm_free(r);
+		return;
+	}
+
+	action_comeback_req(wpa_s, r);
+}
+
+/*
+ * A fragment: type (1), mid (4), total length (2), fragment id (1),
+ * fragment length (2), data, num (2)
+ */
+static int deliver_fragment(struct wpa_supplicant *wpa_s, struct action_handle *act, const u8 *sa, const u8 *payload, size_t len, int freq)
+{
+	struct action_reasm *r;
+	const u8 *pos = payload;
+	u8 type, frag_id, more;
+	u32 mid;
+	u16 total, flen;
+	int ret;
+
+	if(act == NULL || len < 12)
 		return -1;
 
+	type = *pos++;
+	mid = WPA_GET_LE32(pos);
+	pos += 4;
+	total = WPA_GET_LE16(pos);
 	pos += 2;
+	more = *pos & ACTION_FRAG_MORE;
+	frag_id = *pos++ & ~ACTION_FRAG_MORE;
+	flen = WPA_GET_LE16(pos);
+	pos += 2;
+
+	if(flen > len - 12)
+		return -1;
 
-	if(type == WLAN_PA_WAIT_RESP){
-		struct action_pending *not;
-		wpa_printf(MSG_DEBUG, "Notification requires an answer");
+	r = action_reasm_get(act, sa, mid);
+	if(r == NULL){
+		if(frag_id != 0 || total == 0)
+			return -1;
 
-		/*NOTIFICATION ALREADY RECEIVED*/
-		not = getPending(act, sa, mid);
-		if(not != NULL){
-			wpa_printf(MSG_DEBUG, "This message from " MACSTR " with id %u is already received", MAC2STR(sa), mid);
+		/* Do not fetch the rest of a message we already have */
+		if(action_seen_get(act, sa, mid) != NULL){
+			wpa_printf(MSG_DEBUG, "Message %u from " MACSTR " is already received", mid, MAC2STR(sa));
 			return 0;
 		}
 
-		wpa_printf(MSG_DEBUG, "Generating an entry for the notification");
+		if(act->num_reasm >= ACTION_REASM_MAX){
+			wpa_printf(MSG_DEBUG, "Too many messages in reassembly, dropping the oldest");
+			action_reasm_free(dl_list_first(&act->reasm, struct action_reasm, list));
+		}
 
-		not = os_malloc(sizeof(struct action_pending));
-		os_memcpy(not->addr, sa, ETH_ALEN);
-		not->mid = mid;
-		not->freq = freq;
-		dl_list_add(&act->pending, &not->list);
+		r = os_zalloc(sizeof(*r));
+		if(r == NULL)
+			return -1;
+		r->buf = os_malloc(total);
+		if(r->buf == NULL){
+			os_free(r);
+			return -1;
+		}
+		r->act = act;
+		os_memcpy(r->addr, sa, ETH_ALEN);
+		r->mid = mid;
+		r->type = type;
+		r->total = total;
+		dl_list_add_tail(&act->reasm, &r->list);
+		act->num_reasm++;
 	}
 
-	return send_notification_upstream(act, type, sa, mid, pos, slen);
+	r->freq = freq;
+	r->num = WPA_GET_LE16(pos + flen);
 
-}
+	if(frag_id != r->next_frag || total != r->total){
+		wpa_printf(MSG_DEBUG, "Unexpected fragment %u of message %u, waiting for %u",
+				   frag_id, mid, r->next_frag);
+		return 0;
+	}
 
-static void wpa_action_req_not_ind(void *eloop_ctx, void *timeout_ctx){
-	struct wpa_supplicant *wpa_s = eloop_ctx;
-	u8 *pos = timeout_ctx;
-	u8 addr[ETH_ALEN];
-	int freq;
+	if(flen > r->total - r->received || (!more && flen != r->total - r->received)){
+		wpa_printf(MSG_DEBUG, "Invalid fragment length for message %u", mid);
+		action_reasm_free(r);
+		return -1;
+	}
+
+	os_memcpy(r->buf + r->received, pos, flen);
+	r->received += flen;
+	r->next_frag++;
+	r->retries = 0;
 
-	os_memcpy(addr, pos, ETH_ALEN);
-	os_memcpy(&freq, pos + ETH_ALEN, sizeof(freq));
-	wpa_printf(MSG_DEBUG, "Sending AF to " MACSTR " at %d MHz", MAC2STR(addr), freq);
+	if(more)
+		return action_comeback_req(wpa_s, r) < 0 ? -1 : 0;
 
-	action_notification_req_dispatcher(wpa_s, addr, freq);
-	//wpa_action_notify_presence(wpa_s, 2);
-	os_free(pos);
+	wpa_printf(MSG_DEBUG, "Message %u from " MACSTR " reassembled (%u bytes)",
+			   mid, MAC2STR(sa), r->total);
+	ret = deliver_message(act, sa, r->type, mid, r->buf, r->total, r->num, freq);
+	action_reasm_free(r);
 
+	return ret;
 }
 
-static int schedule_req(struct wpa_supplicant *wpa_s, const u8 *sa, const u8 *payload, int freq)
+/* Time to fetch: timeout (2) and the query id (4) if it answers a query */
+static int schedule_req(struct wpa_supplicant *wpa_s, const u8 *sa, const u8 *payload, size_t len, int freq)
 {
 	u16 tout = WPA_GET_LE16(payload);
-	size_t mylen = sizeof(freq) + ETH_ALEN;
-	u8 *buf = os_malloc(mylen);
-	if(buf == NULL)
-		return -1;
 
-	wpa_printf(MSG_DEBUG, "Scheduling an action frame to signal to the AP that we are up");
-	wpa_printf(MSG_DEBUG, "The message will be sent in %u ms at freq %d", tout, freq);
+	if(wpa_s->act == NULL)
+		return -1;
 
-	os_memcpy(buf, sa, ETH_ALEN);
-	os_memcpy(buf + ETH_ALEN, &freq, sizeof(freq));
+	wpa_printf(MSG_DEBUG, "The AP asks us to fetch in %u ms at freq %d", tout, freq);
 
-	eloop_register_timeout(tout / 1000, 1000*(tout % 1000), wpa_action_req_not_ind,
-						wpa_s, buf);
+	if(len >= 6)
+		action_query_taken(wpa_s->act, sa, WPA_GET_LE32(payload + 2));
+	action_fetch_schedule(wpa_s->act, sa, freq, tout, 0, 0);
 
 	return 0;
 }
@@ -664,6 +2099,7 @@ int action_rx(struct wpa_supplicant *wpa_s, const u8 *da, const u8 *sa,
 	u8 stype;
 	int ret;  
 	const u8 *pos;
+	size_t rlen;
 
 	wpa_printf(MSG_DEBUG, "Action frame is received from " MACSTR, MAC2STR(sa));
 
@@ -685,20 +2121,32 @@ int action_rx(struct wpa_supplicant *wpa_s, const u8 *da, const u8 *sa,
 
 	wpa_printf(MSG_DEBUG, "Action frame type is %u, length is %zu", stype, len);
 
+	if((size_t) (pos - data) > len)
+		return -1;
+	rlen = len - (pos - data);
+
 	switch(stype){
 		case WLAN_PA_HYPERLOCAL_RESP:
 			wpa_printf(MSG_DEBUG, "Hyperlocal information is received");
 			if(len < 10)
 				ret = -1;
 			else
-				ret = deliver_notification(wpa_s, act, sa, pos, freq);
+				ret = deliver_notification(wpa_s, act, sa, pos, rlen, freq);
+			break;
+		case WLAN_PA_HYPERLOCAL_AGG_RESP:
+			wpa_printf(MSG_DEBUG, "Aggregated hyperlocal information is received");
+			ret = deliver_aggregate(wpa_s, act, sa, pos, rlen, freq);
+			break;
+		case WLAN_PA_HYPERLOCAL_FRAG_RESP:
+			wpa_printf(MSG_DEBUG, "A fragment of hyperlocal information is received");
+			ret = deliver_fragment(wpa_s, act, sa, pos, rlen, freq);
 			break;
 		case WLAN_PA_HYPERLOCAL_TTF_REQ:
 			wpa_printf(MSG_DEBUG, "A time to fetch response for your hyperlocal query is received");
-			if(len < 3)
+			if(rlen < 2)
 				ret = -1;
 			else{
-				ret = schedule_req(wpa_s, sa, pos, freq);
+				ret = schedule_req(wpa_s, sa, pos, rlen, freq);
 			}
 			break;
 		default:
@@ -711,7 +2159,6 @@ static void action_notification_req_dispatcher(struct wpa_supplicant *wpa_s,
 									const u8 *addr, int freq)
 {
 	int res;
-	const u8 *src = wpa_s->own_addr;
 	struct wpabuf *buf;
 
 	buf = wpabuf_alloc(4);
@@ -729,29 +2176,12 @@ static void action_notification_req_dispatcher(struct wpa_supplicant *wpa_s,
 
 	wpa_printf(MSG_DEBUG, "Notification request is being sent at frequency %d to " MACSTR, freq, MAC2STR(addr));
 
-	res =  offchannel_send_action(wpa_s, freq, addr, src, addr, wpabuf_head(buf), wpabuf_len(buf), 0, NULL, 0);
-	wpa_printf(MSG_DEBUG, "  offchannel_send_action res = %d", res);
-
-	wpa_printf(MSG_DEBUG, "Notification request is sent");
-	os_free(buf);
-}
- 
-void wpa_action_req_not(void *eloop_ctx, void *timeout_ctx){
-	struct wpa_supplicant *wpa_s = eloop_ctx;
-	struct wpa_bss *bss = timeout_ctx;
-
-	wpa_printf(MSG_DEBUG, "Notification indicator from probe response");
-	action_notification_req_dispatcher(wpa_s, bss->bssid, bss->freq);
-	wpa_action_notify_presence(wpa_s, 1);
+	res = action_tx(wpa_s, freq, addr, buf);
+	wpa_printf(MSG_DEBUG, "  action_tx res = %d", res);
 }
 
 void wpa_action_cleanup(struct wpa_supplicant *wpa_s){
-	char *buf = NULL;
-	char *pbuf, *dir = NULL;
-	size_t len;
-	int res;
 	struct action_handle *act = wpa_s->act;
-	struct action_pending *q, *qold = NULL;
 
 	wpa_printf(MSG_DEBUG, "Terminating notification unit");
 
@@ -760,55 +2190,55 @@ void wpa_action_cleanup(struct wpa_supplicant *wpa_s){
 		return;
 	}
 
+	/* Whatever is still batched goes out before the socket closes */
+	eloop_cancel_timeout(action_event_flush, act, NULL);
+	action_event_flush(act, NULL);
+	while(!dl_list_empty(&act->dst))
+		action_dst_free(act, dl_list_first(&act->dst, struct action_ctrl_dst, list));
+
 	eloop_unregister_read_sock(act->sock);
 	close(act->sock);
 	act->sock = -1;
 
-	if(wpa_s->conf->ctrl_interface != NULL){
-		pbuf = os_strdup(wpa_s->conf->ctrl_interface);
-
-		if (os_strncmp(pbuf, "DIR=", 4) == 0) {
-			char *gid_str;
-			dir = pbuf + 4;
-			gid_str = os_strstr(dir, " GROUP=");
-			if (gid_str)
-				*gid_str = '\0';
-		} else
-			dir = pbuf;
-
-		len = os_strlen(dir)+2+os_strlen(AFN_SOCKNAME);
-		buf = os_malloc(len);
-		if (buf == NULL) {
-			os_free(pbuf);
-			return;
-		}
-
-		res = os_snprintf(buf, len, "%s/%s", dir, AFN_SOCKNAME);
-		if (res < 0 || (size_t) res >= len) {
-			os_free(pbuf);
-			os_free(buf);
-			return;
-		}
-
-		os_free(pbuf);
-		if(buf){
-			unlink(buf);
-			os_free(buf);
-		}
+	if (act->sock_path){
+		unlink(act->sock_path);
+		os_free(act->sock_path);
+		act->sock_path = NULL;
 	}
 
 	wpa_printf(MSG_DEBUG, "Socket is unlinked");
 
-	dl_list_for_each(q, &act->pending, struct action_pending, list){
-		if(qold!=NULL)
-			os_free(qold);
-		qold=q;
+	while(!dl_list_empty(&act->queries))
+		action_query_free(dl_list_first(&act->queries, struct action_query, list));
+
+	while(!dl_list_empty(&act->qgroups)){
+		struct action_qgroup *g;
+
+		g = dl_list_first(&act->qgroups, struct action_qgroup, list);
+		dl_list_del(&g->list);
+		os_free(g);
+	}
+
+	eloop_cancel_timeout(action_fetch_timeout, act, NULL);
+	eloop_cancel_timeout(action_tx_next, act, NULL);
+	eloop_cancel_timeout(action_tx_timeout, act, NULL);
+	if (act->tx_cur)
+		action_tx_free(act->tx_cur);
+	while(!dl_list_empty(&act->tx_queue)){
+		struct action_tx *t;
+
+		t = dl_list_first(&act->tx_queue, struct action_tx, list);
+		dl_list_del(&t->list);
+		action_tx_free(t);
 	}
 
-	if(qold!=NULL)
-		os_free(qold);
+	while(!dl_list_empty(&act->seen_lru))
+		action_seen_free(act, dl_list_first(&act->seen_lru, struct action_seen, lru));
+
+	while(!dl_list_empty(&act->reasm))
+		action_reasm_free(dl_list_first(&act->reasm, struct action_reasm, list));
 
-	os_free(act->dst);
+	wpa_s->act = NULL;
 	os_free(act);
 	wpa_printf(MSG_DEBUG, "Everything is cleaned up");
 
@@ -11,6 +11,8 @@ void action_notification_add_indication(struct wpabuf *buf, int pps_mo_id);
 int action_rx(struct wpa_supplicant *wpa_s, const u8 *da, const u8 *sa,
 			const u8 *bssid, u8 categ, const u8 *data, size_t len, int freq);
 
-void wpa_action_req_not(void *eloop_ctx, void *timeout_ctx);
+void action_ind_scan(struct wpa_supplicant *wpa_s, const u8 *bssid, int freq,
+		     const u8 *ie, int new_bss);
+void action_scan_done(struct wpa_supplicant *wpa_s);
 void wpa_action_cleanup(struct wpa_supplicant *wpa_s);
 void wpa_action_notify_presence(struct wpa_supplicant *wpa_s, int type);
\ No newline at end of file
@@ -391,14 +391,8 @@ static struct wpa_bss * wpa_bss_add(struct wpa_supplicant *wpa_s,
 #ifdef CONFIG_ACTION_NOTIFICATION
 	{
 		const u8 *ie = wpa_scan_get_ie(res, WLAN_EID_NOT_INDICATOR);
-		if (ie && ie[1] == 2)
-		{
-			u16 tout;
-			os_memcpy(&tout, ie + 2, 2);
-			//wpa_printf(MSG_ERROR, "tout is %u", tout);
-			eloop_register_timeout(tout / 1000, 1000 * (tout % 1000), wpa_action_req_not,
-								   wpa_s, bss);
-		}
+		if (ie)
+			action_ind_scan(wpa_s, bss->bssid, bss->freq, ie, 1);
 	}
 #endif /* CONFIG_ACTION_NOTIFICATION */
 
@@ -553,6 +547,13 @@ wpa_bss_update(struct wpa_supplicant *wpa_s, struct wpa_bss *bss,
 	bss->scan_miss_count = 0;
 	bss->last_update_idx = wpa_s->bss_update_idx;
 	wpa_bss_copy_res(bss, res, fetch_time);
+#ifdef CONFIG_ACTION_NOTIFICATION
+	{
+		const u8 *ie = wpa_scan_get_ie(res, WLAN_EID_NOT_INDICATOR);
+		if (ie)
+			action_ind_scan(wpa_s, bss->bssid, bss->freq, ie, 0);
+	}
+#endif /* CONFIG_ACTION_NOTIFICATION */
 	/* Move the entry to the end of the list */
 	dl_list_del(&bss->list);
 #ifdef CONFIG_P2P
@@ -793,6 +794,9 @@ void wpa_bss_update_end(struct wpa_supplicant *wpa_s, struct scan_info *info,
 	struct wpa_bss *bss, *n;
 
 	os_get_reltime(&wpa_s->last_scan);
+#ifdef CONFIG_ACTION_NOTIFICATION
+	action_scan_done(wpa_s);
+#endif /* CONFIG_ACTION_NOTIFICATION */
 	if (!new_scan)
 		return; /* do not expire entries without new scan */
 
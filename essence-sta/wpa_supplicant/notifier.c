@@ -463,6 +463,102 @@ static int set_node_expire(struct wpa_ctrl *ctrl, int argc, char *argv[]){
 	return not_command(ctrl, cmd);
 }
 
+static int set_agg_len(struct wpa_ctrl *ctrl, int argc, char *argv[]){
+	char cmd[2048];
+	int res = 0;
+
+	if(argc < 1){
+		printf("Please enter the aggregated frame limit in bytes (0 disables aggregation)\n");
+		return -1;
+	}
+
+	res= os_snprintf(cmd, 2047, "SETAGGLEN %s", argv[0]);
+	if(res < 0 || res > 2047){
+		return -1;
+	}
+
+	printf("Aggregated frame limit is changed to %s\n", argv[0]);
+
+	return not_command(ctrl, cmd);
+}
+
+static int set_frag_len(struct wpa_ctrl *ctrl, int argc, char *argv[]){
+	char cmd[2048];
+	int res = 0;
+
+	if(argc < 1){
+		printf("Please enter the fragment size in bytes (512-2048)\n");
+		return -1;
+	}
+
+	res= os_snprintf(cmd, 2047, "SETFRAGLEN %s", argv[0]);
+	if(res < 0 || res > 2047){
+		return -1;
+	}
+
+	printf("Fragment size is changed to %s\n", argv[0]);
+
+	return not_command(ctrl, cmd);
+}
+
+static int set_tx_rate(struct wpa_ctrl *ctrl, int argc, char *argv[]){
+	char cmd[2048];
+	int res = 0;
+
+	if(argc < 2 || argc > 3){
+		printf("Please enter <frames/s> <bytes/s> [<per station frames/s>] (0 = unlimited)\n");
+		return -1;
+	}
+
+	if(argc == 3)
+		res = os_snprintf(cmd, 2047, "SETTXRATE %s %s %s", argv[0], argv[1], argv[2]);
+	else
+		res = os_snprintf(cmd, 2047, "SETTXRATE %s %s", argv[0], argv[1]);
+	if(res < 0 || res > 2047){
+		return -1;
+	}
+
+	return not_command(ctrl, cmd);
+}
+
+static int tx_stats(struct wpa_ctrl *ctrl, int argc, char *argv[]){
+	return not_command(ctrl, "TXSTATS");
+}
+
+static int set_query_cache(struct wpa_ctrl *ctrl, int argc, char *argv[]){
+	char cmd[2048];
+	int res = 0;
+
+	if(argc < 1){
+		printf("Please enter 1 to cache query answers or 0 to forward every query\n");
+		return -1;
+	}
+
+	res = os_snprintf(cmd, 2047, "QCACHE %s", argv[0]);
+	if(res < 0 || res > 2047){
+		return -1;
+	}
+
+	return not_command(ctrl, cmd);
+}
+
+static int set_tx_attempts(struct wpa_ctrl *ctrl, int argc, char *argv[]){
+	char cmd[2048];
+	int res = 0;
+
+	if(argc < 1){
+		printf("Please enter the number of sends per directed notification (0 disables ACK tracking)\n");
+		return -1;
+	}
+
+	res = os_snprintf(cmd, 2047, "SETTXATTEMPTS %s", argv[0]);
+	if(res < 0 || res > 2047){
+		return -1;
+	}
+
+	return not_command(ctrl, cmd);
+}
+
 
 struct not_cmd {
 	const char *cmd;
@@ -482,6 +578,12 @@ static struct not_cmd not_commands[] = {
 	{ "btest" , test_broadcast },
 	{ "dtest" , test_dynamic },
 	{ "expirenode" , set_node_expire },
+	{ "agglen" , set_agg_len },
+	{ "fraglen" , set_frag_len },
+	{ "txrate" , set_tx_rate },
+	{ "txstats" , tx_stats },
+	{ "txattempts" , set_tx_attempts },
+	{ "qcache" , set_query_cache },
 	{ NULL, NULL }
 };
 
@@ -1,41 +1,36 @@
-import time
-import socket
+import asyncio
+import os
 import sys
-from ctypes import cdll
-from thread import *
 
-lib = cdll.LoadLibrary('./wpa_not.so')
+# The binding lives with libhyperlocal in the hostapd tree
+sys.path.insert(0, os.environ.get("HYPERLOCAL_PY", os.path.join(
+    os.path.dirname(os.path.abspath(__file__)), "../../essence-ap/hostapd")))
+import hyperlocal  # noqa: E402
 
-message = "hl_query"
+path = sys.argv[1] if len(sys.argv) > 1 else "/var/run/wpa_supplicant/wpa_wipush"
 
-def start_wpa_not(p):
-    print lib.wpa_not_init()
+message = b"Hello, how are you?"
 
-def start_pystub_listener(p):
-    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
-    try:
-    	s.bind(("localhost", 9998))
-    except socket.error as msg:
-    	print 'Bind failed. Error Code : ' + str(msg[0]) + ' Message ' + msg[1]
-    	sys.exit()
-    	
-    s.listen(10)
-    conn, addr = s.accept()
 
-    while True:
-        data = conn.recv(1024)
-        if len(data) > 0:
-            print "Data received: ", data
+def handle_event(ev):
+    if ev.type == hyperlocal.EVENT_MSG:
+        print("Message", ev.mid, "from", ev.addr, "query", ev.qid, ":",
+              ev.data)
+    elif ev.type == hyperlocal.EVENT_QDONE:
+        print("Query", ev.qid, "done,", ev.answered, "answered,",
+              ev.failed, "failed")
+    elif ev.type == hyperlocal.EVENT_QFAIL:
+        print("Query", ev.qid, "failed")
 
-start_new_thread(start_pystub_listener, (0,))
 
-time.sleep(1) 
+async def main():
+    client = hyperlocal.Client(hyperlocal.STA, path, on_event=handle_event)
 
-start_new_thread(start_wpa_not, (0,))
+    qid = await client.query(None, message)
+    print("Query", qid, "sent")
 
-time.sleep(1) 
+    while True:
+        await asyncio.sleep(10)
 
-lib.wpa_not_process_command(message)
 
-while (1):
-    time.sleep(10)
+asyncio.run(main())
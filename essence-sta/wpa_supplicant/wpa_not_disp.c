@@ -7,10 +7,10 @@
 #include "utils/list.h"
 #include "common/version.h"
 #include "common/ieee802_11_defs.h"
+#include "common/hyperlocal_ring.h"
 #ifdef ANDROID
 #include <cutils/properties.h>
 #endif /* ANDROID */
-#include <netdb.h>
 
 static struct wpa_ctrl *mon_conn;
 #ifndef CONFIG_CTRL_IFACE_DIR
@@ -58,47 +58,21 @@ static void clean_wipush_messages(){
 	}
 }
 
-int *pystub_sockfd;
-#define NOT_PYSTUB_PORT_NO 9998
-static int not_connect_pystub()
-{
-	int sockfd, portno, n;
-	
-	struct sockaddr_in serv_addr;
-	struct hostent *server;
-	
-	char buffer[256];
-
-	portno = NOT_PYSTUB_PORT_NO;
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	if (sockfd < 0){
-		printf("ERROR opening socket for pystub\n");
-		return -1;
-	}
-	server = gethostbyname("localhost");
-	if (server == NULL){
-		printf("ERROR, no such host\n");
-		return -1;
-	}
-	bzero((char *) &serv_addr, sizeof(serv_addr));
-	serv_addr.sin_family = AF_INET;
-	bcopy((char *)server->h_addr, 
-	     (char *)&serv_addr.sin_addr.s_addr,
-	     server->h_length);
-	serv_addr.sin_port = htons(portno);
-	if (connect(sockfd,(struct sockaddr *)&serv_addr,sizeof(serv_addr)) < 0){ 
-		printf("ERROR connecting the pystub\n");
-		return -1;
-	}
-
-	printf("Successfully connected to pystub\n");	
-	pystub_sockfd = &sockfd;
-	return 0;
-}
+/* Events for the application, see hyperlocal_ring.h */
+#define NOT_RING_SIZE (256 * 1024)
+static struct hl_ring *not_ring;
 
-static int not_disconnect_pystub()
+/*
+ * The ring the events go to. The application calls this before it runs
+ * wpa_not_init() in another thread and reads the events from the ring in
+ * place. The ring stays as long as the library is loaded, so the last
+ * events can be read after wpa_not_init() returns.
+ */
+struct hl_ring * not_event_ring(void)
 {
-	close(*pystub_sockfd);
+	if (not_ring == NULL)
+		not_ring = hl_ring_create(NOT_RING_SIZE);
+	return not_ring;
 }
 
 static void not_disp_msg_cb(char *msg, size_t len)
@@ -275,7 +249,8 @@ static void process_notification(const char *not){
 	if(myn)
 		show_not(myn, hwaddr);
 
-	if(type){
+	/* Type 2 answers one of our queries */
+	if(type == 1){
 		if(cur_mid != NULL){
 			printf("I am already processing a notification\n");
 			goto fail;
@@ -364,7 +339,8 @@ static void not_disp_recv_pending(struct wpa_ctrl *ctrl)
 			buf[len] = '\0';
 			edit_clear_line();
 			not_event(buf);
-			write(*pystub_sockfd, buf, len);
+			if (not_ring)
+				hl_ring_write(not_ring, buf, len);
 			edit_redraw();
 		} else {
 			printf("Could not read pending message.\n");
@@ -702,13 +678,12 @@ int wpa_not_init(int argc, char *argv[])
 	eloop_register_signal_terminate(not_disp_terminate, NULL);
 	eloop_register_timeout(4000, 0, not_disp_end, NULL, NULL);
 	
-	not_connect_pystub();
+	not_event_ring();
 
 	not_disp();
 
 	eloop_destroy();
 	not_disp_cleanup();
-	not_disconnect_pystub();
 	os_program_deinit();
 
 	return 0;